@@ -0,0 +1,325 @@
+// SPDX-License-Identifier: GPL-2.0-or-later OR MIT
+/*
+ * fan control daemon for MICON v2 of Buffalo TeraStation
+ *
+ * The sensors and fan1_target of the MICON hwmon are opened once and
+ * sampled every period. The fan is stepped up as soon as a sensor reaches
+ * the threshold of the step, and down one step at a time after both
+ * sensors have stayed below the thresholds minus the hysteresis for the
+ * ramp-down delay. fan1_target is written only when the step changes.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <glob.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MICON_HWMON	"/sys/devices/platform/ts-miconv2/ts-miconv2-hwmon/hwmon/hwmon*"
+#define I2C_TSENS	"/sys/class/i2c-dev/i2c-0/device/0-00*/hwmon/hwmon*/temp1_input"
+#define SOC_TSENS	"/sys/devices/virtual/thermal/thermal_zone0/hwmon*/temp1_input"
+
+#define PERIOD_DEF	10	/* seconds */
+#define DELAY_DEF	60	/* seconds below the band before stepping down */
+#define HYST_DEF	3	/* celsius */
+
+enum {
+	FAN_STOP,
+	FAN_LOW,
+	FAN_MID,
+	FAN_HIG,
+};
+
+/* SoC:System (celsius), the fan runs at the next step from these */
+struct fan_thres {
+	int soc;
+	int sys;
+};
+
+static struct fan_thres thres[FAN_HIG] = {
+	[FAN_STOP] = { 38, 28 },	/* SOCSYS_TEMP_LOW */
+	[FAN_LOW]  = { 48, 38 },	/* SOCSYS_TEMP_MID */
+	[FAN_MID]  = { 53, 43 },	/* SOCSYS_TEMP_HIG */
+};
+
+static struct fan_thres hyst = { HYST_DEF, HYST_DEF };
+
+struct sensor {
+	const char *name;
+	int fd;
+};
+
+static struct sensor micon_ts = { "MICON", -1 };
+static struct sensor i2c_ts = { "I2C", -1 };
+static struct sensor soc_ts = { "SoC", -1 };
+static int fan_fd = -1;
+static bool verbose = false;
+static volatile sig_atomic_t terminated = 0;
+
+static void __attribute__((format(printf, 1, 2)))
+pr_info(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	fputs("info: ", stderr);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+}
+
+/* the first match of the pattern, opened */
+static int open_glob(const char *pattern, const char *file, int flags)
+{
+	char path[256];
+	glob_t g;
+	int fd = -1;
+
+	if (glob(pattern, 0, NULL, &g))
+		return -1;
+	snprintf(path, sizeof(path), "%s%s", g.gl_pathv[0], file ? file : "");
+	fd = open(path, flags | O_CLOEXEC);
+	globfree(&g);
+
+	return fd;
+}
+
+static int read_long(int fd, long *val)
+{
+	char buf[32], *end;
+	ssize_t len;
+
+	len = pread(fd, buf, sizeof(buf) - 1, 0);
+	if (len <= 0)
+		return -1;
+	buf[len] = '\0';
+	errno = 0;
+	*val = strtol(buf, &end, 10);
+	if (errno || end == buf)
+		return -1;
+
+	return 0;
+}
+
+/* celsius */
+static int read_temp(struct sensor *s, int *temp)
+{
+	long val;
+
+	if (s->fd < 0 || read_long(s->fd, &val))
+		return -1;
+	*temp = val / 1000;
+
+	return 0;
+}
+
+static int write_fan(int step)
+{
+	char buf[4];
+	int len;
+
+	len = snprintf(buf, sizeof(buf), "%d\n", step);
+	if (pwrite(fan_fd, buf, len, 0) != len) {
+		fprintf(stderr, "err: failed to set the fan (%s)\n",
+			strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+/* the step for the temperatures, lowered by the hysteresis if "down" */
+static int fan_step(int soc, int sys, bool down)
+{
+	int i;
+
+	for (i = FAN_STOP; i < FAN_HIG; i++) {
+		if (soc < thres[i].soc - (down ? hyst.soc : 0) &&
+		    sys < thres[i].sys - (down ? hyst.sys : 0))
+			return i;
+	}
+
+	return FAN_HIG;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void handle_signal(int sig)
+{
+	terminated = 1;
+}
+
+/* "<soc>:<sys>" */
+static int parse_pair(const char *str, struct fan_thres *t)
+{
+	char *end;
+
+	t->soc = strtol(str, &end, 10);
+	if (end == str || *end != ':')
+		return -1;
+	str = end + 1;
+	t->sys = strtol(str, &end, 10);
+	if (end == str || *end)
+		return -1;
+
+	return 0;
+}
+
+static void print_usage(char *program)
+{
+	printf("Usage: %s [options]\n\n", program);
+	printf("Options:\n\n"
+	       "  -p <sec>         sampling period (default: %d)\n"
+	       "  -d <sec>         ramp-down delay (default: %d)\n"
+	       "  -l <soc>:<sys>   thresholds of low step (default: %d:%d)\n"
+	       "  -m <soc>:<sys>   thresholds of middle step (default: %d:%d)\n"
+	       "  -H <soc>:<sys>   thresholds of high step (default: %d:%d)\n"
+	       "  -b <soc>:<sys>   hysteresis bands (default: %d:%d)\n"
+	       "  -v               print the temperatures of each sample\n"
+	       "  -h               show this help\n",
+	       PERIOD_DEF, DELAY_DEF,
+	       thres[FAN_STOP].soc, thres[FAN_STOP].sys,
+	       thres[FAN_LOW].soc, thres[FAN_LOW].sys,
+	       thres[FAN_MID].soc, thres[FAN_MID].sys,
+	       hyst.soc, hyst.sys);
+}
+
+int main(int argc, char **argv)
+{
+	struct sigaction sa = { .sa_handler = handle_signal };
+	struct sensor *sys_ts;
+	struct timespec ts;
+	int period = PERIOD_DEF, delay = DELAY_DEF;
+	int c, soc, sys, cur, next;
+	double down_since = 0;
+	long val;
+
+	while ((c = getopt(argc, argv, "p:d:l:m:H:b:vh")) != -1) {
+		switch (c) {
+		case 'p':
+			period = atoi(optarg);
+			break;
+		case 'd':
+			delay = atoi(optarg);
+			break;
+		case 'l':
+		case 'm':
+		case 'H':
+		case 'b':
+			if (parse_pair(optarg, c == 'b' ? &hyst :
+				       &thres[c == 'l' ? FAN_STOP :
+					      c == 'm' ? FAN_LOW : FAN_MID])) {
+				fprintf(stderr, "err: invalid value \"%s\"\n",
+					optarg);
+				return 1;
+			}
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		default:
+			print_usage(argv[0]);
+			return c == 'h' ? 0 : 1;
+		}
+	}
+	if (period < 1)
+		period = 1;
+	if (delay < 0)
+		delay = 0;
+
+	fan_fd = open_glob(MICON_HWMON, "/fan1_target", O_RDWR);
+	if (fan_fd < 0) {
+		fprintf(stderr, "err: MICON hwmon device is unavailable\n");
+		return 1;
+	}
+	micon_ts.fd = open_glob(MICON_HWMON, "/temp1_input", O_RDONLY);
+	i2c_ts.fd = open_glob(I2C_TSENS, NULL, O_RDONLY);
+	soc_ts.fd = open_glob(SOC_TSENS, NULL, O_RDONLY);
+	if (micon_ts.fd < 0 && i2c_ts.fd < 0) {
+		fprintf(stderr, "err: there is no available thermal sensor for system\n");
+		return 1;
+	}
+
+	cur = read_long(fan_fd, &val) || val < FAN_STOP || val > FAN_HIG ?
+		-1 : val;
+
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+
+	while (!terminated) {
+		/* MICON returns an error sometimes, the I2C one is used then */
+		sys_ts = &micon_ts;
+		if (read_temp(sys_ts, &sys)) {
+			sys_ts = &i2c_ts;
+			if (read_temp(sys_ts, &sys))
+				sys_ts = NULL;
+		}
+		/* no SoC sensor on some models, the system one decides */
+		if (read_temp(&soc_ts, &soc))
+			soc = -273;
+
+		if (!sys_ts) {
+			fprintf(stderr, "err: failed to read the thermal sensors\n");
+			next = FAN_HIG;
+		} else {
+			if (verbose)
+				pr_info("SoC: %d celsius, System (%s): %d celsius\n",
+					soc, sys_ts->name, sys);
+			next = fan_step(soc, sys, false);
+		}
+
+		if (cur < 0 || next > cur) {
+			down_since = 0;
+		} else if (next < cur) {
+			next = fan_step(soc, sys, true);
+			if (next >= cur) {
+				/* still in the band */
+				next = cur;
+				down_since = 0;
+			} else {
+				if (!down_since)
+					down_since = now();
+				if (now() - down_since < delay) {
+					next = cur;
+				} else {
+					/* one step per delay */
+					next = cur - 1;
+					down_since = now();
+				}
+			}
+		} else {
+			down_since = 0;
+		}
+
+		if (next != cur && !write_fan(next)) {
+			pr_info("Fan: %d --> %d (SoC: %d, System: %d)\n",
+				cur, next, soc, sys);
+			cur = next;
+		}
+
+		ts.tv_sec = period;
+		ts.tv_nsec = 0;
+		while (nanosleep(&ts, &ts) && errno == EINTR && !terminated)
+			;
+	}
+
+	/* nothing controls the fan after this */
+	if (cur != FAN_HIG)
+		write_fan(FAN_HIG);
+
+	return 0;
+}
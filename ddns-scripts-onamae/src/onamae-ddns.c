@@ -0,0 +1,583 @@
+// SPDX-License-Identifier: MIT
+/*
+ * client for the DDNS protocol of onamae.com
+ *
+ * The commands are sent over TLS (mbedTLS) to ddnsclient.onamae.com:65010
+ * and the replies are parsed in a single pass as they arrive. All domains
+ * are updated in one session, a MODIP block for each of them between LOGIN
+ * and LOGOUT, and the numbered replies are mapped back to the domains. The TLS
+ * session is saved on tmpfs after each run and offered on the next one, so
+ * the full handshake is skipped while the server still accepts the session.
+ *
+ * The credentials are taken from ONAMAE_USERID and ONAMAE_PASSWORD in the
+ * environment to keep them out of the command line.
+ *
+ * exit codes, same as the update scripts of ddns-scripts:
+ *   0: updated, 1: failed (network, TLS or server error), 127: invalid config
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <mbedtls/ctr_drbg.h>
+#include <mbedtls/entropy.h>
+#include <mbedtls/error.h>
+#include <mbedtls/net_sockets.h>
+#include <mbedtls/platform_util.h>
+#include <mbedtls/ssl.h>
+#include <mbedtls/x509_crt.h>
+#ifdef MBEDTLS_PSA_CRYPTO_C
+#include <psa/crypto.h>
+#endif
+
+#define ENDPOINT	"ddnsclient.onamae.com"
+#define ENDPOINT_PORT	"65010"
+#define CA_FILE		"/etc/ssl/certs/ca-certificates.crt"
+#define SESSION_FILE	"/tmp/onamae-ddns.session"
+#define LOCK_FILE	"/tmp/onamae-ddns.lock"
+
+#define TIMEOUT		15000	/* ms, for each read */
+#define SESSION_LEN	4096	/* serialized session */
+#define DOMAIN_MAX	32	/* in a session */
+#define CMD_LEN		16384
+#define LINE_LEN	512
+
+#define REPLY_OK	0	/* "000 COMMAND SUCCESSFUL" */
+
+enum {
+	RET_OK = 0,
+	RET_FAIL = 1,
+	RET_CONFIG = 127,
+};
+
+struct tls {
+	mbedtls_net_context net;
+	mbedtls_ssl_context ssl;
+	mbedtls_ssl_config conf;
+	mbedtls_x509_crt ca;
+	mbedtls_entropy_context entropy;
+	mbedtls_ctr_drbg_context drbg;
+};
+
+static bool verbose = false;
+
+static void tls_perror(const char *what, int ret)
+{
+	char buf[128];
+
+	mbedtls_strerror(ret, buf, sizeof(buf));
+	fprintf(stderr, "err: %s failed (-0x%04x: %s)\n", what, -ret, buf);
+}
+
+/* the fields are sent as the lines of the commands */
+static bool valid_field(const char *str)
+{
+	return *str && !strpbrk(str, "\r\n");
+}
+
+/*
+ * "test.www.example.com" -> host: "test.www", domain: "example.com"
+ * host is empty for the second level domain itself
+ */
+static int split_domain(const char *fqdn, char *host, size_t host_len,
+			const char **domain)
+{
+	const char *tld, *scnd;
+
+	tld = strrchr(fqdn, '.');
+	if (!tld || tld == fqdn || !tld[1])
+		return -1;
+	for (scnd = tld; scnd > fqdn && scnd[-1] != '.'; scnd--)
+		;
+	if (scnd == tld)
+		return -1;
+
+	if (scnd == fqdn) {
+		host[0] = '\0';
+	} else {
+		if (scnd - 1 == fqdn ||
+		    (size_t)(scnd - 1 - fqdn) >= host_len)
+			return -1;
+		memcpy(host, fqdn, scnd - 1 - fqdn);
+		host[scnd - 1 - fqdn] = '\0';
+	}
+	*domain = scnd;
+
+	return 0;
+}
+
+/*
+ * LOGIN, MODIP for each domain and LOGOUT, each block is terminated by "."
+ * The server replies to them in order, after its greeting.
+ */
+static int build_cmds(char *buf, size_t size, const char *user,
+		      const char *pass, char **fqdns, int n, const char *ip)
+{
+	char host[256];
+	const char *domain;
+	size_t len;
+	int i, ret;
+
+	ret = snprintf(buf, size, "LOGIN\nUSERID:%s\nPASSWORD:%s\n.\n",
+		       user, pass);
+	if (ret < 0 || (size_t)ret >= size)
+		goto too_long;
+	len = ret;
+
+	for (i = 0; i < n; i++) {
+		if (split_domain(fqdns[i], host, sizeof(host), &domain)) {
+			fprintf(stderr, "err: invalid domain name \"%s\"\n",
+				fqdns[i]);
+			return -1;
+		}
+		ret = snprintf(buf + len, size - len,
+			       "MODIP\n%s%s%sDOMNAME:%s\nIPV4:%s\n.\n",
+			       host[0] ? "HOSTNAME:" : "", host,
+			       host[0] ? "\n" : "", domain, ip);
+		if (ret < 0 || (size_t)ret >= size - len)
+			goto too_long;
+		len += ret;
+	}
+
+	ret = snprintf(buf + len, size - len, "LOGOUT\n.\n");
+	if (ret < 0 || (size_t)ret >= size - len)
+		goto too_long;
+
+	return len + ret;
+
+too_long:
+	fprintf(stderr, "err: too long command\n");
+	return -1;
+}
+
+/* returns true if the cached session is offered */
+static bool session_load(struct tls *t, const char *path)
+{
+	unsigned char buf[SESSION_LEN];
+	mbedtls_ssl_session sess;
+	bool offered = false;
+	ssize_t len;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+	len = read(fd, buf, sizeof(buf));
+	close(fd);
+	if (len <= 0)
+		return false;
+
+	mbedtls_ssl_session_init(&sess);
+	if (!mbedtls_ssl_session_load(&sess, buf, len) &&
+	    !mbedtls_ssl_set_session(&t->ssl, &sess)) {
+		offered = true;
+		if (verbose)
+			fprintf(stderr, "info: offering the cached session\n");
+	}
+	mbedtls_ssl_session_free(&sess);
+	mbedtls_platform_zeroize(buf, sizeof(buf));
+
+	return offered;
+}
+
+/* the session holds the master secret, written to tmpfs only for root */
+static void session_save(struct tls *t, const char *path)
+{
+	unsigned char buf[SESSION_LEN];
+	char tmp[256];
+	mbedtls_ssl_session sess;
+	size_t len = 0;
+	int fd, ret;
+
+	mbedtls_ssl_session_init(&sess);
+	ret = mbedtls_ssl_get_session(&t->ssl, &sess);
+	if (!ret)
+		ret = mbedtls_ssl_session_save(&sess, buf, sizeof(buf), &len);
+	mbedtls_ssl_session_free(&sess);
+	if (ret) {
+		/* no ticket from the server, don't offer the old one again */
+		unlink(path);
+		return;
+	}
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd < 0) {
+		fprintf(stderr, "err: failed to open \"%s\" (%s)\n",
+			tmp, strerror(errno));
+		goto out;
+	}
+	ret = write(fd, buf, len) != (ssize_t)len;
+	close(fd);
+	if (ret || rename(tmp, path)) {
+		fprintf(stderr, "err: failed to save the session to \"%s\"\n",
+			path);
+		unlink(tmp);
+	}
+
+out:
+	mbedtls_platform_zeroize(buf, sizeof(buf));
+}
+
+/*
+ * returns -2 if the handshake failed with the cached session offered,
+ * to be retried without it
+ */
+static int tls_connect(struct tls *t, const char *ca_file, bool insecure,
+		       const char *session)
+{
+	static const char pers[] = "onamae-ddns";
+	bool offered = false;
+	struct stat st;
+	int ret;
+
+	mbedtls_net_init(&t->net);
+	mbedtls_ssl_init(&t->ssl);
+	mbedtls_ssl_config_init(&t->conf);
+	mbedtls_x509_crt_init(&t->ca);
+	mbedtls_entropy_init(&t->entropy);
+	mbedtls_ctr_drbg_init(&t->drbg);
+#ifdef MBEDTLS_PSA_CRYPTO_C
+	psa_crypto_init();
+#endif
+
+	ret = mbedtls_ctr_drbg_seed(&t->drbg, mbedtls_entropy_func,
+				    &t->entropy, (const unsigned char *)pers,
+				    sizeof(pers) - 1);
+	if (ret) {
+		tls_perror("seeding the random generator", ret);
+		return -1;
+	}
+
+	if (!insecure) {
+		/* a bundle or a directory, like cacert of ddns-scripts */
+		if (!stat(ca_file, &st) && S_ISDIR(st.st_mode))
+			ret = mbedtls_x509_crt_parse_path(&t->ca, ca_file);
+		else
+			ret = mbedtls_x509_crt_parse_file(&t->ca, ca_file);
+		if (ret < 0) {
+			tls_perror("loading the CA certificates", ret);
+			return -1;
+		}
+	}
+
+	ret = mbedtls_ssl_config_defaults(&t->conf, MBEDTLS_SSL_IS_CLIENT,
+					  MBEDTLS_SSL_TRANSPORT_STREAM,
+					  MBEDTLS_SSL_PRESET_DEFAULT);
+	if (ret) {
+		tls_perror("setting up TLS", ret);
+		return -1;
+	}
+	mbedtls_ssl_conf_authmode(&t->conf, insecure ?
+				  MBEDTLS_SSL_VERIFY_NONE :
+				  MBEDTLS_SSL_VERIFY_REQUIRED);
+	mbedtls_ssl_conf_ca_chain(&t->conf, &t->ca, NULL);
+	mbedtls_ssl_conf_rng(&t->conf, mbedtls_ctr_drbg_random, &t->drbg);
+	mbedtls_ssl_conf_read_timeout(&t->conf, TIMEOUT);
+
+	ret = mbedtls_ssl_setup(&t->ssl, &t->conf);
+	if (!ret)
+		ret = mbedtls_ssl_set_hostname(&t->ssl, ENDPOINT);
+	if (ret) {
+		tls_perror("setting up TLS", ret);
+		return -1;
+	}
+	if (session)
+		offered = session_load(t, session);
+
+	ret = mbedtls_net_connect(&t->net, ENDPOINT, ENDPOINT_PORT,
+				  MBEDTLS_NET_PROTO_TCP);
+	if (ret) {
+		tls_perror("connecting to " ENDPOINT, ret);
+		return -1;
+	}
+	mbedtls_ssl_set_bio(&t->ssl, &t->net, mbedtls_net_send, NULL,
+			    mbedtls_net_recv_timeout);
+
+	do {
+		ret = mbedtls_ssl_handshake(&t->ssl);
+	} while (ret == MBEDTLS_ERR_SSL_WANT_READ ||
+		 ret == MBEDTLS_ERR_SSL_WANT_WRITE);
+	if (ret) {
+		tls_perror("TLS handshake", ret);
+		/* may be the cached one rejected in a broken way */
+		if (offered) {
+			unlink(session);
+			return -2;
+		}
+		return -1;
+	}
+
+	if (verbose)
+		fprintf(stderr, "info: connected (%s, %s)\n",
+			mbedtls_ssl_get_version(&t->ssl),
+			mbedtls_ssl_get_ciphersuite(&t->ssl));
+
+	return 0;
+}
+
+static void tls_close(struct tls *t)
+{
+	mbedtls_ssl_close_notify(&t->ssl);
+	mbedtls_net_free(&t->net);
+	mbedtls_ssl_free(&t->ssl);
+	mbedtls_ssl_config_free(&t->conf);
+	mbedtls_x509_crt_free(&t->ca);
+	mbedtls_ctr_drbg_free(&t->drbg);
+	mbedtls_entropy_free(&t->entropy);
+}
+
+static int tls_write_all(struct tls *t, const char *buf, size_t len)
+{
+	int ret;
+
+	while (len) {
+		ret = mbedtls_ssl_write(&t->ssl, (const unsigned char *)buf, len);
+		if (ret == MBEDTLS_ERR_SSL_WANT_READ ||
+		    ret == MBEDTLS_ERR_SSL_WANT_WRITE)
+			continue;
+		if (ret < 0) {
+			tls_perror("sending the commands", ret);
+			return -1;
+		}
+		buf += ret;
+		len -= ret;
+	}
+
+	return 0;
+}
+
+/* the greeting, LOGIN, MODIP for each domain and LOGOUT */
+static const char *reply_name(int i, char **fqdns, int n)
+{
+	if (i == 0)
+		return "greeting";
+	if (i == 1)
+		return "LOGIN";
+	if (i < n + 2)
+		return fqdns[i - 2];
+
+	return "LOGOUT";
+}
+
+/* one line of the replies, counted if it is "NNN <message>" */
+static void reply_line(char *line, char **fqdns, int n, int *replies,
+		       int *ok)
+{
+	size_t len = strlen(line);
+	int code;
+
+	if (len > 0 && line[len - 1] == '\r')
+		line[len - 1] = '\0';
+	if (!(line[0] >= '0' && line[0] <= '9' &&
+	      line[1] >= '0' && line[1] <= '9' &&
+	      line[2] >= '0' && line[2] <= '9' &&
+	      (line[3] == ' ' || line[3] == '\t')))
+		return;
+
+	code = atoi(line);
+	if (code == REPLY_OK)
+		(*ok)++;
+	if (code != REPLY_OK || (*replies >= 2 && *replies < n + 2))
+		printf("%s: %s\n", reply_name(*replies, fqdns, n), line);
+	(*replies)++;
+}
+
+/*
+ * "NNN <message>" for each command, followed by "."
+ * The results of the domains and the other error replies are printed to
+ * stdout as "<domain or command>: <reply>" for the log of ddns-scripts.
+ * Returns the number of successful replies, or -1 on error of the stream.
+ */
+static int read_replies(struct tls *t, char **fqdns, int n)
+{
+	char buf[LINE_LEN], *line, *nl;
+	int expect = n + 3, replies = 0, ok = 0, ret;
+	size_t len = 0;
+
+	while (replies < expect) {
+		ret = mbedtls_ssl_read(&t->ssl, (unsigned char *)buf + len,
+				       sizeof(buf) - 1 - len);
+		if (ret == MBEDTLS_ERR_SSL_WANT_READ ||
+		    ret == MBEDTLS_ERR_SSL_WANT_WRITE)
+			continue;
+#ifdef MBEDTLS_ERR_SSL_RECEIVED_NEW_SESSION_TICKET
+		if (ret == MBEDTLS_ERR_SSL_RECEIVED_NEW_SESSION_TICKET)
+			continue;
+#endif
+		if (ret == 0 || ret == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY) {
+			/* the last reply without '\n' before the close */
+			if (len > 0) {
+				buf[len] = '\0';
+				reply_line(buf, fqdns, n, &replies, &ok);
+			}
+			break;
+		}
+		if (ret < 0) {
+			tls_perror("reading the replies", ret);
+			return -1;
+		}
+		len += ret;
+		buf[len] = '\0';
+
+		line = buf;
+		while ((nl = strchr(line, '\n'))) {
+			*nl = '\0';
+			reply_line(line, fqdns, n, &replies, &ok);
+			line = nl + 1;
+		}
+		len -= line - buf;
+		memmove(buf, line, len);
+		/* a line longer than the buffer is not a reply */
+		if (len == sizeof(buf) - 1)
+			len = 0;
+	}
+
+	/* closed by the server, e.g. after an error of LOGIN */
+	for (; replies < n + 2; replies++) {
+		if (replies >= 2)
+			printf("%s: no reply\n", fqdns[replies - 2]);
+	}
+
+	return ok;
+}
+
+static void print_usage(char *program)
+{
+	printf("Usage: %s [options] <domain> [<domain>...] <IPv4 address>\n\n", program);
+	printf("Options:\n\n"
+	       "  -c <path>        CA certificates, file or directory (default: %s)\n"
+	       "  -k               don't verify the certificate of the server (implies -S)\n"
+	       "  -s <file>        TLS session cache (default: %s)\n"
+	       "  -S               don't cache the TLS session\n"
+	       "  -v               print the progress to stderr\n"
+	       "  -h               show this help\n\n"
+	       "Environment:\n\n"
+	       "  ONAMAE_USERID    user ID of onamae.com\n"
+	       "  ONAMAE_PASSWORD  password of onamae.com\n",
+	       CA_FILE, SESSION_FILE);
+}
+
+int main(int argc, char **argv)
+{
+	const char *ca_file = CA_FILE, *session = SESSION_FILE;
+	const char *user, *pass, *ip;
+	char **fqdns;
+	struct in_addr addr;
+	struct tls t;
+	char cmds[CMD_LEN];
+	bool insecure = false;
+	int c, i, n, len, lock_fd, ok, err, ret = RET_FAIL;
+
+	while ((c = getopt(argc, argv, "c:ks:Svh")) != -1) {
+		switch (c) {
+		case 'c':
+			ca_file = optarg;
+			break;
+		case 'k':
+			insecure = true;
+			break;
+		case 's':
+			session = optarg;
+			break;
+		case 'S':
+			session = NULL;
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		default:
+			print_usage(argv[0]);
+			return c == 'h' ? RET_OK : RET_CONFIG;
+		}
+	}
+	n = argc - optind - 1;
+	if (n < 1) {
+		print_usage(argv[0]);
+		return RET_CONFIG;
+	}
+	if (n > DOMAIN_MAX) {
+		fprintf(stderr, "err: too many domains (max: %d)\n", DOMAIN_MAX);
+		return RET_CONFIG;
+	}
+	fqdns = &argv[optind];
+	ip = argv[argc - 1];
+	/*
+	 * a session with an unverified server is not resumed by the verified
+	 * runs, nor the verified one handed to it
+	 */
+	if (insecure)
+		session = NULL;
+
+	user = getenv("ONAMAE_USERID");
+	pass = getenv("ONAMAE_PASSWORD");
+	if (!user || !valid_field(user) || !pass || !valid_field(pass)) {
+		fprintf(stderr, "err: ONAMAE_USERID or ONAMAE_PASSWORD is missing or invalid\n");
+		return RET_CONFIG;
+	}
+	for (i = 0; i < n; i++) {
+		if (!valid_field(fqdns[i])) {
+			fprintf(stderr, "err: invalid domain name \"%s\"\n",
+				fqdns[i]);
+			return RET_CONFIG;
+		}
+	}
+	if (inet_pton(AF_INET, ip, &addr) != 1) {
+		fprintf(stderr, "err: invalid IPv4 address \"%s\"\n", ip);
+		return RET_CONFIG;
+	}
+
+	len = build_cmds(cmds, sizeof(cmds), user, pass, fqdns, n, ip);
+	if (len < 0)
+		return RET_CONFIG;
+
+	/* the server doesn't like concurrent logins of the same user */
+	lock_fd = open(LOCK_FILE, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (lock_fd < 0 || flock(lock_fd, LOCK_EX)) {
+		fprintf(stderr, "err: failed to lock \"%s\" (%s)\n",
+			LOCK_FILE, strerror(errno));
+		goto out;
+	}
+
+	err = tls_connect(&t, ca_file, insecure, session);
+	if (err == -2) {
+		if (verbose)
+			fprintf(stderr, "info: retrying without the cached session\n");
+		tls_close(&t);
+		err = tls_connect(&t, ca_file, insecure, NULL);
+	}
+	if (err)
+		goto out_tls;
+	if (tls_write_all(&t, cmds, len))
+		goto out_tls;
+
+	ok = read_replies(&t, fqdns, n);
+	if (ok < 0)
+		goto out_tls;
+	if (session)
+		session_save(&t, session);
+	/* all or nothing for ddns-scripts, the domains are retried together */
+	if (ok == n + 3)
+		ret = RET_OK;
+	else if (verbose)
+		fprintf(stderr, "info: %d of %d replies succeeded\n", ok, n + 3);
+
+out_tls:
+	tls_close(&t);
+out:
+	mbedtls_platform_zeroize(cmds, sizeof(cmds));
+	if (lock_fd >= 0)
+		close(lock_fd);
+
+	return ret;
+}
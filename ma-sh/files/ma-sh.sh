@@ -22,6 +22,8 @@ CONFIG_APIBASE=
 CONFIG_APIKEY=
 CONFIG_HOSTID=
 CONFIG_TIMEOUT=
+CONFIG_OUTPUT_MACKEREL=
+CONFIG_ENABLED=
 
 # parameters
 PARAM_DAEMON=
@@ -58,6 +60,13 @@ func_build_url() {
 	local base_url="https://${CONFIG_APIBASE}/api/v0"
 	local url
 
+	# CONFIG_APIBASE given as a URL keeps its own scheme and port
+	case "${CONFIG_APIBASE}" in
+		http://*|https://*)
+			base_url="${CONFIG_APIBASE}/api/v0"
+			;;
+	esac
+
 	case "${category}" in
 		reg)
 			url="${base_url}/hosts"
@@ -78,6 +87,7 @@ func_build_url() {
 
 # Access to the API
 # paramerters: method, data
+# output: "<http code> <bytes posted> <total time>"
 func_access_api() {
 	local method="${1}"
 	local url="${2}"
@@ -94,17 +104,22 @@ func_access_api() {
 #		echo "method: $method"
 #		echo "url: $url"
 #		echo -e "data:\n$data"
-		echo 200
+		echo "200 ${#data} 0"
 	else
 		curl -s ${url} -X${method} \
 			-H "X-api-key: ${CONFIG_APIKEY}" -H 'Content-Type: application/json' \
 			--data "${data}" \
-			-o "$TMP_RESPONSE" -w %{http_code} -m "${CONFIG_TIMEOUT:-10}"
+			-o "$TMP_RESPONSE" -w '%{http_code} %{size_upload} %{time_total}' \
+			-m "${CONFIG_TIMEOUT:-10}"
 	fi
 }
 
 func_http_check() {
-	local http="$1"
+	local http size time
+
+	set -- $1
+	http="$1" size="$2" time="$3"
+	func_print_log "debug" "API: $http, ${size:-0} bytes in ${time:-0}s"
 
 	# success
 	if [ "$http" = "200" ]; then
@@ -124,6 +139,14 @@ func_http_check() {
 		func_print_log "err" "API: not found"
 		return 1
 	fi
+	if [ "${http#5}" != "$http" ]; then
+		func_print_log "err" "API: server error ($http)"
+		return 1
+	fi
+	if [ "$http" = "000" ]; then
+		func_print_log "err" "API: timed out or failed to connect"
+		return 1
+	fi
 
 	# fail (other reason (incl. timeout), http=000?)
 	func_print_log "err" "API: failed by any reason"
@@ -151,27 +174,19 @@ func_host_regupd() {
 			return 0
 	fi
 	CONFIG_HOSTID="$(jsonfilter -s "$TMP_RESPONSE" -e '@.id')"
-	uci_set "ma-sh" "global" "hostid" "$CONFIG_HOSTID"
-	uci_commit "ma-sh"
+	$MA_TOOL set hostid "$CONFIG_HOSTID"
 
 	return 0
 #	func_dump "ret" "$ret"
 }
 
-build_status_json() {
-	local status="$1"
-
-	json_init
-	json_add_string "status" "$status"
-}
-
 # status: working, standby, maintenance, poweroff
 func_status_upd() {
 	local status="$1"
 	local http
 
-	build_status_json "$status"
-	json="$(json_dump)"
+	# one of MA_SUPPOTED_STATS, no escaping is needed
+	json="{\"status\":\"$status\"}"
 #	func_dump "json" "$json"
 	url="$(func_build_url host '/status')"
 	http="$(func_access_api POST "$url" "$json")"
@@ -196,6 +211,9 @@ func_metric_post() {
 	local url
 	local http
 
+	# posted by the resident collector (the host id is read from the config)
+	[ "$CONFIG_OUTPUT_MACKEREL" = "1" ] && return 0
+
 	json="$($MA_TOOL -h "$CONFIG_HOSTID" metricj)"
 	[ "$DEBUG" = "1" ] && func_dump "json" "$json"
 
@@ -266,14 +284,6 @@ if ! type curl &> /dev/null; then
 	exit 1
 fi
 
-if [ -r "/lib/functions.sh" ] && [ -r "/usr/share/libubox/jshn.sh" ]; then
-	. "/lib/functions.sh"
-	. "/usr/share/libubox/jshn.sh"
-	func_print_log "debug" "libraries are loaded, starting..."
-else
-	func_print_log "err" "failed to load libraries"
-	exit 1
-fi
 
 # Sub command
 agent_cmd="${1:-"start"}"
@@ -298,13 +308,11 @@ while getopts CdDS option; do
 done
 
 #func_print_log "info" "PARAM_DAEMON: $PARAM_DAEMON"
-config_load "ma-sh"
-config_get CONFIG_USE_MODEL "global" "use_model"
-config_get CONFIG_EXIT_STAT "global" "exit_stat"
-config_get CONFIG_APIBASE "global" "apibase"
-config_get CONFIG_APIKEY "global" "apikey"
-config_get CONFIG_HOSTID "global" "hostid"
-config_get CONFIG_TIMEOUT "global" "timeout"
+# all options by ma-tools at once
+if ! eval "$($MA_TOOL config)"; then
+	func_print_log "err" "failed to load the config"
+	exit 1
+fi
 
 if [ "$PARAM_SYSLOG_OUTPUT" != "1" -o "$PARAM_DAEMON" = "1" ]; then
 	func_print_log "info" "${MA_AGENT_NAME:-MA_AGENT_DEF_NAME} ${MA_AGENT_VER:-MA_AGENT_DEF_VER}"
@@ -314,7 +322,6 @@ if [ -z "$CONFIG_APIKEY" ]; then	# check if the api key is set
 	func_print_log "err" "Please set the API key before starting this program."
 	exit 1
 fi
-[ "$CONFIG_USE_MODEL" != "1" ] && unset CONFIG_USE_MODEL
 
 # Operations
 case "$agent_cmd" in
@@ -0,0 +1,243 @@
+/*
+ * traffic of the application protocols by nlbwmon
+ *
+ * The database of the current period is dumped from the control socket of
+ * nlbwmon ("dump", same as "nlbw -c json -g layer7") and the records are
+ * summed up while they are received, by the layer7 name looked up from
+ * (proto, port) in the protocols file of nlbwmon. No json is formatted
+ * or parsed, and the sums are kept in a fixed table.
+ */
+
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <endian.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "appproto.h"
+
+/* same layouts as database.h of nlbwmon, in network byte order */
+struct nlbw_hdr {
+	uint32_t magic;
+	uint32_t entries;
+	uint32_t timestamp;
+} __attribute__((packed));
+
+struct nlbw_rec {
+	uint8_t family;
+	uint8_t proto;
+	uint16_t dst_port;
+	uint8_t src_addr[16];		/* in_addr or in6_addr */
+	uint8_t src_mac[6];
+	uint64_t count;
+	uint64_t out_pkts;
+	uint64_t out_bytes;
+	uint64_t in_pkts;
+	uint64_t in_bytes;
+} __attribute__((packed));
+
+struct appproto_map {
+	uint8_t proto;
+	uint16_t port;				/* 0: any port */
+	int slot;					/* in the names */
+};
+
+static struct appproto_map maps[APPPROTO_PROTO_MAX];
+static int map_cnt;
+static char names[APPPROTO_MAX][APPPROTO_NAME_LEN];
+static int name_cnt;
+static bool loaded = false;
+static char rbuf[APPPROTO_BUF_LEN];
+
+/* "SMB-over-TCP" -> "SMBoverTCP", for the metric names */
+static void strip_name(char *dst, const char *src, size_t len)
+{
+	size_t i = 0;
+
+	for (; *src && i < len - 1; src++) {
+		if ((*src >= '0' && *src <= '9') ||
+		    (*src >= 'a' && *src <= 'z') ||
+		    (*src >= 'A' && *src <= 'Z'))
+			dst[i++] = *src;
+	}
+	dst[i] = '\0';
+}
+
+static int name_slot(const char *name)
+{
+	int i;
+
+	for (i = 0; i < name_cnt; i++) {
+		if (!strcmp(names[i], name))
+			return i;
+	}
+	if (name_cnt >= APPPROTO_MAX)
+		return -1;
+	strcpy(names[name_cnt], name);
+
+	return name_cnt++;
+}
+
+/*
+ * "<proto> <port> <name>" per line, the unknown ones are "Other" (slot 0)
+ * like "nlbw -g layer7" with no name
+ */
+static void load_protocols(void)
+{
+	char line[128], name[APPPROTO_NAME_LEN], *p, *end;
+	unsigned long proto, port;
+	FILE *fp;
+	int slot;
+
+	loaded = true;
+	name_slot("Other");
+
+	if ((fp = fopen(APPPROTO_PROTOCOLS, "r")) == NULL)
+		return;
+	while (fgets(line, sizeof(line), fp) && map_cnt < APPPROTO_PROTO_MAX) {
+		p = line + strspn(line, " \t");
+		if (*p == '#' || *p == '\n' || !*p)
+			continue;
+		proto = strtoul(p, &end, 0);
+		if (end == p || proto > 255)
+			continue;
+		p = end;
+		port = strtoul(p, &end, 0);
+		if (end == p || port > 65535)
+			continue;
+		p = end + strspn(end, " \t");
+		p[strcspn(p, " \t\r\n")] = '\0';
+		strip_name(name, p, sizeof(name));
+		if (!name[0] || (slot = name_slot(name)) < 0)
+			continue;
+
+		maps[map_cnt].proto = proto;
+		maps[map_cnt].port = port;
+		maps[map_cnt].slot = slot;
+		map_cnt++;
+	}
+	fclose(fp);
+}
+
+static int lookup(uint8_t proto, uint16_t port)
+{
+	int i, any = 0;
+
+	for (i = 0; i < map_cnt; i++) {
+		if (maps[i].proto != proto)
+			continue;
+		if (maps[i].port == port)
+			return maps[i].slot;
+		if (!maps[i].port)
+			any = maps[i].slot;
+	}
+
+	return any;
+}
+
+static int nlbw_connect(void)
+{
+	struct sockaddr_un sa = { .sun_family = AF_UNIX };
+	struct timeval tv = { .tv_sec = APPPROTO_TIMEOUT };
+	int fd;
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+	strncpy(sa.sun_path, APPPROTO_SOCK, sizeof(sa.sun_path) - 1);
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	if (connect(fd, (struct sockaddr *)&sa, sizeof(sa))) {
+		/* nlbwmon is not running */
+		if (errno != ENOENT && errno != ECONNREFUSED)
+			fprintf(stderr, "err: failed to connect to nlbwmon (%s)\n",
+					strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static void add_record(struct appproto_ent *ents, int n,
+		       const struct nlbw_rec *rec)
+{
+	int slot = lookup(rec->proto, be16toh(rec->dst_port));
+
+	if (slot >= n)
+		slot = 0;
+	ents[slot].rx_bytes += be64toh(rec->in_bytes);
+	ents[slot].rx_pkts += be64toh(rec->in_pkts);
+	ents[slot].tx_bytes += be64toh(rec->out_bytes);
+	ents[slot].tx_pkts += be64toh(rec->out_pkts);
+}
+
+/* sums by the name, returns the number of entries (some may be zero) */
+int appproto_read(struct appproto_ent *ents, int n)
+{
+	struct nlbw_hdr hdr;
+	struct nlbw_rec rec;
+	uint32_t entries = 0, done = 0;
+	size_t len = 0, off;
+	ssize_t ret;
+	bool has_hdr = false;
+	int fd, i;
+
+	if (!loaded)
+		load_protocols();
+	if (n > name_cnt)
+		n = name_cnt;
+	for (i = 0; i < n; i++) {
+		memset(&ents[i], 0, sizeof(ents[i]));
+		strcpy(ents[i].name, names[i]);
+	}
+
+	if ((fd = nlbw_connect()) < 0)
+		return -1;
+	if (send(fd, "dump", 4, 0) != 4) {
+		close(fd);
+		return -1;
+	}
+
+	/* the header, then the records until closed by nlbwmon */
+	for (;;) {
+		ret = recv(fd, rbuf + len, sizeof(rbuf) - len, 0);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			break;
+		len += ret;
+
+		off = 0;
+		if (!has_hdr) {
+			if (len < sizeof(hdr))
+				continue;
+			memcpy(&hdr, rbuf, sizeof(hdr));
+			entries = be32toh(hdr.entries);
+			off = sizeof(hdr);
+			has_hdr = true;
+		}
+		/* copied out, unaligned in the buffer */
+		for (; len - off >= sizeof(rec) && done < entries;
+		     off += sizeof(rec), done++) {
+			memcpy(&rec, rbuf + off, sizeof(rec));
+			add_record(ents, n, &rec);
+		}
+		memmove(rbuf, rbuf + off, len - off);
+		len -= off;
+		if (done == entries)
+			break;
+	}
+	close(fd);
+
+	if (!has_hdr || done < entries) {
+		fprintf(stderr, "err: incomplete dump from nlbwmon\n");
+		return -1;
+	}
+
+	return n;
+}
@@ -0,0 +1,33 @@
+#ifndef APPPROTO_H
+#define APPPROTO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define APPPROTO_MAX		64		/* names in the protocols file + "Other" */
+#define APPPROTO_PROTO_MAX	128		/* lines in the protocols file */
+#define APPPROTO_NAME_LEN	24
+#define APPPROTO_BUF_LEN	4096
+#define APPPROTO_TIMEOUT	2		/* s, nlbwmon busy with a commit */
+#define APPPROTO_SOCK		"/var/run/nlbwmon.sock"
+#define APPPROTO_PROTOCOLS	"/usr/share/nlbwmon/protocols"
+
+/* totals of the current accounting period of nlbwmon */
+struct appproto_ent {
+	char name[APPPROTO_NAME_LEN];	/* sanitized ("SMB-over-TCP" -> "SMBoverTCP") */
+	uint64_t rx_bytes;
+	uint64_t rx_pkts;
+	uint64_t tx_bytes;
+	uint64_t tx_pkts;
+};
+
+#ifdef WITH_APPPROTO
+int appproto_read(struct appproto_ent *ents, int n);
+#else
+static inline int appproto_read(struct appproto_ent *ents, int n)
+{
+	return -1;
+}
+#endif
+
+#endif
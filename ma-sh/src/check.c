@@ -0,0 +1,397 @@
+/*
+ * check monitoring of Mackerel
+ *
+ * The check plugins are run concurrently in uloop every interval, each
+ * with its own deadline (killed with its process group after it). When
+ * all of them are finished, their results are posted in one request to
+ * /api/v0/monitoring/checks/report. Like mackerel-agent, OK results are
+ * posted only when the status changed, the others every time the check ran
+ * for maxCheckAttempts and the notification of Mackerel. Each result is
+ * posted once, the results not posted by an error are posted with the
+ * next batch.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <libubox/uclient.h>
+#include <libubox/blobmsg_json.h>
+
+#include "output.h"
+#include "check.h"
+
+static const char * const status_names[] = {
+	[CHECK_OK] = "OK",
+	[CHECK_WARNING] = "WARNING",
+	[CHECK_CRITICAL] = "CRITICAL",
+	[CHECK_UNKNOWN] = "UNKNOWN",
+};
+
+static LIST_HEAD(checks);
+static int running;
+static char report_url[CHECK_URL_LEN];
+static char api_key[CHECK_KEY_LEN];
+static const char *host_id;		/* of the caller, updated by it */
+static struct uclient *cl;
+static int http_status;
+static bool posting;
+static struct blob_buf report_buf;
+
+static void check_report(void);
+
+static void read_output(struct check *c)
+{
+	char discard[256];
+	ssize_t len;
+
+	for (;;) {
+		if (c->msg_len < sizeof(c->msg) - 1)
+			len = read(c->out.fd, c->msg + c->msg_len,
+					sizeof(c->msg) - 1 - c->msg_len);
+		else
+			len = read(c->out.fd, discard, sizeof(discard));
+		if (len <= 0)
+			break;
+		if (c->msg_len < sizeof(c->msg) - 1)
+			c->msg_len += len;
+	}
+	c->msg[c->msg_len] = '\0';
+}
+
+static void out_cb(struct uloop_fd *fd, unsigned int events)
+{
+	read_output(container_of(fd, struct check, out));
+}
+
+static void deadline_cb(struct uloop_timeout *t)
+{
+	struct check *c = container_of(t, struct check, deadline);
+
+	c->timed_out = true;
+	/* with the children of the shell */
+	kill(-c->proc.pid, SIGKILL);
+}
+
+static void proc_cb(struct uloop_process *p, int ret)
+{
+	struct check *c = container_of(p, struct check, proc);
+
+	uloop_timeout_cancel(&c->deadline);
+	read_output(c);
+	uloop_fd_delete(&c->out);
+	close(c->out.fd);
+	c->running = false;
+
+	/* trailing newline of the plugin */
+	while (c->msg_len > 0 && c->msg[c->msg_len - 1] == '\n')
+		c->msg[--c->msg_len] = '\0';
+
+	if (c->timed_out) {
+		c->status = CHECK_UNKNOWN;
+		snprintf(c->msg, sizeof(c->msg), "timed out after %us",
+				c->timeout);
+	} else if (WIFEXITED(ret) && WEXITSTATUS(ret) < _CHECK_STATUS_MAX) {
+		c->status = WEXITSTATUS(ret);
+	} else {
+		c->status = CHECK_UNKNOWN;
+	}
+	c->occurred = time(NULL);
+	c->fresh = true;
+
+	if (--running == 0)
+		check_report();
+}
+
+static int check_run(struct check *c)
+{
+	int fds[2];
+	pid_t pid;
+
+	if (pipe2(fds, O_CLOEXEC))
+		return -1;
+
+	pid = fork();
+	if (pid < 0) {
+		close(fds[0]);
+		close(fds[1]);
+		return -1;
+	}
+	if (pid == 0) {
+		setpgid(0, 0);
+		dup2(fds[1], STDOUT_FILENO);
+		dup2(fds[1], STDERR_FILENO);
+		execl("/bin/sh", "sh", "-c", c->cmd, NULL);
+		_exit(127);
+	}
+	/* also in the parent, so that kill(-pid) works before the child runs */
+	setpgid(pid, pid);
+	close(fds[1]);
+
+	c->msg_len = 0;
+	c->msg[0] = '\0';
+	c->timed_out = false;
+	c->running = true;
+
+	c->proc.pid = pid;
+	c->proc.cb = proc_cb;
+	uloop_process_add(&c->proc);
+
+	c->out.fd = fds[0];
+	c->out.cb = out_cb;
+	fcntl(c->out.fd, F_SETFL, fcntl(c->out.fd, F_GETFL) | O_NONBLOCK);
+	uloop_fd_add(&c->out, ULOOP_READ);
+
+	c->deadline.cb = deadline_cb;
+	uloop_timeout_set(&c->deadline, c->timeout * 1000);
+	running++;
+
+	return 0;
+}
+
+/* new results only, OK: only if changed, the others: every time */
+static bool check_to_report(struct check *c)
+{
+	return c->fresh &&
+		(c->status != CHECK_OK || c->reported != CHECK_OK);
+}
+
+static void http_header_done(struct uclient *cl)
+{
+	http_status = cl->status_code;
+}
+
+static void http_data_read(struct uclient *cl)
+{
+	char buf[256];
+
+	/* the response body is not used */
+	while (uclient_read(cl, buf, sizeof(buf)) > 0);
+}
+
+static void post_done(bool success)
+{
+	struct check *c;
+
+	uclient_disconnect(cl);
+	posting = false;
+	list_for_each_entry(c, &checks, list) {
+		if (!c->sent)
+			continue;
+		c->sent = false;
+		/* the status sent, it may have changed in the meantime */
+		if (success)
+			c->reported = c->sent_status;
+		else
+			c->fresh = true;
+	}
+	if (!success)
+		fprintf(stderr, "warning: failed to post check reports (status: %d)\n",
+				http_status);
+}
+
+static void http_data_eof(struct uclient *cl)
+{
+	post_done(http_status >= 200 && http_status < 300);
+}
+
+static void http_error(struct uclient *cl, int code)
+{
+	http_status = -code;
+	post_done(false);
+}
+
+static const struct uclient_cb http_cb = {
+	.header_done = http_header_done,
+	.data_read = http_data_read,
+	.data_eof = http_data_eof,
+	.error = http_error,
+};
+
+/* post the results to be reported in one request */
+static void check_report(void)
+{
+	struct check *c;
+	void *ary, *tbl, *src;
+	char *body;
+	int cnt = 0;
+
+	if (posting || !host_id || strlen(host_id) != 11 || !cl)
+		return;
+
+	blob_buf_init(&report_buf, 0);
+	ary = blobmsg_open_array(&report_buf, "reports");
+	list_for_each_entry(c, &checks, list) {
+		if (!check_to_report(c))
+			continue;
+		tbl = blobmsg_open_table(&report_buf, NULL);
+		src = blobmsg_open_table(&report_buf, "source");
+		blobmsg_add_string(&report_buf, "type", "host");
+		blobmsg_add_string(&report_buf, "hostId", host_id);
+		blobmsg_close_table(&report_buf, src);
+		blobmsg_add_string(&report_buf, "name", c->name);
+		blobmsg_add_string(&report_buf, "status", status_names[c->status]);
+		blobmsg_add_string(&report_buf, "message", c->msg);
+		blobmsg_add_u64(&report_buf, "occurredAt", c->occurred);
+		if (c->max_attempts)
+			blobmsg_add_u32(&report_buf, "maxCheckAttempts",
+					c->max_attempts);
+		blobmsg_close_table(&report_buf, tbl);
+		c->sent = true;
+		c->sent_status = c->status;
+		/* set again by the next run, or by an error of this post */
+		c->fresh = false;
+		cnt++;
+	}
+	blobmsg_close_array(&report_buf, ary);
+	if (!cnt)
+		return;
+
+	body = blobmsg_format_json(report_buf.head, true);
+	if (!body)
+		goto err;
+
+	http_status = 0;
+	uclient_set_timeout(cl, CHECK_TIMEOUT_DEF * 1000);
+	if (uclient_connect(cl))
+		goto err;
+	uclient_http_set_request_type(cl, "POST");
+	uclient_http_reset_headers(cl);
+	uclient_http_set_header(cl, "X-Api-Key", api_key);
+	uclient_http_set_header(cl, "Content-Type", "application/json");
+	uclient_write(cl, body, strlen(body));
+	free(body);
+	body = NULL;
+	if (uclient_request(cl))
+		goto err;
+	posting = true;
+
+	return;
+
+err:
+	free(body);
+	posting = true;
+	post_done(false);
+}
+
+static void tick_cb(struct uloop_timeout *t)
+{
+	struct check *c;
+
+	uloop_timeout_set(t, CHECK_TICK * 1000);
+
+	list_for_each_entry(c, &checks, list) {
+		if (c->running || ++c->ticks < c->interval)
+			continue;
+		c->ticks = 0;
+		if (check_run(c))
+			fprintf(stderr, "err: failed to run check \"%s\"\n",
+					c->name);
+	}
+	/* nothing started */
+	if (!running)
+		check_report();
+}
+
+static struct uloop_timeout tick_timer = {
+	.cb = tick_cb,
+};
+
+int check_add(const char *name, const char *cmd, unsigned int timeout,
+	      unsigned int interval, unsigned int max_attempts)
+{
+	struct check *c;
+
+	if (!name[0] || strlen(name) >= CHECK_NAME_LEN ||
+	    !cmd[0] || strlen(cmd) >= CHECK_CMD_LEN) {
+		fprintf(stderr, "err: invalid check \"%s\"\n", name);
+		return -1;
+	}
+
+	c = calloc(1, sizeof(*c));
+	if (!c)
+		return -1;
+	strcpy(c->name, name);
+	strcpy(c->cmd, cmd);
+	c->timeout = timeout ? timeout : CHECK_TIMEOUT_DEF;
+	c->interval = interval ? interval : 1;
+	c->max_attempts = max_attempts;
+	c->reported = -1;
+	/* run on the first tick */
+	c->ticks = c->interval - 1;
+
+	list_add_tail(&c->list, &checks);
+
+	return 0;
+}
+
+/*
+ * apibase: as "apibase" of ma-sh, the checks are reported over https
+ * unless it has the scheme, hostid: kept as a reference
+ */
+void check_set_api(const char *apibase, const char *apikey,
+		   const char *hostid)
+{
+	const char *base = apibase[0] ? apibase : MACKEREL_APIBASE_DEF;
+
+	snprintf(report_url, sizeof(report_url),
+			"%s%s/api/v0/monitoring/checks/report",
+			strstr(base, "://") ? "" : "https://", base);
+	snprintf(api_key, sizeof(api_key), "%s", apikey);
+	host_id = hostid;
+}
+
+void check_start(void)
+{
+	if (list_empty(&checks))
+		return;
+
+	if (!api_key[0]) {
+		fprintf(stderr, "err: no API key for check monitoring\n");
+		return;
+	}
+	cl = uclient_new(report_url, NULL, &http_cb);
+	if (!cl) {
+		fprintf(stderr, "err: invalid URL \"%s\"\n", report_url);
+		return;
+	}
+	if (!strncmp(report_url, "https://", 8) && output_set_ssl(cl, true)) {
+		uclient_free(cl);
+		cl = NULL;
+		return;
+	}
+
+	uloop_timeout_set(&tick_timer, 0);
+}
+
+void check_free_all(void)
+{
+	struct check *c, *tmp;
+
+	uloop_timeout_cancel(&tick_timer);
+	list_for_each_entry_safe(c, tmp, &checks, list) {
+		if (c->running) {
+			uloop_timeout_cancel(&c->deadline);
+			uloop_process_delete(&c->proc);
+			uloop_fd_delete(&c->out);
+			close(c->out.fd);
+			kill(-c->proc.pid, SIGKILL);
+			/* no zombie, it is killed just now */
+			waitpid(c->proc.pid, NULL, 0);
+		}
+		list_del(&c->list);
+		free(c);
+	}
+	running = 0;
+
+	if (cl) {
+		uclient_free(cl);
+		cl = NULL;
+	}
+	posting = false;
+}
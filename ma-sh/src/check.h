@@ -0,0 +1,81 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <libubox/list.h>
+#include <libubox/uloop.h>
+
+#define CHECK_NAME_LEN		64
+#define CHECK_CMD_LEN		256
+#define CHECK_MEMO_LEN		256		/* 250 chars in Mackerel */
+#define CHECK_MSG_LEN		1024	/* longer messages are truncated by Mackerel */
+#define CHECK_TIMEOUT_DEF	30		/* sec */
+#define CHECK_TICK			60		/* sec, the unit of the interval */
+#define CHECK_URL_LEN		256
+#define CHECK_KEY_LEN		128
+
+enum {
+	CHECK_OK,
+	CHECK_WARNING,
+	CHECK_CRITICAL,
+	CHECK_UNKNOWN,
+	_CHECK_STATUS_MAX,
+};
+
+/*
+ * check plugin of Mackerel, executed by "/bin/sh -c <command>"
+ * exit code: 0: OK, 1: WARNING, 2: CRITICAL, others: UNKNOWN
+ * stdout and stderr are reported as the message
+ */
+struct check {
+	struct list_head list;
+	char name[CHECK_NAME_LEN];
+	char cmd[CHECK_CMD_LEN];
+	unsigned int timeout;		/* sec */
+	unsigned int interval;		/* min */
+	unsigned int max_attempts;	/* 0: default of Mackerel */
+
+	/* run */
+	struct uloop_process proc;
+	struct uloop_fd out;
+	struct uloop_timeout deadline;
+	unsigned int ticks;
+	bool running;
+	bool timed_out;
+	char msg[CHECK_MSG_LEN];
+	size_t msg_len;
+
+	/* report */
+	int status;
+	time_t occurred;
+	bool fresh;					/* the result is not posted yet */
+	int reported;				/* -1: never */
+	bool sent;					/* in the request in flight */
+	int sent_status;			/* of the request in flight */
+};
+
+#ifdef WITH_CHECK
+int check_add(const char *name, const char *cmd, unsigned int timeout,
+	      unsigned int interval, unsigned int max_attempts);
+void check_set_api(const char *apibase, const char *apikey,
+		   const char *hostid);
+void check_start(void);
+void check_free_all(void);
+#else
+static inline int check_add(const char *name, const char *cmd,
+			    unsigned int timeout, unsigned int interval,
+			    unsigned int max_attempts)
+{
+	fprintf(stderr, "err: checks are not supported in this build\n");
+	return -1;
+}
+static inline void check_set_api(const char *apibase, const char *apikey,
+				 const char *hostid) {}
+static inline void check_start(void) {}
+static inline void check_free_all(void) {}
+#endif
+
+#endif
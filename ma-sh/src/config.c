@@ -0,0 +1,315 @@
+/*
+ * "ma-sh" UCI package
+ *
+ * The options are read by libuci directly, so neither ma-sh nor the init
+ * script need to source /lib/functions.sh and run config_get for each of
+ * them. ma-sh gets all values by one "ma-tools config" and evaluates it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <uci.h>
+
+#include "config.h"
+
+static void copy_option(struct uci_context *uci, struct uci_section *s,
+			const char *name, char *dst, size_t len)
+{
+	const char *val = uci_lookup_option_string(uci, s, name);
+
+	if (val)
+		snprintf(dst, len, "%s", val);
+}
+
+static bool get_option_bool(struct uci_context *uci, struct uci_section *s,
+			    const char *name)
+{
+	const char *val = uci_lookup_option_string(uci, s, name);
+
+	return val && (!strcmp(val, "1") || !strcmp(val, "on") ||
+			!strcmp(val, "true") || !strcmp(val, "yes") ||
+			!strcmp(val, "enabled"));
+}
+
+static unsigned long get_option_ulong(struct uci_context *uci,
+				      struct uci_section *s, const char *name)
+{
+	const char *val = uci_lookup_option_string(uci, s, name);
+
+	return val ? strtoul(val, NULL, 10) : 0;
+}
+
+static double get_option_double(struct uci_context *uci,
+				struct uci_section *s, const char *name)
+{
+	const char *val = uci_lookup_option_string(uci, s, name);
+
+	return val ? strtod(val, NULL) : 0;
+}
+
+static void load_output(struct uci_context *uci, struct uci_section *s,
+			struct ma_config *cfg)
+{
+	struct ma_output_conf *out;
+
+	if (cfg->output_cnt >= MA_OUTPUT_MAX) {
+		fprintf(stderr,
+			"warning: too many outputs (max: %d), ignored\n",
+			MA_OUTPUT_MAX);
+		return;
+	}
+
+	out = &cfg->outputs[cfg->output_cnt];
+	memset(out, 0, sizeof(*out));
+	copy_option(uci, s, "type", out->type, sizeof(out->type));
+	if (!out->type[0])
+		return;
+	copy_option(uci, s, "target", out->target, sizeof(out->target));
+	copy_option(uci, s, "token", out->token, sizeof(out->token));
+	out->batch = get_option_ulong(uci, s, "batch");
+
+	cfg->output_cnt++;
+}
+
+static void load_remote(struct uci_context *uci, struct uci_section *s,
+			struct ma_config *cfg)
+{
+	struct ma_remote_conf *rem;
+
+	if (cfg->remote_cnt >= MA_REMOTE_MAX) {
+		fprintf(stderr,
+			"warning: too many remotes (max: %d), ignored\n",
+			MA_REMOTE_MAX);
+		return;
+	}
+
+	rem = &cfg->remotes[cfg->remote_cnt];
+	memset(rem, 0, sizeof(*rem));
+	copy_option(uci, s, "url", rem->url, sizeof(rem->url));
+	copy_option(uci, s, "hostid", rem->hostid, sizeof(rem->hostid));
+	if (!rem->url[0] || !rem->hostid[0])
+		return;
+	copy_option(uci, s, "username", rem->user, sizeof(rem->user));
+	copy_option(uci, s, "password", rem->pass, sizeof(rem->pass));
+	rem->timeout = get_option_ulong(uci, s, "timeout");
+
+	cfg->remote_cnt++;
+}
+
+static void load_check(struct uci_context *uci, struct uci_section *s,
+		       struct ma_config *cfg)
+{
+	struct ma_check_conf *chk;
+
+	if (cfg->check_cnt >= MA_CHECK_MAX) {
+		fprintf(stderr,
+			"warning: too many checks (max: %d), ignored\n",
+			MA_CHECK_MAX);
+		return;
+	}
+
+	chk = &cfg->checks[cfg->check_cnt];
+	memset(chk, 0, sizeof(*chk));
+	copy_option(uci, s, "name", chk->name, sizeof(chk->name));
+	copy_option(uci, s, "command", chk->cmd, sizeof(chk->cmd));
+	if (!chk->name[0] || !chk->cmd[0])
+		return;
+	copy_option(uci, s, "memo", chk->memo, sizeof(chk->memo));
+	chk->timeout = get_option_ulong(uci, s, "timeout");
+	chk->interval = get_option_ulong(uci, s, "interval");
+	chk->max_attempts = get_option_ulong(uci, s, "max_check_attempts");
+
+	cfg->check_cnt++;
+}
+
+static void load_probe(struct uci_context *uci, struct uci_section *s,
+		       struct ma_config *cfg)
+{
+	struct ma_probe_conf *prb;
+
+	if (cfg->probe_cnt >= MA_PROBE_MAX) {
+		fprintf(stderr,
+			"warning: too many probes (max: %d), ignored\n",
+			MA_PROBE_MAX);
+		return;
+	}
+
+	prb = &cfg->probes[cfg->probe_cnt];
+	memset(prb, 0, sizeof(*prb));
+	copy_option(uci, s, "name", prb->name, sizeof(prb->name));
+	copy_option(uci, s, "type", prb->type, sizeof(prb->type));
+	copy_option(uci, s, "target", prb->target, sizeof(prb->target));
+	if (!prb->type[0] || !prb->target[0])
+		return;
+	/* the target by default */
+	if (!prb->name[0])
+		snprintf(prb->name, sizeof(prb->name), "%s", prb->target);
+	prb->interval = get_option_ulong(uci, s, "interval");
+	prb->timeout = get_option_ulong(uci, s, "timeout");
+
+	cfg->probe_cnt++;
+}
+
+static void load_logmatch(struct uci_context *uci, struct uci_section *s,
+			  struct ma_config *cfg)
+{
+	struct ma_logmatch_conf *lm;
+
+	if (cfg->logmatch_cnt >= MA_LOGMATCH_MAX) {
+		fprintf(stderr,
+			"warning: too many log patterns (max: %d), ignored\n",
+			MA_LOGMATCH_MAX);
+		return;
+	}
+
+	lm = &cfg->logmatches[cfg->logmatch_cnt];
+	memset(lm, 0, sizeof(*lm));
+	copy_option(uci, s, "name", lm->name, sizeof(lm->name));
+	copy_option(uci, s, "pattern", lm->pattern, sizeof(lm->pattern));
+	if (!lm->name[0] || !lm->pattern[0])
+		return;
+
+	cfg->logmatch_cnt++;
+}
+
+int ma_config_load(struct ma_config *cfg)
+{
+	struct uci_context *uci;
+	struct uci_package *pkg;
+	struct uci_section *s;
+	struct uci_element *e;
+
+	memset(cfg, 0, sizeof(*cfg));
+
+	uci = uci_alloc_context();
+	if (!uci)
+		return -1;
+	if (uci_load(uci, MA_CONFIG_PKG, &pkg)) {
+		uci_free_context(uci);
+		return -3;
+	}
+
+	s = uci_lookup_section(uci, pkg, MA_CONFIG_SECTION);
+	if (s) {
+		cfg->enabled = get_option_bool(uci, s, "enabled");
+		cfg->use_model = get_option_bool(uci, s, "use_model");
+		copy_option(uci, s, "exit_stat",
+				cfg->exit_stat, sizeof(cfg->exit_stat));
+		copy_option(uci, s, "apibase",
+				cfg->apibase, sizeof(cfg->apibase));
+		copy_option(uci, s, "apikey",
+				cfg->apikey, sizeof(cfg->apikey));
+		copy_option(uci, s, "hostid",
+				cfg->hostid, sizeof(cfg->hostid));
+		cfg->timeout = get_option_ulong(uci, s, "timeout");
+		/* enabled unless "0" */
+		cfg->backoff_disabled =
+			uci_lookup_option_string(uci, s, "backoff") &&
+			!get_option_bool(uci, s, "backoff");
+		cfg->backoff_load = get_option_double(uci, s, "backoff_load");
+		cfg->backoff_cycle_ms =
+			get_option_ulong(uci, s, "backoff_cycle_ms");
+		cfg->appproto = get_option_bool(uci, s, "appproto");
+		cfg->portlink = get_option_bool(uci, s, "portlink");
+	}
+
+	uci_foreach_element(&pkg->sections, e) {
+		s = uci_to_section(e);
+		if (!strcmp(s->type, "output"))
+			load_output(uci, s, cfg);
+		else if (!strcmp(s->type, "remote"))
+			load_remote(uci, s, cfg);
+		else if (!strcmp(s->type, "check"))
+			load_check(uci, s, cfg);
+		else if (!strcmp(s->type, "probe"))
+			load_probe(uci, s, cfg);
+		else if (!strcmp(s->type, "logmatch"))
+			load_logmatch(uci, s, cfg);
+	}
+
+	uci_unload(uci, pkg);
+	uci_free_context(uci);
+
+	return 0;
+}
+
+/*
+ * set the option in the global section and commit,
+ * returns 1 without commit if the value is not changed
+ */
+int ma_config_set(const char *option, const char *value)
+{
+	struct uci_context *uci;
+	struct uci_ptr ptr;
+	char path[128];
+	int ret = 0;
+
+	if (strchr(option, '.') || strchr(option, '=')) {
+		fprintf(stderr, "err: invalid option name \"%s\"\n", option);
+		return -1;
+	}
+
+	uci = uci_alloc_context();
+	if (!uci)
+		return -1;
+
+	snprintf(path, sizeof(path), "%s.%s.%s",
+			MA_CONFIG_PKG, MA_CONFIG_SECTION, option);
+	if (uci_lookup_ptr(uci, &ptr, path, true) || !ptr.s) {
+		fprintf(stderr, "err: failed to look up \"%s\"\n", path);
+		ret = -3;
+		goto out;
+	}
+	if (ptr.o && ptr.o->type == UCI_TYPE_STRING &&
+	    !strcmp(ptr.o->v.string, value)) {
+		ret = 1;
+		goto out;
+	}
+	ptr.value = value;
+	if (uci_set(uci, &ptr) || uci_commit(uci, &ptr.p, false)) {
+		fprintf(stderr, "err: failed to commit \"%s\"\n", path);
+		ret = -3;
+	}
+
+out:
+	uci_free_context(uci);
+
+	return ret;
+}
+
+/* single-quoted for eval in sh */
+static void print_sh_var(const char *name, const char *val)
+{
+	printf("%s='", name);
+	for (; *val; val++) {
+		if (*val == '\'')
+			fputs("'\\''", stdout);
+		else
+			putchar(*val);
+	}
+	printf("'\n");
+}
+
+void ma_config_print_sh(const struct ma_config *cfg)
+{
+	char timeout[11] = "";
+	bool mackerel = false;
+	int i;
+
+	if (cfg->timeout)
+		sprintf(timeout, "%u", cfg->timeout);
+	for (i = 0; i < cfg->output_cnt; i++) {
+		if (!strcmp(cfg->outputs[i].type, "mackerel"))
+			mackerel = true;
+	}
+
+	print_sh_var("CONFIG_ENABLED", cfg->enabled ? "1" : "0");
+	print_sh_var("CONFIG_USE_MODEL", cfg->use_model ? "1" : "");
+	print_sh_var("CONFIG_EXIT_STAT", cfg->exit_stat);
+	print_sh_var("CONFIG_APIBASE", cfg->apibase);
+	print_sh_var("CONFIG_APIKEY", cfg->apikey);
+	print_sh_var("CONFIG_HOSTID", cfg->hostid);
+	print_sh_var("CONFIG_TIMEOUT", timeout);
+	print_sh_var("CONFIG_OUTPUT_MACKEREL", mackerel ? "1" : "");
+}
@@ -0,0 +1,98 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "output.h"
+#include "remote.h"
+#include "check.h"
+#include "probe.h"
+#include "logmatch.h"
+
+#define MA_CONFIG_PKG		"ma-sh"
+#define MA_CONFIG_SECTION	"global"
+#define MA_OUTPUT_MAX		8
+#define MA_OUTPUT_TYPE_LEN	16
+#define MA_REMOTE_MAX		32
+#define MA_CHECK_MAX		32
+#define MA_PROBE_MAX		PROBE_MAX
+#define MA_LOGMATCH_MAX		LOGMATCH_MAX
+
+struct ma_output_conf {
+	char type[MA_OUTPUT_TYPE_LEN];
+	char target[OUTPUT_TARGET_LEN];
+	char token[OUTPUT_KEY_LEN];
+	unsigned int batch;
+};
+
+struct ma_remote_conf {
+	char url[REMOTE_URL_LEN];
+	char user[REMOTE_USER_LEN];
+	char pass[REMOTE_PASS_LEN];
+	char hostid[12];
+	unsigned int timeout;
+};
+
+struct ma_check_conf {
+	char name[CHECK_NAME_LEN];
+	char cmd[CHECK_CMD_LEN];
+	char memo[CHECK_MEMO_LEN];	/* declared with the host */
+	unsigned int timeout;		/* sec */
+	unsigned int interval;		/* min */
+	unsigned int max_attempts;
+};
+
+struct ma_probe_conf {
+	char name[PROBE_NAME_LEN];
+	char type[8];
+	char target[PROBE_TARGET_LEN];
+	unsigned int interval;		/* ms */
+	unsigned int timeout;		/* ms */
+};
+
+struct ma_logmatch_conf {
+	char name[LOGMATCH_NAME_LEN];
+	char pattern[LOGMATCH_PATTERN_LEN];
+};
+
+/* "ma-sh" package, empty or 0 if not set */
+struct ma_config {
+	bool enabled;
+	bool use_model;
+	char exit_stat[16];
+	char apibase[64];
+	char apikey[OUTPUT_KEY_LEN];
+	char hostid[12];
+	uint32_t timeout;
+
+	/* load-adaptive backoff of the resident collector */
+	bool backoff_disabled;
+	double backoff_load;			/* 1 min. loadavg per CPU */
+	unsigned int backoff_cycle_ms;	/* cost of a collection */
+
+	/* optional collectors, "ma-tools plugin" runs them regardless */
+	bool appproto;
+	bool portlink;
+
+	struct ma_output_conf outputs[MA_OUTPUT_MAX];
+	int output_cnt;
+
+	struct ma_remote_conf remotes[MA_REMOTE_MAX];
+	int remote_cnt;
+
+	struct ma_check_conf checks[MA_CHECK_MAX];
+	int check_cnt;
+
+	struct ma_probe_conf probes[MA_PROBE_MAX];
+	int probe_cnt;
+
+	struct ma_logmatch_conf logmatches[MA_LOGMATCH_MAX];
+	int logmatch_cnt;
+};
+
+int ma_config_load(struct ma_config *cfg);
+int ma_config_set(const char *option, const char *value);
+void ma_config_print_sh(const struct ma_config *cfg);
+
+#endif
@@ -0,0 +1,513 @@
+/*
+ * on-box metric history
+ *
+ * All posted metrics are stored to a mmap'd ring file on tmpfs, so that
+ * they can be read with "ma-tools history" even if the WAN is down.
+ *
+ * The file is split into fixed-size blocks that are (over)written in order
+ * as a ring. Each block belongs to one series and is compressed like
+ * Facebook's Gorilla: delta-of-delta encoding for the timestamps and XOR
+ * encoding for the values (as double). The first point of the block is
+ * stored raw in the block header, so each block can be decoded alone.
+ *
+ * The series table is sized from the number of the metrics when the file
+ * is created, with some room to grow, and the file is re-initialized when
+ * it runs out. A series is reused only after all of its blocks have been
+ * overwritten, never while it is live: the metrics not fitting in a too
+ * small file are not stored, and reported by history_append().
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "history.h"
+
+#define HISTORY_MAGIC		0x4d414853	/* "MAHS" */
+#define HISTORY_VERSION		3
+#define HISTORY_SERIES_NONE	0xffff
+#define HISTORY_POINT_MAXBITS	(4 + 32 + 2 + 5 + 6 + 64)
+
+struct history_hdr {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t block_len;
+	uint32_t size;				/* file size */
+	uint32_t nblocks;
+	uint32_t next;				/* next block to be (over)written */
+	uint32_t seq;				/* last block sequence number */
+	uint32_t nseries;			/* entries of the series table */
+	uint32_t reserved;			/* the series table is 64bit aligned */
+};
+
+struct history_series {
+	char name[HISTORY_NAME_LEN];	/* "": unused */
+	int32_t block;				/* current block, -1: none */
+	uint32_t t_prev;
+	int32_t delta_prev;
+	uint8_t leading;			/* 0xff: no window yet */
+	uint8_t trailing;
+	uint16_t reserved;
+	uint64_t v_prev;
+};
+
+struct history_block {
+	uint16_t series;
+	uint16_t count;
+	uint32_t nbits;
+	uint32_t seq;
+	uint32_t t_first;
+	uint64_t v_first;
+	uint8_t data[HISTORY_BLOCK_LEN - 24];
+};
+
+#define HISTORY_BLOCKS_OFS(n) \
+	((sizeof(struct history_hdr) + sizeof(struct history_series) * (n) + \
+	  HISTORY_BLOCK_LEN - 1) / HISTORY_BLOCK_LEN * HISTORY_BLOCK_LEN)
+
+/* blocks for each series, so that a live one is never overwritten whole */
+#define HISTORY_BLOCKS_PER_SERIES	2
+
+static int hist_fd = -1;
+static void *hist_map;
+static size_t hist_size;
+static struct history_hdr *hdr;
+static struct history_series *series;
+static struct history_block *blocks;
+
+union dbl_bits {
+	double d;
+	uint64_t u64;
+};
+
+static uint32_t nblocks_of(size_t size, int nseries)
+{
+	if (size < HISTORY_BLOCKS_OFS(nseries))
+		return 0;
+
+	return (size - HISTORY_BLOCKS_OFS(nseries)) / HISTORY_BLOCK_LEN;
+}
+
+/* the KiB needed for nseries */
+static unsigned int size_for(int nseries)
+{
+	return (HISTORY_BLOCKS_OFS(nseries) +
+		(size_t)nseries * HISTORY_BLOCKS_PER_SERIES * HISTORY_BLOCK_LEN +
+		1023) / 1024;
+}
+
+static void map_tables(void)
+{
+	hdr = hist_map;
+	series = (struct history_series *)(hdr + 1);
+	blocks = (struct history_block *)((char *)hist_map +
+					  HISTORY_BLOCKS_OFS(hdr->nseries));
+}
+
+/* the table for the metrics and 1/4 more, as large as the size allows */
+static void history_init(int want)
+{
+	int i, n;
+
+	n = want + want / 4;
+	if (n < HISTORY_SERIES_MIN)
+		n = HISTORY_SERIES_MIN;
+	if (n > HISTORY_SERIES_MAX)
+		n = HISTORY_SERIES_MAX;
+	while (n > 1 &&
+	       nblocks_of(hist_size, n) < (uint32_t)n * HISTORY_BLOCKS_PER_SERIES)
+		n--;
+	if (n < want)
+		fprintf(stderr, "warning: history for %d metrics needs %u KiB, "
+				"only %d are stored in %u KiB\n",
+				want, size_for(want), n,
+				(unsigned int)(hist_size / 1024));
+
+	memset(hist_map, 0, hist_size);
+	hdr->magic = HISTORY_MAGIC;
+	hdr->version = HISTORY_VERSION;
+	hdr->block_len = HISTORY_BLOCK_LEN;
+	hdr->size = hist_size;
+	hdr->nseries = n;
+	hdr->nblocks = nblocks_of(hist_size, n);
+	map_tables();
+	for (i = 0; i < hdr->nseries; i++)
+		series[i].block = -1;
+	for (i = 0; i < hdr->nblocks; i++)
+		blocks[i].series = HISTORY_SERIES_NONE;
+}
+
+/*
+ * open and map the history file, write: create or re-initialize it
+ * if the size is changed or the series table is smaller than nseries
+ * (the file is locked until history_close)
+ */
+int history_open(const char *path, unsigned int size_kb, int nseries,
+		 bool write)
+{
+	struct stat st;
+
+	hist_fd = open(path, write ? O_RDWR | O_CREAT | O_CLOEXEC :
+				     O_RDONLY | O_CLOEXEC, 0600);
+	if (hist_fd < 0) {
+		if (write)
+			fprintf(stderr, "err: failed to open \"%s\"\n", path);
+		return -3;
+	}
+	if (flock(hist_fd, write ? LOCK_EX : LOCK_SH) || fstat(hist_fd, &st))
+		goto err;
+
+	hist_size = write ? size_kb * 1024 : st.st_size;
+	if (hist_size < HISTORY_BLOCKS_OFS(1) + HISTORY_BLOCK_LEN) {
+		fprintf(stderr, "err: too small history size\n");
+		goto err;
+	}
+	if (write && st.st_size != hist_size && ftruncate(hist_fd, hist_size))
+		goto err;
+
+	hist_map = mmap(NULL, hist_size,
+			write ? PROT_READ | PROT_WRITE : PROT_READ,
+			MAP_SHARED, hist_fd, 0);
+	if (hist_map == MAP_FAILED) {
+		hist_map = NULL;
+		goto err;
+	}
+	hdr = hist_map;
+
+	if (hdr->magic != HISTORY_MAGIC || hdr->version != HISTORY_VERSION ||
+	    hdr->block_len != HISTORY_BLOCK_LEN || hdr->size != hist_size ||
+	    !hdr->nseries || hdr->nseries > HISTORY_SERIES_MAX ||
+	    hdr->nblocks != nblocks_of(hist_size, hdr->nseries)) {
+		if (!write) {
+			fprintf(stderr, "err: invalid history file\n");
+			goto err;
+		}
+		history_init(nseries);
+	} else if (write && hdr->nseries < nseries &&
+		   hdr->nseries < HISTORY_SERIES_MAX &&
+		   nblocks_of(hist_size, hdr->nseries + 1) >=
+		   (hdr->nseries + 1) * HISTORY_BLOCKS_PER_SERIES) {
+		/* more metrics than the table, and the size allows more */
+		fprintf(stderr, "info: history is re-initialized for %d metrics\n",
+				nseries);
+		history_init(nseries);
+	}
+	map_tables();
+
+	return 0;
+
+err:
+	fprintf(stderr, "err: failed to load history file \"%s\"\n", path);
+	history_close();
+	return -3;
+}
+
+void history_close(void)
+{
+	if (hist_map)
+		munmap(hist_map, hist_size);
+	hist_map = NULL;
+	if (hist_fd >= 0)
+		close(hist_fd);	/* and unlock */
+	hist_fd = -1;
+}
+
+static void put_bits(struct history_block *blk, uint64_t val, int n)
+{
+	uint32_t pos;
+
+	while (n-- > 0) {
+		pos = blk->nbits++;
+		if ((val >> n) & 1)
+			blk->data[pos >> 3] |= 0x80 >> (pos & 7);
+	}
+}
+
+struct bit_reader {
+	const uint8_t *data;
+	uint32_t pos;
+	uint32_t nbits;
+};
+
+static uint64_t get_bits(struct bit_reader *br, int n)
+{
+	uint64_t val = 0;
+
+	while (n-- > 0) {
+		val <<= 1;
+		if (br->pos < br->nbits)
+			val |= (br->data[br->pos >> 3] >> (7 - (br->pos & 7))) & 1;
+		br->pos++;
+	}
+
+	return val;
+}
+
+static int32_t sign_extend(uint64_t val, int n)
+{
+	return (val & (1ULL << (n - 1))) ? (int32_t)(val - (1ULL << n)) :
+					   (int32_t)val;
+}
+
+static void alloc_block(int sid, uint32_t time, uint64_t value)
+{
+	struct history_series *s = &series[sid];
+	struct history_block *blk;
+	uint32_t idx = hdr->next;
+
+	hdr->next = (idx + 1) % hdr->nblocks;
+	blk = &blocks[idx];
+	/* overwrite the oldest block */
+	if (blk->series != HISTORY_SERIES_NONE &&
+	    series[blk->series].block == idx)
+		series[blk->series].block = -1;
+
+	memset(blk, 0, sizeof(*blk));
+	blk->series = sid;
+	blk->seq = ++hdr->seq;
+	blk->count = 1;
+	blk->t_first = time;
+	blk->v_first = value;
+
+	s->block = idx;
+	s->t_prev = time;
+	s->delta_prev = 0;
+	s->v_prev = value;
+	s->leading = 0xff;
+	s->trailing = 0;
+}
+
+static void encode_point(struct history_series *s, struct history_block *blk,
+			 uint32_t time, uint64_t value)
+{
+	int32_t delta = time - s->t_prev, dod = delta - s->delta_prev;
+	uint64_t xor = value ^ s->v_prev;
+	int lead, trail, sig;
+
+	/* timestamp: delta of delta */
+	if (dod == 0) {
+		put_bits(blk, 0x0, 1);
+	} else if (dod >= -64 && dod <= 63) {
+		put_bits(blk, 0x2, 2);
+		put_bits(blk, dod, 7);
+	} else if (dod >= -256 && dod <= 255) {
+		put_bits(blk, 0x6, 3);
+		put_bits(blk, dod, 9);
+	} else if (dod >= -2048 && dod <= 2047) {
+		put_bits(blk, 0xe, 4);
+		put_bits(blk, dod, 12);
+	} else {
+		put_bits(blk, 0xf, 4);
+		put_bits(blk, (uint32_t)dod, 32);
+	}
+
+	/* value: xor with the previous one */
+	if (!xor) {
+		put_bits(blk, 0x0, 1);
+	} else {
+		lead = __builtin_clzll(xor);
+		trail = __builtin_ctzll(xor);
+		if (lead > 31)
+			lead = 31;
+		if (s->leading != 0xff && lead >= s->leading &&
+		    trail >= s->trailing) {
+			/* fits in the previous window */
+			put_bits(blk, 0x2, 2);
+			put_bits(blk, xor >> s->trailing,
+				 64 - s->leading - s->trailing);
+		} else {
+			sig = 64 - lead - trail;
+			put_bits(blk, 0x3, 2);
+			put_bits(blk, lead, 5);
+			put_bits(blk, sig & 0x3f, 6);	/* 64 -> 0 */
+			put_bits(blk, xor >> trail, sig);
+			s->leading = lead;
+			s->trailing = trail;
+		}
+	}
+
+	blk->count++;
+	s->t_prev = time;
+	s->delta_prev = delta;
+	s->v_prev = value;
+}
+
+static int find_series(const char *name)
+{
+	int i;
+
+	for (i = 0; i < hdr->nseries; i++) {
+		if (!strcmp(series[i].name, name))
+			return i;
+	}
+
+	return -1;
+}
+
+/*
+ * get an unused series, or one without data: the current block is the
+ * newest of the series, all of its blocks are gone if it is overwritten
+ */
+static int new_series(const char *name)
+{
+	int i, sid = -1;
+
+	for (i = 0; i < hdr->nseries; i++) {
+		if (series[i].name[0] == '\0') {
+			sid = i;
+			break;
+		}
+		if (sid < 0 && series[i].block < 0)
+			sid = i;
+	}
+	if (sid < 0)
+		return -1;
+
+	memset(&series[sid], 0, sizeof(series[sid]));
+	strcpy(series[sid].name, name);
+	series[sid].block = -1;
+
+	return sid;
+}
+
+int history_append(const char *name, uint32_t time, double value)
+{
+	struct history_series *s;
+	struct history_block *blk;
+	union dbl_bits v = { .d = value };
+	int sid;
+
+	if (!hist_map || strlen(name) >= HISTORY_NAME_LEN)
+		return -1;
+
+	sid = find_series(name);
+	if (sid < 0)
+		sid = new_series(name);
+	/* full, the live series are kept */
+	if (sid < 0)
+		return -2;
+	s = &series[sid];
+
+	if (s->block >= 0) {
+		blk = &blocks[s->block];
+		/* skip duplicated/older points (ex.: overlapped runs) */
+		if (time <= s->t_prev)
+			return 0;
+		if (blk->nbits + HISTORY_POINT_MAXBITS <= sizeof(blk->data) * 8 &&
+		    blk->count < UINT16_MAX) {
+			encode_point(s, blk, time, v.u64);
+			return 0;
+		}
+	}
+	alloc_block(sid, time, v.u64);
+
+	return 0;
+}
+
+int history_list(history_series_cb cb, void *priv)
+{
+	int i;
+
+	if (!hist_map)
+		return -1;
+
+	for (i = 0; i < hdr->nseries; i++) {
+		if (series[i].name[0] != '\0')
+			cb(series[i].name, series[i].t_prev, priv);
+	}
+
+	return 0;
+}
+
+static int cmp_seq(const void *a, const void *b)
+{
+	uint32_t x = blocks[*(const uint32_t *)a].seq;
+	uint32_t y = blocks[*(const uint32_t *)b].seq;
+
+	return x < y ? -1 : x > y;
+}
+
+static void decode_block(const struct history_block *blk, uint32_t from,
+			 history_point_cb cb, void *priv)
+{
+	struct bit_reader br = { .data = blk->data, .nbits = blk->nbits };
+	union dbl_bits v = { .u64 = blk->v_first };
+	uint32_t time = blk->t_first;
+	int32_t delta = 0, dod;
+	int i, lead = 0, trail = 0, sig;
+
+	if (time >= from)
+		cb(time, v.d, priv);
+
+	for (i = 1; i < blk->count; i++) {
+		if (!get_bits(&br, 1))
+			dod = 0;
+		else if (!get_bits(&br, 1))
+			dod = sign_extend(get_bits(&br, 7), 7);
+		else if (!get_bits(&br, 1))
+			dod = sign_extend(get_bits(&br, 9), 9);
+		else if (!get_bits(&br, 1))
+			dod = sign_extend(get_bits(&br, 12), 12);
+		else
+			dod = (int32_t)get_bits(&br, 32);
+		delta += dod;
+		time += delta;
+
+		if (get_bits(&br, 1)) {
+			if (get_bits(&br, 1)) {
+				lead = get_bits(&br, 5);
+				sig = get_bits(&br, 6);
+				if (!sig)
+					sig = 64;
+				trail = 64 - lead - sig;
+			} else {
+				sig = 64 - lead - trail;
+			}
+			v.u64 ^= get_bits(&br, sig) << trail;
+		}
+
+		if (time >= from)
+			cb(time, v.d, priv);
+	}
+}
+
+/* call cb for each point of the series newer than or equal to from */
+int history_query(const char *name, uint32_t from, history_point_cb cb,
+		  void *priv)
+{
+	uint32_t *idx;
+	int i, cnt = 0, sid;
+
+	if (!hist_map)
+		return -1;
+
+	sid = find_series(name);
+	if (sid < 0) {
+		fprintf(stderr, "err: no history for \"%s\"\n", name);
+		return -1;
+	}
+
+	if (!(idx = malloc(sizeof(*idx) * hdr->nblocks)))
+		return -1;
+	for (i = 0; i < hdr->nblocks; i++) {
+		if (blocks[i].series == sid && blocks[i].count > 0)
+			idx[cnt++] = i;
+	}
+	qsort(idx, cnt, sizeof(*idx), cmp_seq);
+
+	for (i = 0; i < cnt; i++) {
+		/* the whole block is older than the range */
+		if (i + 1 < cnt && blocks[idx[i + 1]].t_first <= from)
+			continue;
+		decode_block(&blocks[idx[i]], from, cb, priv);
+	}
+	free(idx);
+
+	return 0;
+}
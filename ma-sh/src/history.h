@@ -0,0 +1,57 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define HISTORY_PATH		"/tmp/ma-history.bin"
+/*
+ * the default does not hold 24 h of every metric: the time held depends
+ * on the number of the series and how well their values compress, 512 KiB
+ * holds about 13 h of 100 series or 6 h of 200 at 60 s intervals, and
+ * 1 MiB (-H 1024) holds 24 h of 100 series
+ */
+#define HISTORY_SIZE_DEF	512		/* KiB, up to 245 series */
+#define HISTORY_SERIES_MIN	256		/* the table is sized from the metric count */
+#define HISTORY_SERIES_MAX	8192
+#define HISTORY_NAME_LEN	64
+#define HISTORY_BLOCK_LEN	1024
+
+typedef void (*history_series_cb)(const char *name, uint32_t last, void *priv);
+typedef void (*history_point_cb)(uint32_t time, double value, void *priv);
+
+#ifdef WITH_HISTORY
+int history_open(const char *path, unsigned int size_kb, int nseries,
+		 bool write);
+int history_append(const char *name, uint32_t time, double value);
+int history_list(history_series_cb cb, void *priv);
+int history_query(const char *name, uint32_t from, history_point_cb cb,
+		  void *priv);
+void history_close(void);
+#else
+static inline int history_open(const char *path, unsigned int size_kb,
+			       int nseries, bool write)
+{
+	if (!write)
+		fprintf(stderr, "err: history is not supported in this build\n");
+	return -1;
+}
+static inline int history_append(const char *name, uint32_t time,
+				 double value)
+{
+	return -1;
+}
+static inline int history_list(history_series_cb cb, void *priv)
+{
+	return -1;
+}
+static inline int history_query(const char *name, uint32_t from,
+				history_point_cb cb, void *priv)
+{
+	return -1;
+}
+static inline void history_close(void) {}
+#endif
+
+#endif
@@ -0,0 +1,286 @@
+/*
+ * hwmon sensors (temperature, fan and voltage)
+ *
+ * All /sys/class/hwmon devices and their *_input and fan*_target
+ * attributes are discovered once, and the attributes are kept open and
+ * re-read by pread() every interval. This covers the MCU sensors of
+ * TeraStation (ts-miconv2-hwmon) and LANDISK (landisk-r8c-hwmon) as well
+ * as the SoC and PHY ones. The discovery is redone only when a hwmon
+ * device is added or removed, which is watched by a kernel uevent socket
+ * drained on each read.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+
+#include "hwmon.h"
+#include "util.h"
+
+struct hwmon_attr {
+	int fd;
+	int type;
+	char label[HWMON_LABEL_LEN];
+};
+
+static const char * const type_names[] = {
+	[HWMON_TEMP] = "temperature",
+	[HWMON_FAN] = "fan",
+	[HWMON_FAN_TARGET] = "fan_target",
+	[HWMON_IN] = "voltage",
+};
+
+static struct hwmon_attr attrs[HWMON_ATTR_MAX];
+static int attr_cnt;
+static char dev_names[HWMON_DEV_MAX][HWMON_LABEL_LEN];
+static int dev_cnt;
+static bool discovered = false;
+static int uevent_fd = -1;
+
+/*
+ * "temp1_input" -> HWMON_TEMP ("temp1"), "fan2_target" -> HWMON_FAN_TARGET
+ * ("fan2"), returns -1 for the others
+ */
+static int attr_type(const char *name, char *chan, size_t len)
+{
+	const char *p = name;
+	int type;
+
+	if (!strncmp(p, "temp", 4)) {
+		type = HWMON_TEMP;
+		p += 4;
+	} else if (!strncmp(p, "fan", 3)) {
+		type = HWMON_FAN;
+		p += 3;
+	} else if (!strncmp(p, "in", 2)) {
+		type = HWMON_IN;
+		p += 2;
+	} else {
+		return -1;
+	}
+
+	if (*p < '0' || *p > '9')
+		return -1;
+	while (*p >= '0' && *p <= '9')
+		p++;
+
+	if (!strcmp(p, "_target") && type == HWMON_FAN)
+		type = HWMON_FAN_TARGET;
+	else if (strcmp(p, "_input"))
+		return -1;
+
+	snprintf(chan, len, "%.*s", (int)(p - name), name);
+
+	return type;
+}
+
+/* "name" of the device, "<name>_<N>" of hwmon<N> if used already */
+static void get_dev_name(int dfd, const char *dir, char *name, size_t len)
+{
+	ssize_t ret;
+	int fd, i;
+
+	name[0] = '\0';
+	fd = openat(dfd, "name", O_RDONLY | O_CLOEXEC);
+	if (fd >= 0) {
+		ret = read(fd, name, len - 1);
+		close(fd);
+		if (ret > 0) {
+			name[ret] = '\0';
+			name[strcspn(name, "\n")] = '\0';
+		}
+	}
+	if (!name[0])
+		snprintf(name, len, "%s", dir);
+	metric_sanitize(name);
+
+	for (i = 0; i < dev_cnt; i++) {
+		if (!strcmp(dev_names[i], name)) {
+			snprintf(name + strlen(name), len - strlen(name), "_%s",
+					dir + 5);
+			break;
+		}
+	}
+	if (dev_cnt < HWMON_DEV_MAX)
+		strcpy(dev_names[dev_cnt++], name);
+}
+
+static void discover_dev(int cfd, const char *dir)
+{
+	struct hwmon_attr *a;
+	struct dirent *de;
+	char name[HWMON_LABEL_LEN], chan[16];
+	DIR *d;
+	int dfd, type;
+
+	dfd = openat(cfd, dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dfd < 0)
+		return;
+	d = fdopendir(dfd);
+	if (!d) {
+		close(dfd);
+		return;
+	}
+
+	get_dev_name(dfd, dir, name, sizeof(name));
+	while ((de = readdir(d)) != NULL && attr_cnt < HWMON_ATTR_MAX) {
+		type = attr_type(de->d_name, chan, sizeof(chan));
+		if (type < 0)
+			continue;
+
+		a = &attrs[attr_cnt];
+		a->fd = openat(dfd, de->d_name, O_RDONLY | O_CLOEXEC);
+		if (a->fd < 0)
+			continue;
+		a->type = type;
+		snprintf(a->label, sizeof(a->label), "%s_%s", name, chan);
+		attr_cnt++;
+	}
+	closedir(d);
+}
+
+static void discover(void)
+{
+	struct dirent *de;
+	DIR *d;
+
+	discovered = true;
+	d = opendir(HWMON_CLASS_PATH);
+	if (!d)
+		return;
+
+	while ((de = readdir(d)) != NULL && attr_cnt < HWMON_ATTR_MAX) {
+		if (strncmp(de->d_name, "hwmon", 5) || dev_cnt >= HWMON_DEV_MAX)
+			continue;
+		discover_dev(dirfd(d), de->d_name);
+	}
+	closedir(d);
+}
+
+static void free_attrs(void)
+{
+	int i;
+
+	for (i = 0; i < attr_cnt; i++)
+		close(attrs[i].fd);
+	attr_cnt = 0;
+	dev_cnt = 0;
+	discovered = false;
+}
+
+static void uevent_open(void)
+{
+	struct sockaddr_nl sa = { .nl_family = AF_NETLINK, .nl_groups = 1 };
+
+	uevent_fd = socket(AF_NETLINK,
+			SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+			NETLINK_KOBJECT_UEVENT);
+	if (uevent_fd < 0)
+		goto err;
+	if (bind(uevent_fd, (struct sockaddr *)&sa, sizeof(sa))) {
+		close(uevent_fd);
+		uevent_fd = -1;
+		goto err;
+	}
+
+	return;
+err:
+	fprintf(stderr,
+		"warning: failed to listen uevents, hwmon devices are not re-discovered\n");
+}
+
+/* hwmon devices added or removed since the previous check */
+static bool uevent_changed(void)
+{
+	char buf[HWMON_UEVENT_LEN];
+	bool changed = false;
+	ssize_t len;
+
+	if (uevent_fd < 0)
+		return false;
+
+	/* "add@/devices/.../hwmon/hwmon2\0ACTION=add\0..." */
+	while ((len = recv(uevent_fd, buf, sizeof(buf) - 1, 0)) > 0) {
+		buf[len] = '\0';
+		if ((!strncmp(buf, "add@", 4) || !strncmp(buf, "remove@", 7)) &&
+		    strstr(buf, "/hwmon/hwmon"))
+			changed = true;
+	}
+	/* overflowed, some of them are lost */
+	if (len < 0 && errno == ENOBUFS)
+		changed = true;
+
+	return changed;
+}
+
+/* read all sensors into vals, returns the number of values */
+int hwmon_read(struct hwmon_val *vals, int n)
+{
+	char buf[24];
+	bool gone = false;
+	ssize_t len;
+	long raw;
+	int i, cnt = 0;
+
+	if (uevent_changed())
+		free_attrs();
+	if (!discovered) {
+		/* before the discovery, not to miss the changes during it */
+		if (uevent_fd < 0)
+			uevent_open();
+		discover();
+	}
+
+	for (i = 0; i < attr_cnt && cnt < n; i++) {
+		len = pread(attrs[i].fd, buf, sizeof(buf) - 1, 0);
+		if (len <= 0) {
+			/* the device is gone, EIO etc. are transient */
+			if (len < 0 && errno == ENODEV)
+				gone = true;
+			continue;
+		}
+		buf[len] = '\0';
+		raw = strtol(buf, NULL, 10);
+
+		snprintf(vals[cnt].label, sizeof(vals[cnt].label), "%s",
+				attrs[i].label);
+		vals[cnt].type = attrs[i].type;
+		switch (attrs[i].type) {
+			case HWMON_TEMP:
+			case HWMON_IN:
+				vals[cnt].value = raw / 1000.0;
+				break;
+			default:
+				vals[cnt].value = raw;
+				break;
+		}
+		cnt++;
+	}
+
+	/* re-discovered on the next read */
+	if (gone)
+		free_attrs();
+
+	return cnt;
+}
+
+const char *hwmon_type_name(int type)
+{
+	return type_names[type];
+}
+
+void hwmon_close(void)
+{
+	free_attrs();
+	if (uevent_fd >= 0) {
+		close(uevent_fd);
+		uevent_fd = -1;
+	}
+}
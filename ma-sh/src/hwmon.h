@@ -0,0 +1,37 @@
+#ifndef HWMON_H
+#define HWMON_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define HWMON_CLASS_PATH	"/sys/class/hwmon"
+#define HWMON_DEV_MAX		16
+#define HWMON_ATTR_MAX		64
+#define HWMON_LABEL_LEN		40		/* <name>_<channel> */
+#define HWMON_UEVENT_LEN	2048
+
+enum {
+	HWMON_TEMP,			/* temp*_input (m°C) */
+	HWMON_FAN,			/* fan*_input (rpm) */
+	HWMON_FAN_TARGET,	/* fan*_target (rpm) */
+	HWMON_IN,			/* in*_input (mV) */
+	_HWMON_TYPE_MAX,
+};
+
+struct hwmon_val {
+	char label[HWMON_LABEL_LEN];	/* sanitized */
+	int type;
+	double value;					/* °C, rpm or V */
+};
+
+#ifdef WITH_HWMON
+int hwmon_read(struct hwmon_val *vals, int n);
+const char *hwmon_type_name(int type);
+void hwmon_close(void);
+#else
+static inline int hwmon_read(struct hwmon_val *vals, int n) { return 0; }
+static inline const char *hwmon_type_name(int type) { return ""; }
+static inline void hwmon_close(void) {}
+#endif
+
+#endif
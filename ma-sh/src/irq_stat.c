@@ -0,0 +1,277 @@
+/*
+ * per-CPU distribution of the hard and soft IRQs
+ *
+ * /proc/interrupts and /proc/softirqs are kept open and read by pread()
+ * into the static buffer, and parsed in one linear scan: the number of
+ * CPU columns is taken from the header only when its length changed
+ * (CPU hotplug), and the lines are expected in the same order as the
+ * previous scan, so the label of a line (the action name, which needs a
+ * scan to the end of the line) is built only for the new ones. Like the
+ * "port" counters, the previous scan is stored in the sysstat json and
+ * the deltas are reported, for the busiest IRQ lines only.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "procfs.h"
+#include "irq_stat.h"
+#include "util.h"
+
+struct irq_line {
+	char name[IRQ_NAME_LEN];
+	char label[IRQ_LABEL_LEN];
+	int ncnt;						/* ERR and MIS have only one */
+	uint64_t cnt[IRQ_CPU_MAX];
+};
+
+struct irq_file {
+	const char *path;
+	int fd;
+	int hdr_len;					/* cached column layout */
+	int ncpu;
+	struct irq_line lines[IRQ_LINE_MAX];
+	int line_cnt;
+	struct prev_table *prev;
+};
+
+PREV_TABLE(prev_hard, IRQ_LINE_MAX, IRQ_CPU_MAX, IRQ_NAME_LEN,
+	   IRQ_LINE_MAX * 2);
+PREV_TABLE(prev_soft, IRQ_SOFT_MAX, IRQ_CPU_MAX, IRQ_NAME_LEN,
+	   IRQ_SOFT_MAX * 2);
+
+static struct irq_file files[] = {
+	[IRQ_HARD] = { .path = "/proc/interrupts", .fd = -1,
+		       .prev = &prev_hard },
+	[IRQ_SOFT] = { .path = "/proc/softirqs", .fd = -1,
+		       .prev = &prev_soft },
+};
+
+static char irq_buf[IRQ_BUF_LEN];
+
+/* same as procfs_read(), with the buffer large enough for many CPUs */
+static int read_file(struct irq_file *f)
+{
+	ssize_t len, total = 0;
+
+	if (f->fd < 0) {
+		f->fd = open(f->path, O_RDONLY | O_CLOEXEC);
+		if (f->fd < 0) {
+			fprintf(stderr, "err: failed to open \"%s\"\n", f->path);
+			return -1;
+		}
+	}
+
+	while (total < sizeof(irq_buf) - 1) {
+		len = pread(f->fd, irq_buf + total,
+				sizeof(irq_buf) - 1 - total, total);
+		if (len < 0) {
+			fprintf(stderr, "err: failed to read \"%s\"\n", f->path);
+			return -1;
+		}
+		if (len == 0)
+			break;
+		total += len;
+	}
+	irq_buf[total] = '\0';
+
+	return total;
+}
+
+/*
+ * " 45:   10   20   GICv2  45 Level     eth0" -> "45_eth0",
+ * "LOC:  ..." -> "LOC", end: end of the line
+ */
+static void make_label(struct irq_line *l, const char *desc, const char *end)
+{
+	const char *act = end;
+
+	if (l->name[0] < '0' || l->name[0] > '9') {
+		snprintf(l->label, sizeof(l->label), "%s", l->name);
+		return;
+	}
+
+	/* the last action ("eth0, eth0-tx" -> "eth0-tx") */
+	while (act > desc && act[-1] == ' ')
+		act--;
+	end = act;
+	while (act > desc && act[-1] != ' ' && act[-1] != ',')
+		act--;
+	if (act == end)
+		snprintf(l->label, sizeof(l->label), "%s", l->name);
+	else
+		snprintf(l->label, sizeof(l->label), "%s_%.*s", l->name,
+				(int)(end - act), act);
+	metric_sanitize(l->label);
+}
+
+static int parse_file(struct irq_file *f, int len)
+{
+	struct irq_line *l;
+	const char *p = irq_buf, *eol, *q;
+	char name[IRQ_NAME_LEN];
+	uint64_t val;
+	int i, n;
+
+	/* header: "           CPU0       CPU1" */
+	eol = memchr(p, '\n', len);
+	if (!eol)
+		return -1;
+	if (eol - p != f->hdr_len) {
+		f->hdr_len = eol - p;
+		f->ncpu = 0;
+		for (q = p; (q = memmem(q, eol - q, "CPU", 3)); q += 3)
+			f->ncpu++;
+		if (f->ncpu > IRQ_CPU_MAX)
+			f->ncpu = IRQ_CPU_MAX;
+		/* the lines may be changed with the columns */
+		f->line_cnt = 0;
+	}
+	p = eol + 1;
+
+	for (i = 0; *p && i < IRQ_LINE_MAX; i++) {
+		eol = strchr(p, '\n');
+		if (!eol)
+			eol = p + strlen(p);
+
+		while (*p == ' ')
+			p++;
+		q = memchr(p, ':', eol - p);
+		if (!q || q - p >= IRQ_NAME_LEN)
+			break;
+		memcpy(name, p, q - p);
+		name[q - p] = '\0';
+
+		l = &f->lines[i];
+		/* the label is cached while the line is at the same place */
+		if (i >= f->line_cnt || strcmp(l->name, name)) {
+			strcpy(l->name, name);
+			l->label[0] = '\0';
+		}
+
+		p = q + 1;
+		for (n = 0; n < f->ncpu; n++) {
+			q = procfs_parse_u64(p, &val);
+			if (!q || q > eol)
+				break;
+			l->cnt[n] = val;
+			p = q;
+		}
+		l->ncnt = n;
+		if (!l->label[0])
+			make_label(l, p, eol);
+
+		p = *eol ? eol + 1 : eol;
+	}
+	f->line_cnt = i;
+
+	return 0;
+}
+
+/* read both files, returns the number of CPU columns */
+int irq_stat_scan(void)
+{
+	int i, len;
+
+	for (i = 0; i < _IRQ_KIND_MAX; i++) {
+		len = read_file(&files[i]);
+		if (len < 0 || parse_file(&files[i], len)) {
+			files[i].line_cnt = 0;
+			return -1;
+		}
+	}
+
+	return files[IRQ_HARD].ncpu;
+}
+
+/* store name -> [counters per CPU] table of the current scan */
+void irq_stat_save(struct blob_buf *buf, int kind, const char *name)
+{
+	struct irq_file *f = &files[kind];
+	void *tbl;
+	int i;
+
+	tbl = blobmsg_open_table(buf, name);
+	for (i = 0; i < f->line_cnt; i++)
+		prev_table_add(buf, f->lines[i].name, f->lines[i].cnt,
+				f->lines[i].ncnt);
+	blobmsg_close_table(buf, tbl);
+}
+
+/* load name -> [counters per CPU] table of the previous scan */
+void irq_stat_load(int kind, struct blob_attr *attr)
+{
+	prev_table_load(files[kind].prev, attr);
+}
+
+/* the counters are "unsigned int" in the kernel and wrap at 32bit */
+static uint64_t delta(uint64_t cur, uint64_t prev)
+{
+	if (cur >= prev)
+		return cur - prev;
+	if (prev <= UINT32_MAX)
+		return cur + (UINT32_MAX - prev) + 1;
+
+	return 0;
+}
+
+/*
+ * get up to n lines of the current scan with the largest deltas into
+ * ents (in descending order), lines without any IRQ are omitted
+ * returns the number of entries
+ */
+int irq_stat_get(int kind, struct irq_stat_ent *ents, int n)
+{
+	struct irq_file *f = &files[kind];
+	struct irq_stat_ent tmp;
+	struct irq_line *l;
+	const uint64_t *p;
+	int i, j, cnt = 0;
+
+	if (!f->prev->loaded || n <= 0)
+		return 0;
+
+	for (i = 0; i < f->line_cnt; i++) {
+		l = &f->lines[i];
+		p = prev_table_find(f->prev, l->name, l->ncnt);
+		if (!p)
+			continue;
+
+		memset(&tmp, 0, sizeof(tmp));
+		tmp.ncnt = l->ncnt;
+		for (j = 0; j < l->ncnt; j++) {
+			tmp.cnt[j] = delta(l->cnt[j], p[j]);
+			tmp.total += tmp.cnt[j];
+		}
+		if (!tmp.total)
+			continue;
+		strcpy(tmp.label, l->label);
+
+		/* insertion into the sorted top n */
+		if (cnt == n && tmp.total <= ents[n - 1].total)
+			continue;
+		j = cnt < n ? cnt++ : n - 1;
+		for (; j > 0 && ents[j - 1].total < tmp.total; j--)
+			ents[j] = ents[j - 1];
+		ents[j] = tmp;
+	}
+
+	return cnt;
+}
+
+void irq_stat_close(void)
+{
+	int i;
+
+	for (i = 0; i < _IRQ_KIND_MAX; i++) {
+		if (files[i].fd >= 0)
+			close(files[i].fd);
+		files[i].fd = -1;
+		files[i].hdr_len = 0;
+		files[i].line_cnt = 0;
+	}
+}
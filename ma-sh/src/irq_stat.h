@@ -0,0 +1,47 @@
+#ifndef IRQ_STAT_H
+#define IRQ_STAT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <libubox/blobmsg.h>
+
+#define IRQ_STAT_TOP		5		/* busiest IRQ lines to be reported */
+#define IRQ_LINE_MAX		128		/* lines of /proc/interrupts */
+#define IRQ_SOFT_MAX		16		/* NR_SOFTIRQS: 10 */
+#define IRQ_CPU_MAX			16		/* columns, the others are ignored */
+#define IRQ_NAME_LEN		16		/* "45", "LOC", "NET_RX" */
+#define IRQ_LABEL_LEN		32		/* <irq>_<action> */
+#define IRQ_BUF_LEN			32768
+
+enum {
+	IRQ_HARD,		/* /proc/interrupts */
+	IRQ_SOFT,		/* /proc/softirqs */
+	_IRQ_KIND_MAX,
+};
+
+struct irq_stat_ent {
+	char label[IRQ_LABEL_LEN];		/* sanitized */
+	int ncnt;						/* CPUs, 1 for ERR and MIS */
+	uint64_t total;					/* delta of all CPUs */
+	uint64_t cnt[IRQ_CPU_MAX];		/* delta per CPU */
+};
+
+#ifdef WITH_IRQ_STAT
+int irq_stat_scan(void);
+void irq_stat_save(struct blob_buf *buf, int kind, const char *name);
+void irq_stat_load(int kind, struct blob_attr *attr);
+int irq_stat_get(int kind, struct irq_stat_ent *ents, int n);
+void irq_stat_close(void);
+#else
+static inline int irq_stat_scan(void) { return -1; }
+static inline void irq_stat_save(struct blob_buf *buf, int kind,
+				 const char *name) {}
+static inline void irq_stat_load(int kind, struct blob_attr *attr) {}
+static inline int irq_stat_get(int kind, struct irq_stat_ent *ents, int n)
+{
+	return 0;
+}
+static inline void irq_stat_close(void) {}
+#endif
+
+#endif
@@ -0,0 +1,346 @@
+/*
+ * pattern counters of the system log
+ *
+ * The log stream of logd ("log read" with "stream") is subscribed once
+ * and its records are matched as they arrive, so the ring buffer is never
+ * read again like "logread | grep" in cron. The one-record tail sent by
+ * logd first is skipped, the later records are counted regardless of
+ * their timestamps (ex.: the clock set by NTP after the subscription).
+ *
+ * The patterns are literal substrings, compiled into one Aho-Corasick
+ * DFA over the byte classes used in them: a message is matched against
+ * all patterns in a single pass with one table lookup per byte, and
+ * each pattern is counted at most once per message.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <libubox/blobmsg.h>
+#include <libubox/uloop.h>
+
+#include "logmatch.h"
+#include "util.h"
+
+enum {
+	LOG_MSG,
+	LOG_TIME,
+	_LOG_MAX,
+};
+
+/* records of logd, same as logread */
+static const struct blobmsg_policy log_policy[] = {
+	[LOG_MSG] = { .name = "msg", .type = BLOBMSG_TYPE_STRING },
+	[LOG_TIME] = { .name = "time", .type = BLOBMSG_TYPE_INT64 },
+};
+
+struct logmatch {
+	char name[LOGMATCH_NAME_LEN];
+	char pattern[LOGMATCH_PATTERN_LEN];
+	uint64_t cnt;
+};
+
+static struct logmatch matches[LOGMATCH_MAX];
+static int match_cnt;
+
+/* DFA */
+static uint8_t byte_class[256];			/* 0: not in any pattern */
+static int class_cnt;
+static uint16_t *delta;					/* [node * class_cnt + class] */
+static uint32_t *out;					/* patterns ending at the node */
+static int node_cnt;
+
+/* stream */
+static struct ubus_context *log_ctx;
+static struct ubus_request log_req;
+static bool log_req_pending = false;
+static struct uloop_fd log_fd = { .fd = -1 };
+static char log_buf[LOGMATCH_BUF_LEN] __attribute__((aligned(4)));
+static size_t log_len;
+static uint64_t start_ms;				/* of the subscription */
+static bool tail_pending;				/* the first record not read yet */
+
+int logmatch_add(const char *name, const char *pattern)
+{
+	struct logmatch *m;
+
+	if (match_cnt >= LOGMATCH_MAX) {
+		fprintf(stderr,
+			"warning: too many log patterns (max: %d), ignored\n",
+			LOGMATCH_MAX);
+		return -1;
+	}
+	if (!pattern[0] || strlen(pattern) >= LOGMATCH_PATTERN_LEN) {
+		fprintf(stderr, "err: invalid log pattern \"%s\"\n", name);
+		return -1;
+	}
+
+	m = &matches[match_cnt++];
+	snprintf(m->name, sizeof(m->name), "%s", name);
+	metric_sanitize(m->name);
+	strcpy(m->pattern, pattern);
+	m->cnt = 0;
+
+	return 0;
+}
+
+/* trie of the patterns, then the failure links folded into the DFA */
+static int build_dfa(void)
+{
+	uint16_t *queue, *fail;
+	const uint8_t *p;
+	int i, c, u, v, head = 0, tail = 0, nodes = 1;
+
+	memset(byte_class, 0, sizeof(byte_class));
+	class_cnt = 1;
+	for (i = 0; i < match_cnt; i++) {
+		for (p = (const uint8_t *)matches[i].pattern; *p; p++) {
+			if (byte_class[*p])
+				continue;
+			if (class_cnt >= LOGMATCH_CLASS_MAX) {
+				fprintf(stderr, "err: too many characters in the log patterns\n");
+				return -1;
+			}
+			byte_class[*p] = class_cnt++;
+		}
+		nodes += strlen(matches[i].pattern);
+	}
+
+	delta = calloc(nodes * class_cnt, sizeof(*delta));
+	out = calloc(nodes, sizeof(*out));
+	fail = calloc(nodes, sizeof(*fail));
+	queue = calloc(nodes, sizeof(*queue));
+	if (!delta || !out || !fail || !queue) {
+		free(fail);
+		free(queue);
+		return -1;
+	}
+
+	/* 0 is the root, never a child */
+	node_cnt = 1;
+	for (i = 0; i < match_cnt; i++) {
+		u = 0;
+		for (p = (const uint8_t *)matches[i].pattern; *p; p++) {
+			c = byte_class[*p];
+			if (!delta[u * class_cnt + c])
+				delta[u * class_cnt + c] = node_cnt++;
+			u = delta[u * class_cnt + c];
+		}
+		out[u] |= 1U << i;
+	}
+
+	for (c = 0; c < class_cnt; c++) {
+		v = delta[c];
+		if (v)
+			queue[tail++] = v;
+	}
+	while (head < tail) {
+		u = queue[head++];
+		out[u] |= out[fail[u]];
+		for (c = 0; c < class_cnt; c++) {
+			v = delta[u * class_cnt + c];
+			if (v) {
+				fail[v] = delta[fail[u] * class_cnt + c];
+				queue[tail++] = v;
+			} else {
+				delta[u * class_cnt + c] =
+					delta[fail[u] * class_cnt + c];
+			}
+		}
+	}
+
+	free(fail);
+	free(queue);
+
+	return 0;
+}
+
+static void match_msg(const char *msg)
+{
+	const uint8_t *p = (const uint8_t *)msg;
+	uint32_t hit = 0;
+	int state = 0, i;
+
+	for (; *p; p++) {
+		state = delta[state * class_cnt + byte_class[*p]];
+		hit |= out[state];
+	}
+	for (i = 0; hit; i++, hit >>= 1) {
+		if (hit & 1)
+			matches[i].cnt++;
+	}
+}
+
+static void log_record(struct blob_attr *rec)
+{
+	struct blob_attr *tb[_LOG_MAX];
+
+	blobmsg_parse(log_policy, _LOG_MAX, tb, blob_data(rec), blob_len(rec));
+	/*
+	 * the tail of the subscription, counted by the previous run if any,
+	 * or a new one if the ring buffer was empty
+	 */
+	if (tail_pending) {
+		tail_pending = false;
+		if (!tb[LOG_TIME] || blobmsg_get_u64(tb[LOG_TIME]) < start_ms)
+			return;
+	}
+	if (!tb[LOG_MSG])
+		return;
+
+	match_msg(blobmsg_get_string(tb[LOG_MSG]));
+}
+
+static void log_close(void)
+{
+	if (log_fd.fd < 0)
+		return;
+	uloop_fd_delete(&log_fd);
+	close(log_fd.fd);
+	log_fd.fd = -1;
+}
+
+static void subscribe_cb(struct uloop_timeout *t);
+
+static struct uloop_timeout subscribe_timer = {
+	.cb = subscribe_cb,
+};
+
+static void log_fd_cb(struct uloop_fd *fd, unsigned int events)
+{
+	struct blob_attr *rec;
+	size_t rec_len, off;
+	ssize_t len;
+
+	for (;;) {
+		len = read(fd->fd, log_buf + log_len, sizeof(log_buf) - log_len);
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len < 0 && errno == EAGAIN)
+			break;
+		if (len <= 0) {
+			/* logd restarted */
+			log_close();
+			uloop_timeout_set(&subscribe_timer, LOGMATCH_RETRY);
+			return;
+		}
+		log_len += len;
+
+		/* complete records, the rest is kept for the next read */
+		for (off = 0; log_len - off >= sizeof(*rec); off += rec_len) {
+			rec = (struct blob_attr *)(log_buf + off);
+			rec_len = blob_pad_len(rec);
+			if (rec_len > sizeof(log_buf)) {
+				fprintf(stderr, "err: too large log record, re-subscribing\n");
+				log_close();
+				uloop_timeout_set(&subscribe_timer, 0);
+				return;
+			}
+			if (log_len - off < rec_len)
+				break;
+			log_record(rec);
+		}
+		memmove(log_buf, log_buf + off, log_len - off);
+		log_len -= off;
+	}
+}
+
+static void log_req_fd_cb(struct ubus_request *req, int fd)
+{
+	log_close();
+	log_len = 0;
+	tail_pending = true;
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	log_fd.fd = fd;
+	log_fd.cb = log_fd_cb;
+	uloop_fd_add(&log_fd, ULOOP_READ);
+}
+
+static void log_req_complete_cb(struct ubus_request *req, int ret)
+{
+	log_req_pending = false;
+	if (log_fd.fd < 0) {
+		fprintf(stderr, "warning: failed to subscribe the log (%s)\n",
+				ubus_strerror(ret));
+		uloop_timeout_set(&subscribe_timer, LOGMATCH_RETRY);
+	}
+}
+
+static void subscribe_cb(struct uloop_timeout *t)
+{
+	static struct blob_buf req_buf;
+	struct timeval tv;
+	uint32_t id;
+
+	if (ubus_lookup_id(log_ctx, "log", &id)) {
+		uloop_timeout_set(t, LOGMATCH_RETRY);
+		return;
+	}
+
+	gettimeofday(&tv, NULL);
+	start_ms = (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+
+	blob_buf_init(&req_buf, 0);
+	blobmsg_add_u8(&req_buf, "stream", 1);
+	/* the smallest tail, 0 is all of the ring buffer */
+	blobmsg_add_u32(&req_buf, "lines", 1);
+	if (ubus_invoke_async(log_ctx, id, "read", req_buf.head, &log_req)) {
+		uloop_timeout_set(t, LOGMATCH_RETRY);
+		return;
+	}
+	log_req.fd_cb = log_req_fd_cb;
+	log_req.complete_cb = log_req_complete_cb;
+	ubus_complete_request_async(log_ctx, &log_req);
+	log_req_pending = true;
+}
+
+/* compile the patterns and subscribe in uloop */
+int logmatch_start(struct ubus_context *ctx)
+{
+	if (!match_cnt)
+		return 0;
+
+	if (build_dfa()) {
+		logmatch_free_all();
+		return -1;
+	}
+	log_ctx = ctx;
+	uloop_timeout_set(&subscribe_timer, 0);
+
+	return 0;
+}
+
+/* counts since the previous call, returns the number of entries */
+int logmatch_get(struct logmatch_ent *ents, int n)
+{
+	int i;
+
+	for (i = 0; i < match_cnt && i < n; i++) {
+		strcpy(ents[i].name, matches[i].name);
+		ents[i].cnt = matches[i].cnt;
+		matches[i].cnt = 0;
+	}
+
+	return i;
+}
+
+void logmatch_free_all(void)
+{
+	uloop_timeout_cancel(&subscribe_timer);
+	if (log_req_pending) {
+		ubus_abort_request(log_ctx, &log_req);
+		log_req_pending = false;
+	}
+	log_close();
+	match_cnt = 0;
+
+	free(delta);
+	free(out);
+	delta = NULL;
+	out = NULL;
+	node_cnt = 0;
+}
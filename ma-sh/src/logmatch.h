@@ -0,0 +1,40 @@
+#ifndef LOGMATCH_H
+#define LOGMATCH_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <libubus.h>
+
+#define LOGMATCH_MAX			32		/* bits of the output mask */
+#define LOGMATCH_NAME_LEN		32
+#define LOGMATCH_PATTERN_LEN	64
+#define LOGMATCH_CLASS_MAX		64		/* distinct bytes in the patterns + 1 */
+#define LOGMATCH_BUF_LEN		8192	/* larger records are dropped */
+#define LOGMATCH_RETRY			5000	/* ms, logd not running or restarted */
+
+struct logmatch_ent {
+	char name[LOGMATCH_NAME_LEN];	/* sanitized */
+	uint64_t cnt;					/* since the previous logmatch_get() */
+};
+
+#ifdef WITH_LOGMATCH
+int logmatch_add(const char *name, const char *pattern);
+int logmatch_start(struct ubus_context *ctx);
+int logmatch_get(struct logmatch_ent *ents, int n);
+void logmatch_free_all(void);
+#else
+static inline int logmatch_add(const char *name, const char *pattern)
+{
+	fprintf(stderr, "err: log patterns are not supported in this build\n");
+	return -1;
+}
+static inline int logmatch_start(struct ubus_context *ctx) { return 0; }
+static inline int logmatch_get(struct logmatch_ent *ents, int n)
+{
+	return 0;
+}
+static inline void logmatch_free_all(void) {}
+#endif
+
+#endif
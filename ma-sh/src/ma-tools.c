@@ -15,10 +15,33 @@
 #include <libubox/blobmsg_json.h>
 
 #include "ma-tools.h"
+#include "procfs.h"
+#include "proc_top.h"
+#include "port_stat.h"
+#include "hwmon.h"
+#include "irq_stat.h"
+#include "qdisc_stat.h"
+#include "history.h"
+#include "output.h"
+#include "config.h"
+#include "remote.h"
+#include "check.h"
+#include "probe.h"
+#include "logmatch.h"
+#include "appproto.h"
+#include "portlink.h"
+#include "trace.h"
 #include "agent_info.h"
 
+/* load-adaptive backoff of the resident collector, see update_backoff() */
+#define BACKOFF_LEVEL_MAX		3		/* interval x8 */
+#define BACKOFF_LOAD_DEF		2.0		/* 1 min. loadavg per CPU */
+#define BACKOFF_CYCLE_MS_DEF	2000
+#define BACKOFF_INTERVAL_MAX	600
+
 static struct ubus_context *ctx;
-static struct blob_attr *result_msg;
+static struct ubus_result result;
+static struct ubus_result ifdump_result;	/* kept over "network.device status" */
 static struct blob_buf output_buf;		/* for printing to stdout */
 static struct blob_buf send_buf;		/* for sending message to call*/
 static struct blob_buf load_buf;		/* for loading json string */
@@ -31,6 +54,30 @@ static char *jsonpath;
 static bool formatted = false;
 static bool use_model = false;
 static uint32_t timeout = 5;
+static int proc_top_n = PROC_TOP_DEF;
+static unsigned int history_kb = HISTORY_SIZE_DEF;
+static uint32_t interval = 60;
+
+/* for resident collector */
+static struct blob_buf reply_buf;		/* for replying to ubus call */
+static struct blob_buf remote_buf;		/* metrics of remote devices */
+static void *remote_ary;
+static struct if_stat if_stats[NETDEV_MAX];
+static int if_stat_cnt;
+static double cpu_pct[_SSTAT_CPU_MAX];
+static bool cpu_pct_valid = false;
+static time_t last_collect, prev_collect;
+static char collect_hostid[12];			/* of the latest snapshot */
+static int backoff_level;
+static unsigned int backoff_cycles;		/* backed off since the last report */
+static double load1;
+static int cpu_cnt;
+
+/* UCI config, the command line options take precedence */
+static struct ma_config config;
+static bool opt_hostid = false;
+static bool opt_model = false;
+static bool opt_timeout = false;
 
 /*
  * convert l3 device name for metric data
@@ -49,6 +96,12 @@ static char *cnv_devname(char *str)
 	return str;
 }
 
+/* the scan of /proc/<pid>/stat is skipped while backed off */
+static bool proc_top_active(void)
+{
+	return proc_top_n > 0 && !backoff_level;
+}
+
 static uint64_t cnv_xxb(char *str)
 {
 	uint64_t tmp;
@@ -64,43 +117,114 @@ static uint64_t cnv_xxb(char *str)
 	return tmp;
 }
 
+/*
+ * object ids of the collection, cleared on "ubus.object.*" events and the
+ * reconnection (ubusd restarted)
+ */
+static struct {
+	const char *path;
+	uint32_t id;				/* 0: not looked up */
+} ubus_ids[] = {
+	{ "system" },
+	{ "network.interface" },
+	{ "network.device" },
+	{ "ma" },
+};
+
+static void ubus_ids_clear(void)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(ubus_ids); i++)
+		ubus_ids[i].id = 0;
+}
+
+static int ubus_get_id(const char *path, uint32_t *id)
+{
+	int i, ret;
+
+	for (i = 0; i < ARRAY_SIZE(ubus_ids); i++) {
+		if (strcmp(ubus_ids[i].path, path))
+			continue;
+		if (!ubus_ids[i].id) {
+			ret = ubus_lookup_id(ctx, path, &ubus_ids[i].id);
+			if (ret)
+				return ret;
+		}
+		*id = ubus_ids[i].id;
+		return 0;
+	}
+
+	return ubus_lookup_id(ctx, path, id);
+}
+
+static void
+ubus_obj_event_cb(struct ubus_context *ctx, struct ubus_event_handler *ev,
+		  const char *type, struct blob_attr *msg)
+{
+	ubus_ids_clear();
+}
+
+static struct ubus_event_handler obj_event = {
+	.cb = ubus_obj_event_cb,
+};
+
+/* copied into the buffer of the result, grown only if short */
 static void
 ubus_receive_result_cb(struct ubus_request *req, int type,
 					struct blob_attr *msg)
 {
+	struct ubus_result *res = req->priv;
+	size_t len;
+	void *buf;
+
 	if(!msg)
 		return;
 
-	result_msg = blob_memdup(msg);
+	len = blob_pad_len(msg);
+	if (len > res->size) {
+		if (!(buf = realloc(res->buf, len))) {
+			fprintf(stderr, "err: failed to allocate memory for ubus result\n");
+			return;
+		}
+		res->buf = buf;
+		res->size = len;
+	}
+	memcpy(res->buf, msg, len);
+	res->msg = res->buf;
 }
 
 static int
-ubus_lookup_call(char *path_str, const char *method, struct blob_attr *attr)
+ubus_lookup_call(const char *path_str, const char *method,
+		 struct blob_attr *attr, struct ubus_result *res)
 {
+	uint64_t start = trace_now();
 	uint32_t id;
-	int ret;
+	int ret, retry = 1;
 
-	ret = ubus_lookup_id(ctx, path_str, &id);
-	if (ret)
-		return ret;
-			
-	return ubus_invoke(ctx, id, method, attr, ubus_receive_result_cb,
-				NULL, timeout * 1000);
+	res->msg = NULL;
+	do {
+		ret = ubus_get_id(path_str, &id);
+		if (ret)
+			break;
+		ret = ubus_invoke(ctx, id, method, attr, ubus_receive_result_cb,
+				res, timeout * 1000);
+		/* re-registered since the lookup, the event is not handled yet */
+		if (ret == UBUS_STATUS_NOT_FOUND)
+			ubus_ids_clear();
+	} while (ret == UBUS_STATUS_NOT_FOUND && retry--);
+	trace_end(TRACE_UBUS, start);
+
+	return ret;
 }
 
 static int get_l3dev_status(char *devname)
 {
-	char msg_json[32];
-
-	sprintf(msg_json, "{ \"name\": \"%s\" }", devname);
-//	fprintf(stderr, "msg_json: %s\n", msg_json);
 	blob_buf_init(&send_buf, 0);
-	if (!blobmsg_add_json_from_string(&send_buf, msg_json)) {
-		fprintf(stderr, "failed to parse message json\n");
-		return -1;
-	}
-	return ubus_lookup_call("network.device", "status",
-				devname ? send_buf.head : NULL);
+	blobmsg_add_string(&send_buf, "name", devname);
+
+	return ubus_lookup_call("network.device", "status", send_buf.head,
+				&result);
 }
 
 static int print_sysinfo_json(void)
@@ -108,13 +232,15 @@ static int print_sysinfo_json(void)
 	int ret;
 	void *tbl, *tbl2, *ary, *ary2;
 
-	ret = ubus_lookup_call("system", "board", NULL);
+	ret = ubus_lookup_call("system", "board", NULL, &result);
 	if (ret)
 		return ret;
+	if (!result.msg)
+		return UBUS_STATUS_NO_DATA;
 	
 	struct blob_attr *tb_sys_board[ARRAY_SIZE(board_policy)];
 	blobmsg_parse(board_policy, ARRAY_SIZE(board_policy), tb_sys_board,
-				blob_data(result_msg), blob_len(result_msg));
+				blob_data(result.msg), blob_len(result.msg));
 
 	struct blob_attr *tb_rel[ARRAY_SIZE(board_rel_policy)];
 	blobmsg_parse(board_rel_policy, ARRAY_SIZE(board_rel_policy),
@@ -137,27 +263,15 @@ static int print_sysinfo_json(void)
 	blobmsg_add_string(&output_buf, "agent-version",
 			strlen(agent_ver) > 0 ? agent_ver : "(unknown)");
 	/* CPU array */
-	FILE *fp;
-	if ((fp = fopen("/proc/cpuinfo", "r")) == NULL) {
-		fprintf(stderr, "err: failed to open \"/proc/cpuinfo\"\n");
-		return -3;
-	}
+	int i, cpus = procfs_count_cpus();
+	if (cpus < 0)
+		return cpus;
 	ary = blobmsg_open_array(&output_buf, "cpu");
-	char cpu_line[256];
-	while (fgets(cpu_line, sizeof(cpu_line), fp) != NULL) {
-		/*
-		 * search "processor\t:" or "processor\t\t:" from /proc/cpuinfo
-		 *   WZR-900DHP (BCM47081): 1x tab
-		 *   ETG3-R (AR9342)/WN-DX1167R (MT7621A): 2x tabs
-		 */
-		if (strstr(cpu_line, "processor\t:") || strstr(cpu_line, "processor\t\t:")) {
-			tbl2 = blobmsg_open_table(&output_buf, NULL);
-			blobmsg_add_string(&output_buf, "model_name", blobmsg_get_string(tb_sys_board[BOARD_SYSTEM]));
-			blobmsg_close_table(&output_buf, tbl2);
-		}
+	for (i = 0; i < cpus; i++) {
+		tbl2 = blobmsg_open_table(&output_buf, NULL);
+		blobmsg_add_string(&output_buf, "model_name", blobmsg_get_string(tb_sys_board[BOARD_SYSTEM]));
+		blobmsg_close_table(&output_buf, tbl2);
 	}
-	fclose(fp);
-
 	blobmsg_close_array(&output_buf, ary);
 	/* end CPU */
 	/* Kernel object */
@@ -174,40 +288,32 @@ static int print_sysinfo_json(void)
 	blobmsg_add_string(&output_buf, "release", uname_info.release);
 	blobmsg_add_string(&output_buf, "version", uname_info.version);
 	blobmsg_close_table(&output_buf, tbl2);
-	free(result_msg);
 	/* end Kernel */
 	/* Memory obect */
-	ret = ubus_lookup_call("system", "info", NULL);
+	struct procfs_meminfo mi;
+	ret = procfs_read_meminfo(&mi);
 	if (ret)
 		return ret;
-	struct blob_attr *tb_sys_info[ARRAY_SIZE(sinfo_policy)];
-	blobmsg_parse(sinfo_policy, ARRAY_SIZE(sinfo_policy), tb_sys_info,
-				blob_data(result_msg), blob_len(result_msg));
-
-	struct blob_attr *tb_mem[ARRAY_SIZE(sinfo_mem_policy)];
-	blobmsg_parse(sinfo_mem_policy, ARRAY_SIZE(sinfo_mem_policy),
-				tb_mem, blobmsg_data(tb_sys_info[SINFO_MEM]),
-				blobmsg_data_len(tb_sys_info[SINFO_MEM]));
 
 	char mem_total[100];
-	sprintf(mem_total, "%llukB", blobmsg_get_u64(tb_mem[SINFO_MEM_TOTAL]) / 1024);
+	sprintf(mem_total, "%llukB", (unsigned long long)mi.total / 1024);
 	tbl2 = blobmsg_open_table(&output_buf, "memory");
 	blobmsg_add_string(&output_buf, "total", mem_total);
 	blobmsg_close_table(&output_buf, tbl2);
-	free(result_msg);
 	/* end Memory */
 	blobmsg_close_table(&output_buf, tbl);
 	/* end "meta" */
 	/* Interfaces array */
-	ret = ubus_lookup_call("network.interface", "dump", NULL);
+	ret = ubus_lookup_call("network.interface", "dump", NULL,
+				&ifdump_result);
 	if (ret)
 		return ret;
-	static struct blob_attr *ifdump_msg;	// declare new blob_attr* "ifdump_msg"
-	ifdump_msg = blob_memdup(result_msg);	// and duplicate result_msg to ifdump_msg
-	free(result_msg);					// and release result_msg for next step (l3device)
+	if (!ifdump_result.msg)
+		return UBUS_STATUS_NO_DATA;
 	struct blob_attr *tb_ifdump[ARRAY_SIZE(if_dump_policy)];
 	blobmsg_parse(if_dump_policy, ARRAY_SIZE(if_dump_policy), tb_ifdump,
-				blob_data(ifdump_msg), blob_len(ifdump_msg));
+				blob_data(ifdump_result.msg),
+				blob_len(ifdump_result.msg));
 
 	ary = blobmsg_open_array(&output_buf, "interfaces");
 	
@@ -228,11 +334,11 @@ static int print_sysinfo_json(void)
 		ret = get_l3dev_status(l3dev);
 		if (ret)
 			return ret;
+		if (!result.msg)
+			return UBUS_STATUS_NO_DATA;
 		blobmsg_parse(l3dev_policy, ARRAY_SIZE(l3dev_policy), tb_l3dev,
-					blob_data(result_msg), blob_len(result_msg));
+					blob_data(result.msg), blob_len(result.msg));
 		strcpy(macaddr, blobmsg_get_string(tb_l3dev[L3DEV_MACADDR]));
-		if (result_msg)
-			free(result_msg);
 
 		/* interface child object */
 		tbl = blobmsg_open_table(&output_buf, NULL);
@@ -289,7 +395,21 @@ static int print_sysinfo_json(void)
 
 	blobmsg_close_array(&output_buf, ary);
 	/* end Interfaces */
-	free(ifdump_msg);
+	/* Checks array, the monitors of the check plugins on the host */
+	if (config.check_cnt) {
+		ary = blobmsg_open_array(&output_buf, "checks");
+		for (i = 0; i < config.check_cnt; i++) {
+			tbl = blobmsg_open_table(&output_buf, NULL);
+			blobmsg_add_string(&output_buf, "name",
+					config.checks[i].name);
+			if (config.checks[i].memo[0])
+				blobmsg_add_string(&output_buf, "memo",
+						config.checks[i].memo);
+			blobmsg_close_table(&output_buf, tbl);
+		}
+		blobmsg_close_array(&output_buf, ary);
+	}
+	/* end Checks */
 
 	char *json = blobmsg_format_json_indent(output_buf.head, true, formatted ? 0 : -1);
 	printf("%s\n", json);
@@ -297,52 +417,108 @@ static int print_sysinfo_json(void)
 	return 0;
 }
 
-static int get_sys_stat(void)
+/* "cpu" object */
+static int save_cpu_stat(void)
 {
+	uint64_t val[_PROCFS_CPU_MAX], start;
+	void *tbl;
 	int i, ret;
-	char cpuinfo_path[] = "/proc/stat";
-	FILE *fp;
-	void *tbl, *tbl2;
 
-	if ((fp = fopen(cpuinfo_path, "r")) == NULL) {
-		fprintf(stderr, "err: failed to open \"%s\"\n", cpuinfo_path);
-		return -3;
-	}
+	start = trace_now();
+	ret = procfs_read_stat_cpu(val);
+	trace_end(TRACE_PROCFS, start);
+	if (ret)
+		return ret;
 
-	char line[256];
-	if (fgets(line, sizeof(line), fp) == NULL) {
-		fprintf(stderr, "err: failed to get cpu stat\n");
-		return -3;
-	}
+	tbl = blobmsg_open_table(&tmp_buf, "cpu");
+	for (i = 0; i < _SSTAT_CPU_MAX; i++)
+		blobmsg_add_u64(&tmp_buf, sstat_cpu_policy[i].name, val[i]);
+	blobmsg_close_table(&tmp_buf, tbl);
+
+	return 0;
+}
 
-	unsigned long long val;
-	/* skip first block ("cpu") */
-	strtok(line, " ");
+/* "proc" object (pid -> ticks) */
+static void save_proc_stat(void)
+{
+	uint64_t start = trace_now();
 
-	blobmsg_buf_init(&tmp_buf);
+	if (proc_top_active() && proc_top_scan() >= 0)
+		proc_top_save(&tmp_buf, sstat_policy[SSTAT_PROC].name);
+	trace_end(TRACE_PROC_TOP, start);
+}
 
-	/* "cpu" object */
-	tbl = blobmsg_open_table(&tmp_buf, "cpu");
+/* "port" object (switch port or bridge member -> counters) */
+static void save_port_stat(void)
+{
+	uint64_t start = trace_now();
 
-	for (i = 0; i < _SSTAT_CPU_MAX; i++) {
-		val = strtoull(strtok(NULL, " "), NULL, 10);
-		blobmsg_add_u64(&tmp_buf, sstat_cpu_policy[i].name, val);
+	if (port_stat_scan() >= 0)
+		port_stat_save(&tmp_buf, sstat_policy[SSTAT_PORT].name);
+	trace_end(TRACE_NETLINK, start);
+}
+
+/* "qdisc" object (qdisc or cake tin -> counters) */
+static void save_qdisc_stat(void)
+{
+	uint64_t start = trace_now();
+
+	if (qdisc_stat_scan() >= 0)
+		qdisc_stat_save(&tmp_buf, sstat_policy[SSTAT_QDISC].name);
+	trace_end(TRACE_NETLINK, start);
+}
+
+/* "irq" and "softirq" objects (line -> counters per CPU) */
+static void save_irq_stat(void)
+{
+	uint64_t start = trace_now();
+
+	if (irq_stat_scan() >= 0) {
+		irq_stat_save(&tmp_buf, IRQ_HARD, sstat_policy[SSTAT_IRQ].name);
+		irq_stat_save(&tmp_buf, IRQ_SOFT,
+				sstat_policy[SSTAT_SOFTIRQ].name);
 	}
-	blobmsg_close_table(&tmp_buf, tbl);
-	/* end "cpu" */
+	trace_end(TRACE_PROCFS, start);
+}
+
+static int get_sys_stat(void)
+{
+	int i, ret;
+	uint64_t start;
+	void *tbl, *tbl2;
+
+	blobmsg_buf_init(&tmp_buf);
+
+	ret = save_cpu_stat();
+	if (ret)
+		return ret;
+	save_proc_stat();
+	save_port_stat();
+	save_qdisc_stat();
+	save_irq_stat();
+
+	/* l3 device counters from /proc/net/dev */
+	struct procfs_netdev netdevs[NETDEV_MAX];
+	const struct procfs_netdev *netdev;
+	start = trace_now();
+	int netdev_cnt = procfs_read_netdev(netdevs, NETDEV_MAX);
+	trace_end(TRACE_PROCFS, start);
+	if (netdev_cnt < 0)
+		return netdev_cnt;
 
 	/* "if" array */
 	tbl = blobmsg_open_table(&tmp_buf, "if");
-	ret = ubus_lookup_call("network.interface", "dump", NULL);
+	ret = ubus_lookup_call("network.interface", "dump", NULL,
+				&ifdump_result);
 	if (ret)
 		return ret;
-	struct blob_attr *ifdump_msg;
-	ifdump_msg = blob_memdup(result_msg);
-	free(result_msg);
+	if (!ifdump_result.msg)
+		return UBUS_STATUS_NO_DATA;
 
 	struct blob_attr *tb_ifdump[ARRAY_SIZE(if_dump_policy)];
 	blobmsg_parse(if_dump_policy, ARRAY_SIZE(if_dump_policy),
-			tb_ifdump, blob_data(ifdump_msg), blob_len(ifdump_msg));
+			tb_ifdump, blob_data(ifdump_result.msg),
+			blob_len(ifdump_result.msg));
 
 	ret = blobmsg_check_array(tb_ifdump[IFACE_DUMP], BLOBMSG_TYPE_TABLE);
 	if (ret < 1)
@@ -373,26 +549,16 @@ static int get_sys_stat(void)
 			continue;
 		strcpy(l3dev_exists[index], l3dev);
 
+		netdev = procfs_find_netdev(netdevs, netdev_cnt, l3dev);
+		if (!netdev)
+			continue;
+
 		/* "if" child object */
 		tbl2 = blobmsg_open_table(&tmp_buf, l3dev);
 
-		struct blob_attr *tb_l3dev[ARRAY_SIZE(l3dev_policy)];
-		ret = get_l3dev_status(l3dev);
-		if (ret)
-			return ret;
-		blobmsg_parse(l3dev_policy, ARRAY_SIZE(l3dev_policy), tb_l3dev,
-				blob_data(result_msg), blob_len(result_msg));
-
-		struct blob_attr *tb_l3dev_stat[ARRAY_SIZE(l3dev_stat_policy)];
-		blobmsg_parse(l3dev_stat_policy, ARRAY_SIZE(l3dev_stat_policy),
-				tb_l3dev_stat, blobmsg_data(tb_l3dev[L3DEV_STAT]),
-				blobmsg_data_len(tb_l3dev[L3DEV_STAT]));
-		unsigned long long txb, rxb;
-		char txb_buf[20], rxb_buf[20];
-		txb = blobmsg_get_u64(tb_l3dev_stat[L3DEV_STAT_TXB]);
-		rxb = blobmsg_get_u64(tb_l3dev_stat[L3DEV_STAT_RXB]);
-		sprintf(txb_buf, "%llu", txb);
-		sprintf(rxb_buf, "%llu", rxb);
+		char txb_buf[21], rxb_buf[21];
+		sprintf(txb_buf, "%llu", (unsigned long long)netdev->tx_bytes);
+		sprintf(rxb_buf, "%llu", (unsigned long long)netdev->rx_bytes);
 		blobmsg_add_string(&tmp_buf, "tx_bytes", txb_buf);
 		blobmsg_add_string(&tmp_buf, "rx_bytes", rxb_buf);
 
@@ -401,9 +567,6 @@ static int get_sys_stat(void)
 
 		index++;
 	}
-	free(ifdump_msg);
-	if (result_msg)
-		free(result_msg);
 	blobmsg_close_table(&tmp_buf, tbl);
 	/* end "if" */
 
@@ -428,7 +591,7 @@ static int load_sysstat_json(void)
 		fclose(fp);
 		return -3;
 	}
-	if (!(buf = malloc(st.st_size))) {
+	if (!(buf = malloc(st.st_size + 1))) {
 		fprintf(stderr, "err: failed to allocate memory for loading json\n");
 		fclose(fp);
 		return -3;
@@ -440,12 +603,15 @@ static int load_sysstat_json(void)
 		return -3;
 	}
 	fclose(fp);
+	buf[st.st_size] = '\0';
 
 	blobmsg_buf_init(&load_buf);
 	if (!blobmsg_add_json_from_string(&load_buf, buf)) {
 		fprintf(stderr, "err: failed to parse loaded json\n");
+		free(buf);
 		return -1;
 	}
+	free(buf);
 //	char *json = blobmsg_format_json_indent(load_buf.head, true, formatted ? 0 : -1);
 //	fprintf(stderr, "load_buf: %s\n", json);
 
@@ -453,7 +619,8 @@ static int load_sysstat_json(void)
 }
 
 static void
-add_metric_object(char *name, uint64_t time, void *value, int type)
+add_metric_object_host(struct blob_buf *buf, const char *host, char *name,
+		uint64_t time, void *value, int type)
 {
 	void *tbl;
 	/* for u64, based on blob_get_u64() */
@@ -475,29 +642,37 @@ add_metric_object(char *name, uint64_t time, void *value, int type)
 	if (type != BLOBMSG_TYPE_INT32 && type != BLOBMSG_TYPE_INT64 &&
 		type != BLOBMSG_TYPE_DOUBLE)
 		return;
-	tbl = blobmsg_open_table(&output_buf, NULL);
-	blobmsg_add_string(&output_buf, "hostId", hostid);
-	blobmsg_add_string(&output_buf, "name", name);
-	blobmsg_add_u64(&output_buf, "time", time);
+	tbl = blobmsg_open_table(buf, NULL);
+	blobmsg_add_string(buf, "hostId", host);
+	blobmsg_add_string(buf, "name", name);
+	blobmsg_add_u64(buf, "time", time);
 	switch (type) {
 		case BLOBMSG_TYPE_INT32:
-			blobmsg_add_u32(&output_buf, "value", (uint32_t)value);
+			blobmsg_add_u32(buf, "value", (uint32_t)value);
 			break;
 		case BLOBMSG_TYPE_INT64:
-			blobmsg_add_u64(&output_buf, "value", tmp);
+			blobmsg_add_u64(buf, "value", tmp);
 //			fprintf(stderr, "add uint64_t: %llu (%llx)\nptr[0]: %x (%u), ptr[1]: %x (%u)\n",
 //					tmp, tmp, *ptr, *ptr, *(ptr + 1), *(ptr + 1));
 			break;
 		case BLOBMSG_TYPE_DOUBLE:
-			blobmsg_add_double(&output_buf, "value", v.d);
+			blobmsg_add_double(buf, "value", v.d);
 //			fprintf(stderr, "add double: %lf\n", v.d);
 			break;
 	}
-	blobmsg_close_table(&output_buf, tbl);
+	blobmsg_close_table(buf, tbl);
+}
+
+static void
+add_metric_object(char *name, uint64_t time, void *value, int type)
+{
+	add_metric_object_host(&output_buf, hostid, name, time, value, type);
 }
 
 static void print_metric_json(void)
 {
+	uint64_t start = trace_now();
+
 	if (!output_buf.head)
 		return;
 
@@ -514,155 +689,1720 @@ static void print_metric_json(void)
 //	fprintf(stderr, "---- output_buf ----\n");
 	printf("%s\n", blobmsg_format_json_indent(tb_metric[METRIC_METRICS], true, formatted ? 0 : -1));
 //	fprintf(stderr, "--------------------\n");
+	trace_end(TRACE_JSON, start);
 }
 
-static int get_metric_stat(bool loaded)
+/*
+ * top-N processes by CPU or RSS
+ * ex.:
+ *   custom.process.cpu.dnsmasq (percentage of all CPUs, like cpu.*)
+ *   custom.process.rss.odhcpd (bytes)
+ */
+static void add_proc_top_metrics(bool by_cpu, uint64_t diff_total)
 {
-	int i = 0, ret;
-	unsigned rem, rem2;
-	char metric[32];
-	struct blob_attr *tb, *tb2;
-	void *ary;
-
-	blobmsg_buf_init(&output_buf);
-
-	/* open "metrics" array */
-	ary = blobmsg_open_array(&output_buf, "metrics");
-	/* start loadavg and Memory */
-	ret = ubus_lookup_call("system", "info", NULL);
-	if (ret)
-		return ret;
-	
-	struct blob_attr *tb_sys_info[ARRAY_SIZE(sinfo_policy)];
-	blobmsg_parse(sinfo_policy, ARRAY_SIZE(sinfo_policy), tb_sys_info,
-			blob_data(result_msg), blob_len(result_msg));
-	
-	ret = blobmsg_check_array(tb_sys_info[SINFO_LOAD], 0);
-	if (ret < 1) {
-		fprintf(stderr, "err: failed to check: %d\n", ret);
-		return -1;
+	struct proc_top_ent ents[proc_top_n];
+	uint64_t start = trace_now();
+	char metric[64];
+	double p;
+	int i, cnt;
+
+	cnt = proc_top_get(ents, proc_top_n, by_cpu);
+	for (i = 0; i < cnt; i++) {
+		if (by_cpu) {
+			p = diff_total ? ents[i].ticks * 100.00 / diff_total : 0;
+			sprintf(metric, "custom.process.cpu.%s", ents[i].name);
+			add_metric_object(metric, time(NULL), &p, BLOBMSG_TYPE_DOUBLE);
+		} else {
+			sprintf(metric, "custom.process.rss.%s", ents[i].name);
+			add_metric_object(metric, time(NULL), &ents[i].rss,
+					BLOBMSG_TYPE_INT64);
+		}
 	}
+	trace_end(TRACE_PROC_TOP, start);
+}
 
-	/* loadavg */
-	double load;
-	int load_time[] = { 1, 5, 15 };
-	blobmsg_for_each_attr(tb, tb_sys_info[SINFO_LOAD], rem) {
-		load = blobmsg_get_u32(tb) / 65535.0;
-
-		sprintf(metric, "loadavg%d", load_time[i]);
-		add_metric_object(metric, time(NULL), &load, BLOBMSG_TYPE_DOUBLE);
-		i++;
+/*
+ * DSA switch ports and bridge members
+ * ex.:
+ *   custom.port.rxBytes.lan1 (delta, like interface.*.delta)
+ *   custom.port.speed.lan1 (Mbps, for the link up)
+ *   custom.port.duplex.lan1 (1: full, 0: half)
+ */
+static void add_port_stat_metrics(struct blob_attr *prev)
+{
+	struct port_stat_ent ents[PORT_STAT_MAX];
+	char metric[64];
+	uint64_t val;
+	int i, j, cnt;
+
+	port_stat_load(prev);
+	cnt = port_stat_get(ents, PORT_STAT_MAX);
+	for (i = 0; i < cnt; i++) {
+		for (j = 0; j < _PORT_CNT_MAX && ents[i].has_delta; j++) {
+			sprintf(metric, "custom.port.%s.%s",
+					port_stat_cnt_name(j), ents[i].name);
+			add_metric_object(metric, time(NULL), &ents[i].cnt[j],
+					BLOBMSG_TYPE_INT64);
+		}
+		val = ents[i].up;
+		sprintf(metric, "custom.port.up.%s", ents[i].name);
+		add_metric_object(metric, time(NULL), &val, BLOBMSG_TYPE_INT64);
+		if (ents[i].speed > 0) {
+			val = ents[i].speed;
+			sprintf(metric, "custom.port.speed.%s", ents[i].name);
+			add_metric_object(metric, time(NULL), &val,
+					BLOBMSG_TYPE_INT64);
+		}
+		if (ents[i].duplex >= 0) {
+			val = ents[i].duplex;
+			sprintf(metric, "custom.port.duplex.%s", ents[i].name);
+			add_metric_object(metric, time(NULL), &val,
+					BLOBMSG_TYPE_INT64);
+		}
 	}
-	/* end loadavg */
-
-	/* memory */
-	unsigned long long total, avail, used;
-	struct blob_attr *tb_mem[ARRAY_SIZE(sinfo_mem_policy)];
-	blobmsg_parse(sinfo_mem_policy, ARRAY_SIZE(sinfo_mem_policy),
-			tb_mem, blobmsg_data(tb_sys_info[SINFO_MEM]),
-			blobmsg_data_len(tb_sys_info[SINFO_MEM]));
-	total = blobmsg_get_u64(tb_mem[SINFO_MEM_TOTAL]);
-	avail = blobmsg_get_u64(tb_mem[SINFO_MEM_AVAILABLE]);
-	used = total - avail;
-
-//	fprintf(stderr, "total: %llu, avail: %llu, used: %llu\n", total, avail, used);
-	add_metric_object("memory.total", time(NULL), &total,
-			BLOBMSG_TYPE_INT64);
-	add_metric_object("memory.mem_available", time(NULL), &avail,
-			BLOBMSG_TYPE_INT64);
-	add_metric_object("memory.used", time(NULL), &used,
-			BLOBMSG_TYPE_INT64);
-	/* end memory */
-	free(result_msg);
+}
 
-	/* check if the json is loaded from the file */
-	if (!loaded) {
-//		fprintf(stderr, "no json loaded\n");
-		blobmsg_close_array(&output_buf, ary);
-		/* close "metric" */
-		return 0;
+/*
+ * link speed of the swconfig switch ports, same as mackerel-plugin-portlink,
+ * the port map is kept in the sysstat json
+ * ex.:
+ *   custom.portlink.switch0.port1 (Mbps, 0: down)
+ */
+static void add_portlink_metrics(void)
+{
+	struct blob_attr *tb_load_sstat[_SSTAT_MAX] = { NULL };
+	struct portlink_ent ents[PORTLINK_MAX];
+	uint64_t start = trace_now();
+	char metric[64];
+	uint64_t val;
+	int i, cnt;
+
+	if (load_buf.head)
+		blobmsg_parse(sstat_policy, _SSTAT_MAX, tb_load_sstat,
+				blob_data(load_buf.head), blob_len(load_buf.head));
+	portlink_load(tb_load_sstat[SSTAT_PORTLINK]);
+	cnt = portlink_get(ents, PORTLINK_MAX);
+	portlink_save(&tmp_buf, sstat_policy[SSTAT_PORTLINK].name);
+	trace_end(TRACE_NETLINK, start);
+	for (i = 0; i < cnt; i++) {
+		val = ents[i].up ? ents[i].speed : 0;
+		sprintf(metric, "custom.portlink.%s.port%d", ents[i].sw,
+				ents[i].port);
+		add_metric_object(metric, time(NULL), &val, BLOBMSG_TYPE_INT64);
 	}
-//	fprintf(stderr, "json loaded\n");
-
-	/* start CPU and Interfaces */
-	struct blob_attr *tb_load_sstat[_SSTAT_MAX];
-	blobmsg_parse(sstat_policy, _SSTAT_MAX, tb_load_sstat,
-			blob_data(load_buf.head), blob_len(load_buf.head));
+}
 
-	struct blob_attr *tb_cur_sstat[_SSTAT_MAX];
-	blobmsg_parse(sstat_policy, _SSTAT_MAX, tb_cur_sstat,
-			blob_data(tmp_buf.head), blob_len(tmp_buf.head));
-	struct blob_attr *tb_cur_cpu[_SSTAT_CPU_MAX];
-	blobmsg_parse_array(sstat_cpu_policy, _SSTAT_CPU_MAX,
-			tb_cur_cpu, blobmsg_data(tb_cur_sstat[SSTAT_CPU]),
-			blobmsg_data_len(tb_cur_sstat[SSTAT_CPU]));
-
-	int type;
-	uint64_t value_l, value_c, diff_total = 0, value_diffs[_SSTAT_CPU_MAX];
-	i = 0;
-	blobmsg_for_each_attr(tb, tb_load_sstat[SSTAT_CPU], rem) {
-		type = blobmsg_type(tb);
-		value_l = type == BLOBMSG_TYPE_INT32 ? 
-				(uint64_t)blobmsg_get_u32(tb) : blobmsg_get_u64(tb);
-		value_c = blobmsg_get_u64(tb_cur_cpu[i]);
+/*
+ * qdiscs and cake tins, labelled by the device and the parent
+ * ex.:
+ *   custom.qdisc.drops.pppoe-wan (delta)
+ *   custom.qdisc.backlog.ifb4pppoe-wan (bytes)
+ *   custom.qdisc.ecnMarks.eth1_1_11 (delta, fq_codel leaf of htb 1:11)
+ *   custom.qdisc_tin.avgDelayUs.pppoe-wan_tin1 (us)
+ */
+static void add_qdisc_stat_metrics(struct blob_attr *prev)
+{
+	struct qdisc_stat_ent ents[QDISC_STAT_MAX];
+	char metric[80];
+	int i, j, cnt;
+
+	qdisc_stat_load(prev);
+	cnt = qdisc_stat_get(ents, QDISC_STAT_MAX);
+	for (i = 0; i < cnt; i++) {
+		for (j = 0; j < _QDISC_VAL_MAX; j++) {
+			if (!(ents[i].valid & (1U << j)) ||
+			    (j < _QDISC_CNT_MAX && !ents[i].has_delta))
+				continue;
+			sprintf(metric, "custom.%s.%s.%s",
+					ents[i].is_tin ? "qdisc_tin" : "qdisc",
+					qdisc_stat_val_name(j), ents[i].label);
+			add_metric_object(metric, time(NULL), &ents[i].val[j],
+					BLOBMSG_TYPE_INT64);
+		}
+	}
+}
 
-		diff_total += value_diffs[i] = value_c - value_l;
-		i++;
+/*
+ * per-CPU deltas of the busiest IRQ lines and of all softirq types, to
+ * find a core taking all NET_RX for RPS/XPS
+ * ex.:
+ *   custom.irq.45_eth0.cpu0
+ *   custom.irq.LOC.cpu1
+ *   custom.softirq.NET_RX.cpu0
+ */
+static void add_irq_stat_metrics(struct blob_attr *prev_irq,
+				 struct blob_attr *prev_softirq)
+{
+	struct irq_stat_ent ents[IRQ_SOFT_MAX];
+	char metric[80];
+	int i, j, cnt;
+
+	irq_stat_load(IRQ_HARD, prev_irq);
+	irq_stat_load(IRQ_SOFT, prev_softirq);
+	cnt = irq_stat_get(IRQ_HARD, ents, IRQ_STAT_TOP);
+	for (i = 0; i < cnt; i++) {
+		for (j = 0; j < ents[i].ncnt; j++) {
+			sprintf(metric, "custom.irq.%s.cpu%d", ents[i].label, j);
+			add_metric_object(metric, time(NULL), &ents[i].cnt[j],
+					BLOBMSG_TYPE_INT64);
+		}
 	}
-//	printf("diff_total: %llu\n", diff_total);
-	double p;
-	for (i = 0; i < _SSTAT_CPU_MAX; i++) {
-		p = value_diffs[i] * 100.00 / diff_total;
-		sprintf(metric, "cpu.%s.percentage", sstat_cpu_policy[i].name);
-		add_metric_object(metric, time(NULL), &p, BLOBMSG_TYPE_DOUBLE);
+	cnt = irq_stat_get(IRQ_SOFT, ents, IRQ_SOFT_MAX);
+	for (i = 0; i < cnt; i++) {
+		for (j = 0; j < ents[i].ncnt; j++) {
+			sprintf(metric, "custom.softirq.%s.cpu%d", ents[i].label, j);
+			add_metric_object(metric, time(NULL), &ents[i].cnt[j],
+					BLOBMSG_TYPE_INT64);
+		}
 	}
+}
 
-	char l3dev_l[DEVNAME_MAX_LEN], l3dev_c[DEVNAME_MAX_LEN];
-	uint64_t xxb_l[_SSTAT_IF_MAX], xxb_c[_SSTAT_IF_MAX], xxb_diff;
-	struct blob_attr *tb_tmp;
-	blobmsg_for_each_attr(tb, tb_load_sstat[SSTAT_IF], rem) {
-		strcpy(l3dev_l, blobmsg_name(tb));
+/*
+ * RTT (ms) and loss (%) of the probes since the previous collection,
+ * only in the resident collector
+ * ex.:
+ *   custom.probe.rttAvg.gw
+ *   custom.probe.rttP95.dns-local
+ *   custom.probe.loss.gw
+ */
+static void add_probe_metrics(void)
+{
+	static const char * const rtt_names[] = {
+		"rttMin", "rttAvg", "rttMax", "rttP95",
+	};
+	struct probe_stat_ent ents[PROBE_MAX];
+	double rtt[ARRAY_SIZE(rtt_names)];
+	char metric[64];
+	int i, j, cnt;
+
+	cnt = probe_get(ents, PROBE_MAX);
+	for (i = 0; i < cnt; i++) {
+		/* no probe finished in this window */
+		if (!ents[i].done)
+			continue;
+		sprintf(metric, "custom.probe.loss.%s", ents[i].name);
+		add_metric_object(metric, time(NULL), &ents[i].loss,
+				BLOBMSG_TYPE_DOUBLE);
+		if (!ents[i].has_rtt)
+			continue;
+		rtt[0] = ents[i].rtt_min;
+		rtt[1] = ents[i].rtt_avg;
+		rtt[2] = ents[i].rtt_max;
+		rtt[3] = ents[i].rtt_p95;
+		for (j = 0; j < ARRAY_SIZE(rtt_names); j++) {
+			sprintf(metric, "custom.probe.%s.%s", rtt_names[j],
+					ents[i].name);
+			add_metric_object(metric, time(NULL), &rtt[j],
+					BLOBMSG_TYPE_DOUBLE);
+		}
+	}
+}
 
-		blobmsg_for_each_attr(tb2, tb_cur_sstat[SSTAT_IF], rem2) {
-			strcpy(l3dev_c, blobmsg_name(tb2));
-			if (strcmp(l3dev_l, l3dev_c))
-				continue;
+/*
+ * matches of the log patterns since the previous collection, only in the
+ * resident collector
+ * ex.:
+ *   custom.logmatch.dhcpack
+ *   custom.logmatch.deauth
+ */
+static void add_logmatch_metrics(void)
+{
+	struct logmatch_ent ents[LOGMATCH_MAX];
+	char metric[64];
+	int i, cnt;
+
+	cnt = logmatch_get(ents, LOGMATCH_MAX);
+	for (i = 0; i < cnt; i++) {
+		sprintf(metric, "custom.logmatch.%s", ents[i].name);
+		add_metric_object(metric, time(NULL), &ents[i].cnt,
+				BLOBMSG_TYPE_INT64);
+	}
+}
 
-			struct blob_attr *tb_cur_if[_SSTAT_IF_MAX];
-			blobmsg_parse(sstat_if_policy, _SSTAT_IF_MAX, tb_cur_if,
-					blobmsg_data(tb2), blobmsg_data_len(tb2));
-			xxb_c[0] = cnv_xxb(blobmsg_get_string(tb_cur_if[SSTAT_IF_TXB]));
-			xxb_c[1] = cnv_xxb(blobmsg_get_string(tb_cur_if[SSTAT_IF_RXB]));
+/*
+ * traffic of the application protocols in the current period of nlbwmon,
+ * same as mackerel-plugin-appproto
+ * ex.:
+ *   custom.appproto.bytes.HTTPS.rxBytes
+ *   custom.appproto.pkts.DNS.txPkts
+ */
+static void add_appproto_metrics(void)
+{
+	struct appproto_ent ents[APPPROTO_MAX];
+	char metric[64];
+	int i, cnt;
+
+	cnt = appproto_read(ents, APPPROTO_MAX);
+	for (i = 0; i < cnt; i++) {
+		if (!ents[i].rx_bytes && !ents[i].rx_pkts &&
+		    !ents[i].tx_bytes && !ents[i].tx_pkts)
+			continue;
+		sprintf(metric, "custom.appproto.bytes.%s.rxBytes", ents[i].name);
+		add_metric_object(metric, time(NULL), &ents[i].rx_bytes,
+				BLOBMSG_TYPE_INT64);
+		sprintf(metric, "custom.appproto.pkts.%s.rxPkts", ents[i].name);
+		add_metric_object(metric, time(NULL), &ents[i].rx_pkts,
+				BLOBMSG_TYPE_INT64);
+		sprintf(metric, "custom.appproto.bytes.%s.txBytes", ents[i].name);
+		add_metric_object(metric, time(NULL), &ents[i].tx_bytes,
+				BLOBMSG_TYPE_INT64);
+		sprintf(metric, "custom.appproto.pkts.%s.txPkts", ents[i].name);
+		add_metric_object(metric, time(NULL), &ents[i].tx_pkts,
+				BLOBMSG_TYPE_INT64);
+	}
+}
 
-			break;
-		}
+/*
+ * hwmon sensors, labelled by the device name
+ * ex.:
+ *   custom.hwmon.temperature.ts_miconv2_hwmon_temp1 (°C)
+ *   custom.hwmon.fan.ts_miconv2_hwmon_fan1 (rpm)
+ *   custom.hwmon.fan_target.landisk_r8c_hwmon_fan1 (rpm)
+ *   custom.hwmon.voltage.<name>_in0 (V)
+ */
+static void add_hwmon_metrics(void)
+{
+	struct hwmon_val vals[HWMON_ATTR_MAX];
+	uint64_t start = trace_now();
+	char metric[32 + HWMON_LABEL_LEN];
+	int i, cnt;
+
+	cnt = hwmon_read(vals, HWMON_ATTR_MAX);
+	trace_end(TRACE_PROCFS, start);
+	for (i = 0; i < cnt; i++) {
+		sprintf(metric, "custom.hwmon.%s.%s",
+				hwmon_type_name(vals[i].type), vals[i].label);
+		add_metric_object(metric, time(NULL), &vals[i].value,
+				BLOBMSG_TYPE_DOUBLE);
+	}
+}
 
-		struct blob_attr *tb_load_if[_SSTAT_IF_MAX];
-		blobmsg_parse(sstat_if_policy, _SSTAT_IF_MAX, tb_load_if,
-				blobmsg_data(tb), blobmsg_data_len(tb));
-		i = 0;
-		blobmsg_for_each_attr(tb_tmp, tb, rem2) {
-			type = blobmsg_type(tb_tmp);
-			xxb_l[i] = cnv_xxb(blobmsg_get_string(tb_tmp));
-			i++;
-		}
-		xxb_diff = xxb_c[0] - xxb_l[0];
-		sprintf(metric, "interface.%s.txBytes.delta", cnv_devname(l3dev_l));
-		add_metric_object(metric, time(NULL), &xxb_diff, BLOBMSG_TYPE_INT64);
-		xxb_diff = xxb_c[1] - xxb_l[1];
-		sprintf(metric, "interface.%s.rxBytes.delta", cnv_devname(l3dev_l));
-		add_metric_object(metric, time(NULL), &xxb_diff, BLOBMSG_TYPE_INT64);
+static double get_metric_value(struct blob_attr *attr)
+{
+	switch (blobmsg_type(attr)) {
+		case BLOBMSG_TYPE_INT32:
+			return blobmsg_get_u32(attr);
+		case BLOBMSG_TYPE_INT64:
+			return blobmsg_get_u64(attr);
+		case BLOBMSG_TYPE_DOUBLE:
+			return blobmsg_get_double(attr);
 	}
-	blobmsg_close_array(&output_buf, ary);
-	/* close "metrics" */
 
 	return 0;
 }
 
-int main(int argc, char **argv)
+/* "metrics" array in output_buf (or remote_buf) */
+static struct blob_attr *get_metric_array(struct blob_buf *buf)
 {
-	int opt, ret = 0;
-	char *cmd;
+	struct blob_attr *tb_metric[_METRIC_MAX];
+
+	blobmsg_parse(metric_policy, _METRIC_MAX, tb_metric,
+			blobmsg_data(buf->head),
+			blobmsg_data_len(buf->head));
+
+	return tb_metric[METRIC_METRICS];
+}
+
+/* store all metrics in output_buf to the history file */
+static void save_metric_history(void)
+{
+	struct blob_attr *tb;
+	unsigned rem;
+	int dropped = 0;
+
+	blobmsg_for_each_attr(tb, get_metric_array(&output_buf), rem) {
+		struct blob_attr *tb_obj[_METRIC_OBJ_MAX];
+		blobmsg_parse(metric_obj_policy, _METRIC_OBJ_MAX, tb_obj,
+				blobmsg_data(tb), blobmsg_data_len(tb));
+		if (!tb_obj[METRIC_OBJ_NAME] || !tb_obj[METRIC_OBJ_TIME] ||
+		    !tb_obj[METRIC_OBJ_VALUE])
+			continue;
+
+		if (history_append(blobmsg_get_string(tb_obj[METRIC_OBJ_NAME]),
+				   blobmsg_get_u64(tb_obj[METRIC_OBJ_TIME]),
+				   get_metric_value(tb_obj[METRIC_OBJ_VALUE])) == -2)
+			dropped++;
+	}
+	if (dropped)
+		fprintf(stderr, "warning: history is full, %d metrics are not stored "
+				"(-H <KiB> to enlarge)\n", dropped);
+}
+
+/* open, save and close the history file */
+static void store_metric_history(void)
+{
+	uint64_t start = trace_now();
+	struct blob_attr *cur;
+	unsigned rem;
+	int cnt = 0;
+
+	/* the series table is sized from the metrics */
+	blobmsg_for_each_attr(cur, get_metric_array(&output_buf), rem)
+		cnt++;
+
+	if (history_kb > 0 &&
+	    !history_open(HISTORY_PATH, history_kb, cnt, true)) {
+		save_metric_history();
+		history_close();
+	}
+	trace_end(TRACE_HISTORY, start);
+}
+
+static void print_history_series(const char *name, uint32_t last, void *priv)
+{
+	printf("%s\t%u\n", name, last);
+}
+
+static void print_history_point(uint32_t time, double value, void *priv)
+{
+	printf("%u\t%.15g\n", time, value);
+}
+
+/*
+ * print "<time>\t<value>" of the metric in the range (default: 1h)
+ * or "<metric>\t<last updated>" of all metrics if no metric is specified
+ * range: <num>[smhd], ex.: 30m, 6h, 1d
+ */
+static int print_metric_history(char *metric, char *range)
+{
+	uint32_t sec = 3600;
+	char *eptr;
+	int ret;
+
+	if (range) {
+		sec = strtoul(range, &eptr, 10);
+		switch (*eptr) {
+			case 'd':
+				sec *= 24;
+				/* fall through */
+			case 'h':
+				sec *= 60;
+				/* fall through */
+			case 'm':
+				sec *= 60;
+				/* fall through */
+			case 's':
+			case '\0':
+				break;
+			default:
+				fprintf(stderr, "err: invalid range \"%s\"\n", range);
+				return -1;
+		}
+	}
+
+	ret = history_open(HISTORY_PATH, 0, 0, false);
+	if (ret)
+		return ret;
+	if (!metric)
+		ret = history_list(print_history_series, NULL);
+	else
+		ret = history_query(metric, time(NULL) - sec,
+				print_history_point, NULL);
+	history_close();
+
+	return ret;
+}
+
+static void probe_end(struct uloop_timeout *t)
+{
+	uloop_end();
+}
+
+/*
+ * run a probe <count> times at 200ms and print "<stat>\t<value>"
+ * for testing the targets (and ma-tools itself against the local ones)
+ */
+static int run_probe(const char *type, const char *target, const char *count)
+{
+	struct uloop_timeout end = { .cb = probe_end };
+	struct probe_stat_ent ent;
+	unsigned int cnt = count ? strtoul(count, NULL, 10) : 10;
+
+	if (!type || !target) {
+		fprintf(stderr, "err: no type or target is specified\n");
+		return -1;
+	}
+	if (probe_type(type) < 0) {
+		fprintf(stderr, "err: invalid probe type \"%s\"\n", type);
+		return -1;
+	}
+	if (cnt == 0)
+		cnt = 10;
+
+	uloop_init();
+	if (probe_add(target, probe_type(type), target, 200, 0)) {
+		uloop_done();
+		return -1;
+	}
+	probe_start();
+	/* after the last deadline, before the next send */
+	uloop_timeout_set(&end, cnt * 200 + 100);
+	uloop_run();
+	probe_get(&ent, 1);
+	probe_free_all();
+	uloop_done();
+
+	printf("sent\t%u\nlost\t%u\nloss\t%.1f\n", ent.done, ent.lost,
+			ent.loss);
+	if (ent.has_rtt)
+		printf("min\t%.3f\navg\t%.3f\nmax\t%.3f\np95\t%.3f\n",
+				ent.rtt_min, ent.rtt_avg, ent.rtt_max, ent.rtt_p95);
+
+	return ent.done > ent.lost ? 0 : -1;
+}
+
+/*
+ * health of ma-tools itself, the stages are of the last complete
+ * collection in the resident collector
+ * (custom metrics, "agent.*" is not accepted by Mackerel)
+ */
+static void add_agent_metrics(void)
+{
+	const struct trace_stage *st;
+	struct output_stats os;
+	char metric[64];
+	uint64_t val;
+	double ms;
+	int i;
+
+	for (i = 0; i < _TRACE_MAX; i++) {
+		st = trace_get(i);
+		if (!st->cnt)
+			continue;
+		ms = st->us / 1000.0;
+		sprintf(metric, "custom.agent.collect_ms.%s", trace_name(i));
+		add_metric_object(metric, time(NULL), &ms, BLOBMSG_TYPE_DOUBLE);
+	}
+
+	if (!procfs_read_self_rss(&val))
+		add_metric_object("custom.agent.rss", time(NULL), &val,
+				BLOBMSG_TYPE_INT64);
+
+	/* level of this collection and the backed off ones since the last */
+	val = backoff_level;
+	add_metric_object("custom.agent.backoff.level", time(NULL), &val,
+			BLOBMSG_TYPE_INT64);
+	val = backoff_cycles;
+	add_metric_object("custom.agent.backoff.cycles", time(NULL), &val,
+			BLOBMSG_TYPE_INT64);
+	backoff_cycles = 0;
+
+	if (config.output_cnt == 0)
+		return;
+	output_get_stats(&os);
+	val = os.post_ms;
+	add_metric_object("custom.agent.post_ms", time(NULL), &val,
+			BLOBMSG_TYPE_INT64);
+	add_metric_object("custom.agent.bytes_sent", time(NULL), &os.bytes_sent,
+			BLOBMSG_TYPE_INT64);
+	val = os.failures;
+	add_metric_object("custom.agent.failures", time(NULL), &val,
+			BLOBMSG_TYPE_INT64);
+	val = os.pending;
+	add_metric_object("custom.agent.spool_depth", time(NULL), &val,
+			BLOBMSG_TYPE_INT64);
+}
+
+/* deltas of the "cpu" objects, returns the total */
+static uint64_t get_cpu_diffs(struct blob_attr *prev, struct blob_attr *cur,
+			      uint64_t *diffs)
+{
+	struct blob_attr *tb_cur_cpu[_SSTAT_CPU_MAX], *tb;
+	uint64_t value_l, value_c, diff_total = 0;
+	unsigned rem;
+	int i = 0;
+
+	memset(diffs, 0, sizeof(*diffs) * _SSTAT_CPU_MAX);
+	if (!prev || !cur)
+		return 0;
+	blobmsg_parse_array(sstat_cpu_policy, _SSTAT_CPU_MAX, tb_cur_cpu,
+			blobmsg_data(cur), blobmsg_data_len(cur));
+	blobmsg_for_each_attr(tb, prev, rem) {
+		if (i >= _SSTAT_CPU_MAX || !tb_cur_cpu[i])
+			break;
+		value_l = blobmsg_type(tb) == BLOBMSG_TYPE_INT32 ?
+				(uint64_t)blobmsg_get_u32(tb) : blobmsg_get_u64(tb);
+		value_c = blobmsg_get_u64(tb_cur_cpu[i]);
+
+		diff_total += diffs[i] = value_c - value_l;
+		i++;
+	}
+
+	return diff_total;
+}
+
+static int get_metric_stat(bool loaded)
+{
+	int i = 0, ret;
+	unsigned rem, rem2;
+	char metric[64];
+	struct blob_attr *tb, *tb2;
+	void *ary;
+
+	cpu_pct_valid = false;
+	if_stat_cnt = 0;
+	blobmsg_buf_init(&output_buf);
+
+	/* open "metrics" array */
+	ary = blobmsg_open_array(&output_buf, "metrics");
+	/* start loadavg and Memory */
+	struct procfs_loadavg la;
+	uint64_t start = trace_now();
+	ret = procfs_read_loadavg(&la);
+	trace_end(TRACE_PROCFS, start);
+	if (ret)
+		return ret;
+	load1 = la.load[0];
+
+	/* loadavg */
+	int load_time[] = { 1, 5, 15 };
+	for (i = 0; i < ARRAY_SIZE(load_time); i++) {
+		sprintf(metric, "loadavg%d", load_time[i]);
+		add_metric_object(metric, time(NULL), &la.load[i], BLOBMSG_TYPE_DOUBLE);
+	}
+	/* end loadavg */
+
+	/* memory */
+	struct procfs_meminfo mi;
+	uint64_t used;
+	start = trace_now();
+	ret = procfs_read_meminfo(&mi);
+	trace_end(TRACE_PROCFS, start);
+	if (ret)
+		return ret;
+	used = mi.total - mi.available;
+
+	add_metric_object("memory.total", time(NULL), &mi.total,
+			BLOBMSG_TYPE_INT64);
+	add_metric_object("memory.mem_available", time(NULL), &mi.available,
+			BLOBMSG_TYPE_INT64);
+	add_metric_object("memory.used", time(NULL), &used,
+			BLOBMSG_TYPE_INT64);
+	add_metric_object("memory.free", time(NULL), &mi.free,
+			BLOBMSG_TYPE_INT64);
+	add_metric_object("memory.buffers", time(NULL), &mi.buffers,
+			BLOBMSG_TYPE_INT64);
+	add_metric_object("memory.cached", time(NULL), &mi.cached,
+			BLOBMSG_TYPE_INT64);
+	add_metric_object("custom.memory.shmem", time(NULL), &mi.shmem,
+			BLOBMSG_TYPE_INT64);
+	/* swap is reported only if it exists (ex.: zram-swap) */
+	if (mi.swap_total > 0) {
+		add_metric_object("memory.swap_total", time(NULL), &mi.swap_total,
+				BLOBMSG_TYPE_INT64);
+		add_metric_object("memory.swap_free", time(NULL), &mi.swap_free,
+				BLOBMSG_TYPE_INT64);
+		add_metric_object("memory.swap_cached", time(NULL), &mi.swap_cached,
+				BLOBMSG_TYPE_INT64);
+	}
+	/* end memory */
+
+	if (proc_top_active())
+		add_proc_top_metrics(false, 0);
+
+	add_hwmon_metrics();
+	add_probe_metrics();
+	add_logmatch_metrics();
+	if (config.appproto)
+		add_appproto_metrics();
+	if (config.portlink)
+		add_portlink_metrics();
+
+	/* check if the json is loaded from the file */
+	if (!loaded) {
+//		fprintf(stderr, "no json loaded\n");
+		add_agent_metrics();
+		blobmsg_close_array(&output_buf, ary);
+		/* close "metric" */
+		return 0;
+	}
+//	fprintf(stderr, "json loaded\n");
+
+	/* start CPU and Interfaces */
+	struct blob_attr *tb_load_sstat[_SSTAT_MAX];
+	blobmsg_parse(sstat_policy, _SSTAT_MAX, tb_load_sstat,
+			blob_data(load_buf.head), blob_len(load_buf.head));
+
+	struct blob_attr *tb_cur_sstat[_SSTAT_MAX];
+	blobmsg_parse(sstat_policy, _SSTAT_MAX, tb_cur_sstat,
+			blob_data(tmp_buf.head), blob_len(tmp_buf.head));
+
+	uint64_t diff_total, value_diffs[_SSTAT_CPU_MAX];
+	diff_total = get_cpu_diffs(tb_load_sstat[SSTAT_CPU],
+			tb_cur_sstat[SSTAT_CPU], value_diffs);
+//	printf("diff_total: %llu\n", diff_total);
+	double p;
+	for (i = 0; i < _SSTAT_CPU_MAX; i++) {
+		p = value_diffs[i] * 100.00 / diff_total;
+		sprintf(metric, "cpu.%s.percentage", sstat_cpu_policy[i].name);
+		add_metric_object(metric, time(NULL), &p, BLOBMSG_TYPE_DOUBLE);
+		cpu_pct[i] = p;
+	}
+	cpu_pct_valid = true;
+
+	if (proc_top_active()) {
+		start = trace_now();
+		proc_top_load(tb_load_sstat[SSTAT_PROC]);
+		trace_end(TRACE_PROC_TOP, start);
+		add_proc_top_metrics(true, diff_total);
+	}
+
+	add_port_stat_metrics(tb_load_sstat[SSTAT_PORT]);
+	add_irq_stat_metrics(tb_load_sstat[SSTAT_IRQ],
+			tb_load_sstat[SSTAT_SOFTIRQ]);
+	add_qdisc_stat_metrics(tb_load_sstat[SSTAT_QDISC]);
+
+	char l3dev_l[DEVNAME_MAX_LEN], l3dev_c[DEVNAME_MAX_LEN];
+	uint64_t xxb_l[_SSTAT_IF_MAX], xxb_c[_SSTAT_IF_MAX], xxb_diff;
+	struct blob_attr *tb_tmp;
+	blobmsg_for_each_attr(tb, tb_load_sstat[SSTAT_IF], rem) {
+		strcpy(l3dev_l, blobmsg_name(tb));
+
+		blobmsg_for_each_attr(tb2, tb_cur_sstat[SSTAT_IF], rem2) {
+			strcpy(l3dev_c, blobmsg_name(tb2));
+			if (strcmp(l3dev_l, l3dev_c))
+				continue;
+
+			struct blob_attr *tb_cur_if[_SSTAT_IF_MAX];
+			blobmsg_parse(sstat_if_policy, _SSTAT_IF_MAX, tb_cur_if,
+					blobmsg_data(tb2), blobmsg_data_len(tb2));
+			xxb_c[0] = cnv_xxb(blobmsg_get_string(tb_cur_if[SSTAT_IF_TXB]));
+			xxb_c[1] = cnv_xxb(blobmsg_get_string(tb_cur_if[SSTAT_IF_RXB]));
+
+			break;
+		}
+
+		struct blob_attr *tb_load_if[_SSTAT_IF_MAX];
+		blobmsg_parse(sstat_if_policy, _SSTAT_IF_MAX, tb_load_if,
+				blobmsg_data(tb), blobmsg_data_len(tb));
+		i = 0;
+		blobmsg_for_each_attr(tb_tmp, tb, rem2) {
+			xxb_l[i] = cnv_xxb(blobmsg_get_string(tb_tmp));
+			i++;
+		}
+		if (if_stat_cnt < NETDEV_MAX) {
+			struct if_stat *st = &if_stats[if_stat_cnt++];
+
+			strcpy(st->name, l3dev_l);
+			st->txb = xxb_c[0];
+			st->rxb = xxb_c[1];
+			st->txb_diff = xxb_c[0] - xxb_l[0];
+			st->rxb_diff = xxb_c[1] - xxb_l[1];
+		}
+		xxb_diff = xxb_c[0] - xxb_l[0];
+		sprintf(metric, "interface.%s.txBytes.delta", cnv_devname(l3dev_l));
+		add_metric_object(metric, time(NULL), &xxb_diff, BLOBMSG_TYPE_INT64);
+		xxb_diff = xxb_c[1] - xxb_l[1];
+		sprintf(metric, "interface.%s.rxBytes.delta", cnv_devname(l3dev_l));
+		add_metric_object(metric, time(NULL), &xxb_diff, BLOBMSG_TYPE_INT64);
+	}
+	add_agent_metrics();
+	blobmsg_close_array(&output_buf, ary);
+	/* close "metrics" */
+
+	return 0;
+}
+
+static void apply_config(void)
+{
+	if (!opt_hostid && strlen(config.hostid) == 11)
+		strcpy(hostid, config.hostid);
+	if (!opt_model)
+		use_model = config.use_model;
+	if (!opt_timeout && config.timeout > 0)
+		timeout = config.timeout;
+	output_set_timeout(timeout);
+}
+
+/* (re-)create outputs from the "output" sections */
+static void setup_outputs(void)
+{
+	struct ma_output_conf *out;
+	char spec[MA_OUTPUT_TYPE_LEN + OUTPUT_TARGET_LEN];
+	const char *target;
+	int i;
+
+	/* unchanged outputs are kept with their pending batches */
+	output_retire_all();
+	for (i = 0; i < config.output_cnt; i++) {
+		out = &config.outputs[i];
+		target = out->target;
+		if (!strcmp(out->type, "mackerel") && !target[0])
+			target = config.apibase;
+		snprintf(spec, sizeof(spec), "%s%s%s", out->type,
+				target[0] ? ":" : "", target);
+		if (output_add(spec, !strcmp(out->type, "mackerel") ?
+				config.apikey : out->token, out->batch))
+			fprintf(stderr, "err: invalid output \"%s\"\n", spec);
+	}
+	output_free_retired();
+}
+
+static void setup_remotes(void)
+{
+	struct ma_remote_conf *rem;
+	int i;
+
+	remote_free_all();
+	for (i = 0; i < config.remote_cnt; i++) {
+		rem = &config.remotes[i];
+		remote_add(rem->url, rem->user, rem->pass, rem->hostid,
+				rem->timeout);
+	}
+}
+
+/* (re-)start the check monitoring of the "check" sections */
+static void setup_checks(void)
+{
+	struct ma_check_conf *chk;
+	int i;
+
+	check_free_all();
+	if (!config.check_cnt)
+		return;
+
+	/* hostid may be updated later by "ma.hostid" */
+	check_set_api(config.apibase, config.apikey, hostid);
+	for (i = 0; i < config.check_cnt; i++) {
+		chk = &config.checks[i];
+		check_add(chk->name, chk->cmd, chk->timeout, chk->interval,
+				chk->max_attempts);
+	}
+	check_start();
+}
+
+/* (re-)start the probes of the "probe" sections */
+static void setup_probes(void)
+{
+	struct ma_probe_conf *prb;
+	int i;
+
+	probe_free_all();
+	for (i = 0; i < config.probe_cnt; i++) {
+		prb = &config.probes[i];
+		probe_add(prb->name, probe_type(prb->type), prb->target,
+				prb->interval, prb->timeout);
+	}
+	probe_start();
+}
+
+/* (re-)subscribe the log for the "logmatch" sections */
+static void setup_logmatch(void)
+{
+	int i;
+
+	logmatch_free_all();
+	for (i = 0; i < config.logmatch_cnt; i++)
+		logmatch_add(config.logmatches[i].name,
+				config.logmatches[i].pattern);
+	logmatch_start(ctx);
+}
+
+/*
+ * numbers through JSON are stored as int32 if small enough,
+ * so int64 in the policies are accepted as any type
+ */
+static void json_policy(const struct blobmsg_policy *src,
+		struct blobmsg_policy *dst, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		dst[i] = src[i];
+		if (dst[i].type == BLOBMSG_TYPE_INT64)
+			dst[i].type = BLOBMSG_TYPE_UNSPEC;
+	}
+}
+
+static uint64_t json_get_u64(struct blob_attr *attr)
+{
+	switch (blobmsg_type(attr)) {
+		case BLOBMSG_TYPE_INT32:
+			return blobmsg_get_u32(attr);
+		case BLOBMSG_TYPE_INT64:
+			return blobmsg_get_u64(attr);
+		default:
+			return 0;
+	}
+}
+
+/* loadavg and memory from "system info" */
+static void add_remote_sinfo(struct remote *r, struct blob_attr *info)
+{
+	struct blob_attr *tb[ARRAY_SIZE(sinfo_policy)];
+	struct blob_attr *tb_mem[ARRAY_SIZE(sinfo_mem_policy)];
+	struct blob_attr *tb_swap[ARRAY_SIZE(sinfo_swap_policy)];
+	struct blobmsg_policy mem_policy[ARRAY_SIZE(sinfo_mem_policy)];
+	struct blobmsg_policy swap_policy[ARRAY_SIZE(sinfo_swap_policy)];
+	struct blob_attr *cur;
+	int load_time[] = { 1, 5, 15 };
+	uint64_t val[ARRAY_SIZE(sinfo_mem_policy)] = { 0 }, used;
+	char metric[64];
+	unsigned rem;
+	double load;
+	int i = 0;
+
+	json_policy(sinfo_mem_policy, mem_policy, ARRAY_SIZE(mem_policy));
+	json_policy(sinfo_swap_policy, swap_policy, ARRAY_SIZE(swap_policy));
+	blobmsg_parse(sinfo_policy, ARRAY_SIZE(sinfo_policy), tb,
+			blobmsg_data(info), blobmsg_data_len(info));
+
+	/* load average is fixed point (<< 16) */
+	if (tb[SINFO_LOAD]) {
+		blobmsg_for_each_attr(cur, tb[SINFO_LOAD], rem) {
+			if (i >= ARRAY_SIZE(load_time))
+				break;
+			load = json_get_u64(cur) / 65536.0;
+			sprintf(metric, "loadavg%d", load_time[i++]);
+			add_metric_object_host(&remote_buf, r->hostid, metric,
+					time(NULL), &load, BLOBMSG_TYPE_DOUBLE);
+		}
+	}
+
+	if (tb[SINFO_MEM]) {
+		blobmsg_parse(mem_policy, ARRAY_SIZE(mem_policy), tb_mem, blobmsg_data(tb[SINFO_MEM]),
+				blobmsg_data_len(tb[SINFO_MEM]));
+		for (i = 0; i < ARRAY_SIZE(sinfo_mem_policy); i++) {
+			if (tb_mem[i])
+				val[i] = json_get_u64(tb_mem[i]);
+		}
+		/* "available" is not provided by older procd */
+		if (tb_mem[SINFO_MEM_AVAILABLE])
+			used = val[SINFO_MEM_TOTAL] - val[SINFO_MEM_AVAILABLE];
+		else
+			used = val[SINFO_MEM_TOTAL] - val[SINFO_MEM_FREE] -
+				val[SINFO_MEM_BUFFERED] - val[SINFO_MEM_CACHED];
+
+		add_metric_object_host(&remote_buf, r->hostid, "memory.total",
+				time(NULL), &val[SINFO_MEM_TOTAL], BLOBMSG_TYPE_INT64);
+		if (tb_mem[SINFO_MEM_AVAILABLE])
+			add_metric_object_host(&remote_buf, r->hostid,
+					"memory.mem_available", time(NULL),
+					&val[SINFO_MEM_AVAILABLE], BLOBMSG_TYPE_INT64);
+		add_metric_object_host(&remote_buf, r->hostid, "memory.used",
+				time(NULL), &used, BLOBMSG_TYPE_INT64);
+		add_metric_object_host(&remote_buf, r->hostid, "memory.free",
+				time(NULL), &val[SINFO_MEM_FREE], BLOBMSG_TYPE_INT64);
+		add_metric_object_host(&remote_buf, r->hostid, "memory.buffers",
+				time(NULL), &val[SINFO_MEM_BUFFERED], BLOBMSG_TYPE_INT64);
+		add_metric_object_host(&remote_buf, r->hostid, "memory.cached",
+				time(NULL), &val[SINFO_MEM_CACHED], BLOBMSG_TYPE_INT64);
+		add_metric_object_host(&remote_buf, r->hostid, "custom.memory.shmem",
+				time(NULL), &val[SINFO_MEM_SHARED], BLOBMSG_TYPE_INT64);
+	}
+
+	if (tb[SINFO_SWAP]) {
+		blobmsg_parse(swap_policy, ARRAY_SIZE(swap_policy), tb_swap, blobmsg_data(tb[SINFO_SWAP]),
+				blobmsg_data_len(tb[SINFO_SWAP]));
+		if (tb_swap[SINFO_SWAP_TOTAL] && tb_swap[SINFO_SWAP_FREE] &&
+		    json_get_u64(tb_swap[SINFO_SWAP_TOTAL]) > 0) {
+			val[0] = json_get_u64(tb_swap[SINFO_SWAP_TOTAL]);
+			val[1] = json_get_u64(tb_swap[SINFO_SWAP_FREE]);
+			add_metric_object_host(&remote_buf, r->hostid,
+					"memory.swap_total", time(NULL), &val[0],
+					BLOBMSG_TYPE_INT64);
+			add_metric_object_host(&remote_buf, r->hostid,
+					"memory.swap_free", time(NULL), &val[1],
+					BLOBMSG_TYPE_INT64);
+		}
+	}
+}
+
+/* l3 device deltas from "network.interface dump" and "network.device status" */
+static void add_remote_ifs(struct remote *r, struct blob_attr *ifdump,
+			   struct blob_attr *devs)
+{
+	struct blob_attr *tb_ifdump[ARRAY_SIZE(if_dump_policy)];
+	struct blob_attr *tb_if[ARRAY_SIZE(if_policy)];
+	struct blob_attr *tb_dev[ARRAY_SIZE(l3dev_policy)];
+	struct blob_attr *tb_stat[ARRAY_SIZE(l3dev_stat_policy)];
+	struct blobmsg_policy stat_policy[ARRAY_SIZE(l3dev_stat_policy)];
+	struct blob_attr *tb, *dev;
+	struct remote_if cur[REMOTE_IF_MAX];
+	char metric[64], devname[DEVNAME_MAX_LEN];
+	uint64_t diff;
+	unsigned rem, rem2;
+	int i, j, cnt = 0;
+
+	blobmsg_parse(if_dump_policy, ARRAY_SIZE(if_dump_policy), tb_ifdump,
+			blobmsg_data(ifdump), blobmsg_data_len(ifdump));
+	if (!tb_ifdump[IFACE_DUMP])
+		return;
+
+	json_policy(l3dev_stat_policy, stat_policy, ARRAY_SIZE(stat_policy));
+	blobmsg_for_each_attr(tb, tb_ifdump[IFACE_DUMP], rem) {
+		blobmsg_parse(if_policy, ARRAY_SIZE(if_policy), tb_if,
+				blobmsg_data(tb), blobmsg_data_len(tb));
+		if (!tb_if[IFACE_INTERFACE] || !tb_if[IFACE_L3DEV] ||
+		    !strcmp(blobmsg_get_string(tb_if[IFACE_INTERFACE]), "loopback"))
+			continue;
+		if (strlen(blobmsg_get_string(tb_if[IFACE_L3DEV])) >= sizeof(cur[0].name))
+			continue;
+
+		for (i = 0; i < cnt; i++) {
+			if (!strcmp(cur[i].name, blobmsg_get_string(tb_if[IFACE_L3DEV])))
+				break;
+		}
+		if (i < cnt || cnt >= REMOTE_IF_MAX)
+			continue;
+
+		/* "network.device status" without name -> all devices */
+		blobmsg_for_each_attr(dev, devs, rem2) {
+			if (strcmp(blobmsg_name(dev), blobmsg_get_string(tb_if[IFACE_L3DEV])))
+				continue;
+			blobmsg_parse(l3dev_policy, ARRAY_SIZE(l3dev_policy), tb_dev,
+					blobmsg_data(dev), blobmsg_data_len(dev));
+			if (!tb_dev[L3DEV_STAT])
+				break;
+			blobmsg_parse(stat_policy, ARRAY_SIZE(stat_policy), tb_stat, blobmsg_data(tb_dev[L3DEV_STAT]),
+					blobmsg_data_len(tb_dev[L3DEV_STAT]));
+			if (!tb_stat[L3DEV_STAT_TXB] || !tb_stat[L3DEV_STAT_RXB])
+				break;
+
+			strcpy(cur[cnt].name, blobmsg_name(dev));
+			cur[cnt].txb = json_get_u64(tb_stat[L3DEV_STAT_TXB]);
+			cur[cnt].rxb = json_get_u64(tb_stat[L3DEV_STAT_RXB]);
+			cnt++;
+			break;
+		}
+	}
+
+	for (i = 0; r->if_valid && i < cnt; i++) {
+		for (j = 0; j < r->if_cnt; j++) {
+			if (!strcmp(r->ifs[j].name, cur[i].name))
+				break;
+		}
+		/* new device or reset counters (ex.: reboot) */
+		if (j == r->if_cnt || cur[i].txb < r->ifs[j].txb ||
+		    cur[i].rxb < r->ifs[j].rxb)
+			continue;
+
+		strcpy(devname, cur[i].name);
+		cnv_devname(devname);
+		diff = cur[i].txb - r->ifs[j].txb;
+		sprintf(metric, "interface.%s.txBytes.delta", devname);
+		add_metric_object_host(&remote_buf, r->hostid, metric, time(NULL),
+				&diff, BLOBMSG_TYPE_INT64);
+		diff = cur[i].rxb - r->ifs[j].rxb;
+		sprintf(metric, "interface.%s.rxBytes.delta", devname);
+		add_metric_object_host(&remote_buf, r->hostid, metric, time(NULL),
+				&diff, BLOBMSG_TYPE_INT64);
+	}
+
+	memcpy(r->ifs, cur, sizeof(*cur) * cnt);
+	r->if_cnt = cnt;
+	r->if_valid = true;
+}
+
+static void remote_result(struct remote *r, struct blob_attr *info,
+			  struct blob_attr *ifdump, struct blob_attr *devs)
+{
+	add_remote_sinfo(r, info);
+	if (ifdump && devs)
+		add_remote_ifs(r, ifdump, devs);
+}
+
+/* all remote devices are finished, post them with the local metrics */
+static void remote_done(void)
+{
+	blobmsg_close_array(&remote_buf, remote_ary);
+	output_add_metrics(get_metric_array(&remote_buf));
+	output_send();
+}
+
+/* returns the number of polled devices */
+static int start_remote_poll(void)
+{
+	int ret;
+
+	if (remote_empty())
+		return 0;
+
+	/* no callback is called in remote_poll() */
+	ret = remote_poll(remote_result, remote_done);
+	if (ret < 0) {
+		fprintf(stderr, "warning: previous poll of remote devices is still running\n");
+		return ret;
+	}
+	if (ret > 0) {
+		blobmsg_buf_init(&remote_buf);
+		remote_ary = blobmsg_open_array(&remote_buf, "metrics");
+	}
+
+	return ret;
+}
+
+/*
+ * bytes held by the buffers of the collection, reused every time and
+ * grown only if short, so constant in the steady state
+ */
+static size_t collect_buf_size(void)
+{
+	return output_buf.buflen + tmp_buf.buflen + load_buf.buflen +
+		send_buf.buflen + result.size + ifdump_result.size;
+}
+
+/* interval of the resident collector, lengthened while backed off */
+static uint32_t collect_interval(void)
+{
+	uint32_t ival = interval << backoff_level;
+
+	if (backoff_level && ival > BACKOFF_INTERVAL_MAX)
+		ival = interval > BACKOFF_INTERVAL_MAX ?
+				interval : BACKOFF_INTERVAL_MAX;
+
+	return ival;
+}
+
+/*
+ * load-adaptive backoff
+ *
+ * Over the 1 min. loadavg (per CPU) or the cost of the collection itself,
+ * the level is raised by one per collection, and lowered by one again
+ * under 3/4 of both. While backed off, the proc_top scan and the polls of
+ * the remote devices are skipped, the interval is doubled per level and
+ * the outputs hold their batches, so that the monitoring does not compete
+ * with the forwarding on a saturated router.
+ */
+static void update_backoff(uint64_t cycle_us)
+{
+	double load_max = config.backoff_load > 0 ?
+			config.backoff_load : BACKOFF_LOAD_DEF;
+	unsigned int cycle_max = config.backoff_cycle_ms > 0 ?
+			config.backoff_cycle_ms : BACKOFF_CYCLE_MS_DEF;
+	unsigned int cycle_ms = cycle_us / 1000;
+	int level = backoff_level;
+
+	if (cpu_cnt <= 0)
+		cpu_cnt = procfs_count_cpus();
+	if (cpu_cnt > 0)
+		load_max *= cpu_cnt;
+
+	if (config.backoff_disabled)
+		level = 0;
+	else if (load1 > load_max || cycle_ms > cycle_max)
+		level += level < BACKOFF_LEVEL_MAX ? 1 : 0;
+	else if (load1 < load_max * 3 / 4 && cycle_ms < cycle_max * 3 / 4)
+		level -= level > 0 ? 1 : 0;
+
+	if (level != backoff_level) {
+		fprintf(stderr,
+			"warning: backoff level %d -> %d (load: %.2f, collection: %u ms)\n",
+			backoff_level, level, load1, cycle_ms);
+		backoff_level = level;
+	}
+	if (backoff_level)
+		backoff_cycles++;
+	output_defer(backoff_level > 0);
+}
+
+/*
+ * resident collector
+ *
+ * collects the metrics every interval (only by the timer, so that the
+ * deltas always cover the whole interval) and keeps the latest snapshot,
+ * the snapshot is provided read-only to the other components by ubus "ma"
+ * object:
+ *   metrics:    same as metricj ("hostid" is optional)
+ *   interfaces: counters, deltas and rates of l3 devices
+ *   cpu:        CPU usage breakdown (percentage)
+ */
+static int collect_metrics(void)
+{
+	static size_t buf_size;
+	uint64_t start = trace_now();
+	struct blob_buf tmp;
+	size_t size;
+	int ret;
+
+	trace_cycle();
+
+	ret = get_sys_stat();
+	if (ret) {
+		fprintf(stderr, "err: failed to get system status (%s)\n",
+				ubus_strerror(ret));
+		return ret;
+	}
+	ret = get_metric_stat(load_buf.head ? true : false);
+	if (ret) {
+		fprintf(stderr, "err: failed to get metric data (%s)\n",
+				ubus_strerror(ret));
+		return ret;
+	}
+	store_metric_history();
+
+	/* posted together with the remote devices if any */
+	output_add_metrics(get_metric_array(&output_buf));
+	if (backoff_level || start_remote_poll() <= 0)
+		output_send();
+
+	trace_end(TRACE_TOTAL, start);
+	trace_print("collect");
+	size = collect_buf_size();
+	if (trace_enabled)
+		fprintf(stderr, "trace: collect: buffers %zu bytes (+%zu)\n",
+				size, size - buf_size);
+	buf_size = size;
+	update_backoff(trace_now() - start);
+
+	/* keep the current status in memory for the next collection */
+	tmp = load_buf;
+	load_buf = tmp_buf;
+	tmp_buf = tmp;
+
+	prev_collect = last_collect;
+	last_collect = time(NULL);
+	strcpy(collect_hostid, hostid);
+
+	return 0;
+}
+
+/*
+ * the latest snapshot is served unless the collections failed for two
+ * intervals, or it was collected with another Host ID
+ */
+static bool snapshot_valid(void)
+{
+	return output_buf.head && last_collect &&
+		time(NULL) - last_collect <= collect_interval() * 2 &&
+		!strcmp(collect_hostid, hostid);
+}
+
+static int
+ma_metrics(struct ubus_context *ctx, struct ubus_object *obj,
+		struct ubus_request_data *req, const char *method,
+		struct blob_attr *msg)
+{
+	struct blob_attr *tb[_MA_METRICS_MAX];
+	char *id;
+
+	blobmsg_parse(ma_metrics_policy, _MA_METRICS_MAX, tb,
+			blob_data(msg), blob_len(msg));
+	if (tb[MA_METRICS_HOSTID]) {
+		id = blobmsg_get_string(tb[MA_METRICS_HOSTID]);
+		if (strlen(id) != 11)
+			return UBUS_STATUS_INVALID_ARGUMENT;
+		/* collected with the new Host ID from the next interval */
+		if (strcmp(hostid, id))
+			strcpy(hostid, id);
+	}
+
+	if (!snapshot_valid())
+		return UBUS_STATUS_NO_DATA;
+
+	ubus_send_reply(ctx, req, output_buf.head);
+
+	return 0;
+}
+
+static int
+ma_interfaces(struct ubus_context *ctx, struct ubus_object *obj,
+		struct ubus_request_data *req, const char *method,
+		struct blob_attr *msg)
+{
+	time_t dt;
+	void *tbl;
+	int i;
+
+	if (!snapshot_valid())
+		return UBUS_STATUS_NO_DATA;
+	dt = last_collect - prev_collect;
+
+	blobmsg_buf_init(&reply_buf);
+	for (i = 0; i < if_stat_cnt; i++) {
+		tbl = blobmsg_open_table(&reply_buf, if_stats[i].name);
+		blobmsg_add_u64(&reply_buf, "tx_bytes", if_stats[i].txb);
+		blobmsg_add_u64(&reply_buf, "rx_bytes", if_stats[i].rxb);
+		blobmsg_add_u64(&reply_buf, "tx_bytes_delta", if_stats[i].txb_diff);
+		blobmsg_add_u64(&reply_buf, "rx_bytes_delta", if_stats[i].rxb_diff);
+		/* bytes/s */
+		if (prev_collect && dt > 0) {
+			blobmsg_add_double(&reply_buf, "tx_rate",
+					(double)if_stats[i].txb_diff / dt);
+			blobmsg_add_double(&reply_buf, "rx_rate",
+					(double)if_stats[i].rxb_diff / dt);
+		}
+		blobmsg_close_table(&reply_buf, tbl);
+	}
+	ubus_send_reply(ctx, req, reply_buf.head);
+
+	return 0;
+}
+
+static int
+ma_cpu(struct ubus_context *ctx, struct ubus_object *obj,
+		struct ubus_request_data *req, const char *method,
+		struct blob_attr *msg)
+{
+	int i;
+
+	if (!snapshot_valid() || !cpu_pct_valid)
+		return UBUS_STATUS_NO_DATA;
+
+	blobmsg_buf_init(&reply_buf);
+	for (i = 0; i < _SSTAT_CPU_MAX; i++)
+		blobmsg_add_double(&reply_buf, sstat_cpu_policy[i].name, cpu_pct[i]);
+	ubus_send_reply(ctx, req, reply_buf.head);
+
+	return 0;
+}
+
+/*
+ * called by the init script on "config.change" of ma-sh, and by
+ * "ma-tools set" with the option changed in the global section
+ */
+static int
+ma_reload(struct ubus_context *ctx, struct ubus_object *obj,
+		struct ubus_request_data *req, const char *method,
+		struct blob_attr *msg)
+{
+	struct blob_attr *tb[_MA_RELOAD_MAX];
+	const char *opt;
+
+	blobmsg_parse(ma_reload_policy, _MA_RELOAD_MAX, tb,
+			blob_data(msg), blob_len(msg));
+	if (ma_config_load(&config))
+		return UBUS_STATUS_UNKNOWN_ERROR;
+
+	apply_config();
+	if (tb[MA_RELOAD_OPTION]) {
+		/* the other global options are read from config when used */
+		opt = blobmsg_get_string(tb[MA_RELOAD_OPTION]);
+		if (!strcmp(opt, "apibase") || !strcmp(opt, "apikey")) {
+			setup_outputs();
+			setup_checks();
+		}
+		return 0;
+	}
+
+	setup_outputs();
+	setup_remotes();
+	setup_checks();
+	setup_probes();
+	setup_logmatch();
+	/* the new settings are collected from the next interval */
+
+	return 0;
+}
+
+static const struct ubus_method ma_methods[] = {
+	UBUS_METHOD("metrics", ma_metrics, ma_metrics_policy),
+	UBUS_METHOD_NOARG("interfaces", ma_interfaces),
+	UBUS_METHOD_NOARG("cpu", ma_cpu),
+	UBUS_METHOD("reload", ma_reload, ma_reload_policy),
+};
+
+static struct ubus_object_type ma_object_type =
+	UBUS_OBJECT_TYPE("ma", ma_methods);
+
+static struct ubus_object ma_object = {
+	.name = "ma",
+	.type = &ma_object_type,
+	.methods = ma_methods,
+	.n_methods = ARRAY_SIZE(ma_methods),
+};
+
+static void collect_timer_cb(struct uloop_timeout *t)
+{
+	uint32_t ival;
+
+	collect_metrics();
+	/* align to the interval, like ma-sh */
+	ival = collect_interval();
+	uloop_timeout_set(t, (ival - time(NULL) % ival) * 1000);
+}
+
+static struct uloop_timeout collect_timer = {
+	.cb = collect_timer_cb,
+};
+
+static void ubus_reconnect_cb(struct uloop_timeout *t)
+{
+	if (ubus_reconnect(ctx, NULL)) {
+		uloop_timeout_set(t, 2000);
+		return;
+	}
+	ubus_add_uloop(ctx);
+	/* all objects are registered again */
+	ubus_ids_clear();
+}
+
+static struct uloop_timeout reconnect_timer = {
+	.cb = ubus_reconnect_cb,
+};
+
+static void ubus_connection_lost(struct ubus_context *ctx)
+{
+	uloop_timeout_set(&reconnect_timer, 2000);
+}
+
+static int run_collector(void)
+{
+	int ret;
+
+	uloop_init();
+	ubus_add_uloop(ctx);
+	ctx->connection_lost = ubus_connection_lost;
+
+	ret = ubus_add_object(ctx, &ma_object);
+	if (ret) {
+		fprintf(stderr, "err: failed to add ubus object (%s)\n",
+				ubus_strerror(ret));
+		uloop_done();
+		return ret;
+	}
+	/* the cached object ids are kept only while watched */
+	ret = ubus_register_event_handler(ctx, &obj_event, "ubus.object.*");
+	if (ret)
+		fprintf(stderr, "warning: failed to watch ubus objects (%s)\n",
+				ubus_strerror(ret));
+
+	/* first collection for the base of deltas */
+	collect_metrics();
+	uloop_timeout_set(&collect_timer,
+			(interval - time(NULL) % interval) * 1000);
+	uloop_run();
+
+	ubus_remove_object(ctx, &ma_object);
+	uloop_done();
+
+	return 0;
+}
+
+/*
+ * get the latest snapshot from the resident collector if running,
+ * id: the Host ID to be collected with, NULL: as is
+ */
+static int get_collector_metric(const char *id)
+{
+	int ret;
+
+	blob_buf_init(&send_buf, 0);
+	if (id)
+		blobmsg_add_string(&send_buf, "hostid", id);
+	ret = ubus_lookup_call("ma", "metrics", send_buf.head, &result);
+	if (ret)
+		return ret;
+	if (!result.msg)
+		return UBUS_STATUS_NO_DATA;
+
+	blobmsg_buf_init(&output_buf);
+	blob_put_raw(&output_buf, blob_data(result.msg), blob_len(result.msg));
+
+	return 0;
+}
+
+/*
+ * mackerel-agent plugin protocol
+ *
+ * "ma-tools plugin" prints the custom metrics as "<name>\t<value>\t<epoch>"
+ * without the "custom." prefix (added by mackerel-agent), and the graph
+ * definitions after "# mackerel-agent-plugin" if MACKEREL_AGENT_PLUGIN_META
+ * is set. "ma-tools plugin <group>" is limited to one group (ex.: appproto)
+ * for the drop-in replacements of the script plugins.
+ */
+#define PLUGIN_PREFIX		"custom."
+
+static const char *plugin_group;
+
+/* "appproto" matches "appproto" and "appproto.*" */
+static bool plugin_group_match(const char *name)
+{
+	size_t len;
+
+	if (!plugin_group)
+		return true;
+	len = strlen(plugin_group);
+
+	return !strncmp(name, plugin_group, len) &&
+		(name[len] == '.' || name[len] == '\0');
+}
+
+/* the collector of the prefix is needed for the group (ex.: "port.up") */
+static bool plugin_group_wants(const char *prefix)
+{
+	size_t len = strlen(prefix);
+
+	return plugin_group_match(prefix) ||
+		(!strncmp(plugin_group, prefix, len) && plugin_group[len] == '.');
+}
+
+/*
+ * the custom metrics of the group only, without ubus: the collectors of
+ * the other groups are not run, and the sysstat json (of the group) has
+ * only the objects of this group
+ */
+static int get_plugin_stat(void)
+{
+	struct blob_attr *prev[_SSTAT_MAX] = { NULL };
+	struct procfs_meminfo mi;
+	uint64_t diffs[_SSTAT_CPU_MAX], diff_total;
+	struct blob_attr *cur[_SSTAT_MAX];
+	bool loaded;
+	void *ary;
+	int ret;
+
+	loaded = !load_sysstat_json();
+	if (loaded)
+		blobmsg_parse(sstat_policy, _SSTAT_MAX, prev,
+				blob_data(load_buf.head), blob_len(load_buf.head));
+	blobmsg_buf_init(&tmp_buf);
+	blobmsg_buf_init(&output_buf);
+	ary = blobmsg_open_array(&output_buf, "metrics");
+
+	if (plugin_group_wants("process") && proc_top_active()) {
+		ret = save_cpu_stat();
+		if (ret)
+			return ret;
+		save_proc_stat();
+		add_proc_top_metrics(false, 0);
+		if (loaded && prev[SSTAT_CPU]) {
+			blobmsg_parse(sstat_policy, _SSTAT_MAX, cur,
+					blob_data(tmp_buf.head), blob_len(tmp_buf.head));
+			diff_total = get_cpu_diffs(prev[SSTAT_CPU], cur[SSTAT_CPU],
+					diffs);
+			proc_top_load(prev[SSTAT_PROC]);
+			add_proc_top_metrics(true, diff_total);
+		}
+	}
+	if (plugin_group_wants("port")) {
+		save_port_stat();
+		if (loaded)
+			add_port_stat_metrics(prev[SSTAT_PORT]);
+	}
+	if (plugin_group_wants("qdisc") || plugin_group_wants("qdisc_tin")) {
+		save_qdisc_stat();
+		if (loaded)
+			add_qdisc_stat_metrics(prev[SSTAT_QDISC]);
+	}
+	if (plugin_group_wants("irq") || plugin_group_wants("softirq")) {
+		save_irq_stat();
+		if (loaded)
+			add_irq_stat_metrics(prev[SSTAT_IRQ], prev[SSTAT_SOFTIRQ]);
+	}
+	if (plugin_group_wants("memory") && !procfs_read_meminfo(&mi))
+		add_metric_object("custom.memory.shmem", time(NULL), &mi.shmem,
+				BLOBMSG_TYPE_INT64);
+	if (plugin_group_wants("hwmon"))
+		add_hwmon_metrics();
+	if (plugin_group_wants("appproto"))
+		add_appproto_metrics();
+	if (plugin_group_wants("portlink"))
+		add_portlink_metrics();
+	/* probe, logmatch and agent: only in the resident collector */
+
+	blobmsg_close_array(&output_buf, ary);
+
+	return 0;
+}
+
+static void print_plugin_metrics(void)
+{
+	struct blob_attr *tb_obj[_METRIC_OBJ_MAX];
+	struct blob_attr *tb, *val;
+	const char *name;
+	unsigned long long t;
+	unsigned rem;
+
+	blobmsg_for_each_attr(tb, get_metric_array(&output_buf), rem) {
+		blobmsg_parse(metric_obj_policy, _METRIC_OBJ_MAX, tb_obj,
+				blobmsg_data(tb), blobmsg_data_len(tb));
+		if (!tb_obj[METRIC_OBJ_NAME] || !tb_obj[METRIC_OBJ_TIME] ||
+		    !tb_obj[METRIC_OBJ_VALUE])
+			continue;
+		name = blobmsg_get_string(tb_obj[METRIC_OBJ_NAME]);
+		if (strncmp(name, PLUGIN_PREFIX, strlen(PLUGIN_PREFIX)))
+			continue;
+		name += strlen(PLUGIN_PREFIX);
+		if (!plugin_group_match(name))
+			continue;
+		t = blobmsg_get_u64(tb_obj[METRIC_OBJ_TIME]);
+		val = tb_obj[METRIC_OBJ_VALUE];
+
+		switch (blobmsg_type(val)) {
+			case BLOBMSG_TYPE_INT32:
+				printf("%s\t%u\t%llu\n", name, blobmsg_get_u32(val), t);
+				break;
+			case BLOBMSG_TYPE_INT64:
+				printf("%s\t%llu\t%llu\n", name,
+					(unsigned long long)blobmsg_get_u64(val), t);
+				break;
+			case BLOBMSG_TYPE_DOUBLE:
+				printf("%s\t%f\t%llu\n", name, blobmsg_get_double(val), t);
+				break;
+		}
+	}
+}
+
+/*
+ * one graph, all metrics under the key by "*", labelled by mlabel or the
+ * last wildcard if NULL
+ */
+static void add_plugin_graph_ext(const char *key, const char *label,
+				 const char *unit, const char *mlabel,
+				 bool stacked)
+{
+	void *tbl, *ary, *mtbl;
+	char buf[8];
+	const char *p;
+	int n = 1;
+
+	if (!plugin_group_match(key))
+		return;
+
+	/* "%<n>" is the value of the n-th wildcard */
+	if (!mlabel) {
+		for (p = key; *p; p++) {
+			if (*p == '#')
+				n++;
+		}
+		sprintf(buf, "%%%d", n);
+		mlabel = buf;
+	}
+
+	tbl = blobmsg_open_table(&send_buf, key);
+	blobmsg_add_string(&send_buf, "label", label);
+	blobmsg_add_string(&send_buf, "unit", unit);
+	ary = blobmsg_open_array(&send_buf, "metrics");
+	mtbl = blobmsg_open_table(&send_buf, NULL);
+	blobmsg_add_string(&send_buf, "name", "*");
+	blobmsg_add_string(&send_buf, "label", mlabel);
+	if (stacked)
+		blobmsg_add_u8(&send_buf, "stacked", true);
+	blobmsg_close_table(&send_buf, mtbl);
+	blobmsg_close_array(&send_buf, ary);
+	blobmsg_close_table(&send_buf, tbl);
+}
+
+static void add_plugin_graph(const char *key, const char *label,
+			     const char *unit)
+{
+	add_plugin_graph_ext(key, label, unit, NULL, false);
+}
+
+/* the graphs of all collectors built in, whether enabled or not */
+static void print_plugin_meta(void)
+{
+	static const char * const hwmon_units[] = {
+		[HWMON_TEMP] = "float",
+		[HWMON_FAN] = "integer",
+		[HWMON_FAN_TARGET] = "integer",
+		[HWMON_IN] = "float",
+	};
+	char key[64], label[64];
+	const char *name, *unit;
+	void *tbl;
+	int i;
+
+	blob_buf_init(&send_buf, 0);
+	tbl = blobmsg_open_table(&send_buf, "graphs");
+
+	add_plugin_graph("process.cpu", "Process CPU", "percentage");
+	add_plugin_graph("process.rss", "Process RSS", "bytes");
+
+	for (i = 0; i < _PORT_CNT_MAX; i++) {
+		name = port_stat_cnt_name(i);
+		if (!*name)
+			continue;
+		sprintf(key, "port.%s", name);
+		sprintf(label, "Port %s", name);
+		add_plugin_graph(key, label,
+				strstr(name, "Bytes") ? "bytes" : "integer");
+	}
+	add_plugin_graph("port.up", "Port up", "integer");
+	add_plugin_graph("port.speed", "Port speed (Mbps)", "integer");
+	add_plugin_graph("port.duplex", "Port duplex", "integer");
+
+	for (i = 0; i < _QDISC_VAL_MAX; i++) {
+		name = qdisc_stat_val_name(i);
+		if (!*name)
+			continue;
+		if (i == QDISC_BYTES || i == QDISC_BACKLOG)
+			unit = "bytes";
+		else
+			unit = "integer";
+		/* delays are reported by cake tins only */
+		if (i < QDISC_PEAK_DELAY) {
+			sprintf(key, "qdisc.%s", name);
+			sprintf(label, "Qdisc %s", name);
+			add_plugin_graph(key, label, unit);
+		}
+		sprintf(key, "qdisc_tin.%s", name);
+		sprintf(label, "Cake tin %s", name);
+		add_plugin_graph(key, label, unit);
+	}
+
+	/* one graph per IRQ line or softirq type, CPUs as the metrics */
+	add_plugin_graph("irq.#", "IRQ %1", "integer");
+	add_plugin_graph("softirq.#", "Softirq %1", "integer");
+
+	add_plugin_graph("probe.rttMin", "Probe RTT min", "milliseconds");
+	add_plugin_graph("probe.rttAvg", "Probe RTT avg", "milliseconds");
+	add_plugin_graph("probe.rttMax", "Probe RTT max", "milliseconds");
+	add_plugin_graph("probe.rttP95", "Probe RTT p95", "milliseconds");
+	add_plugin_graph("probe.loss", "Probe loss", "percentage");
+
+	add_plugin_graph("logmatch", "Log matches", "integer");
+
+	/* same as mackerel-plugin-portlink, one graph per switch, the ports as the metrics */
+	add_plugin_graph("portlink.#", "LinkSpeed on %1 (Mbps)", "integer");
+
+	/* same as mackerel-plugin-appproto, one graph per protocol */
+	add_plugin_graph_ext("appproto.bytes.#", "Application Protocols (Bytes)",
+			"bytes", "%1", true);
+	add_plugin_graph_ext("appproto.pkts.#", "Application Protocols (Packets)",
+			"integer", "%1", true);
+
+	for (i = 0; i < _HWMON_TYPE_MAX; i++) {
+		name = hwmon_type_name(i);
+		if (!*name)
+			continue;
+		sprintf(key, "hwmon.%s", name);
+		sprintf(label, "Hardware %s", name);
+		add_plugin_graph(key, label, hwmon_units[i]);
+	}
+
+	add_plugin_graph("memory", "Memory (shared)", "bytes");
+
+	add_plugin_graph("agent.collect_ms", "ma-tools collection", "milliseconds");
+	add_plugin_graph("agent.backoff", "ma-tools backoff", "integer");
+	add_plugin_graph("agent", "ma-tools", "integer");
+
+	blobmsg_close_table(&send_buf, tbl);
+
+	printf("# mackerel-agent-plugin\n%s\n",
+			blobmsg_format_json_indent(send_buf.head, true,
+						formatted ? 0 : -1));
+}
+
+/* store the current status for the deltas of the next run */
+static int save_sysstat_json(void)
+{
+	uint64_t start = trace_now();
+	FILE *fp;
+	char *json;
+	int ret = 0;
+
+	if ((fp = fopen(jsonpath, "w")) == NULL) {
+		fprintf(stderr, "err: failed to open the temporary json file for writing\n");
+		return -3;
+	}
+	json = blobmsg_format_json_indent(tmp_buf.head, true, formatted ? 0 : -1);
+	if (!fwrite(json, strlen(json), 1, fp)) {
+		fprintf(stderr, "err: failed to write to temporary json file\n");
+		ret = -3;
+	}
+	free(json);
+	fclose(fp);
+	trace_end(TRACE_JSON, start);
+
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	int opt, ret = 0;
+	char *cmd;
 
 	/* defaults */
 #ifdef AGENT_NAME
@@ -672,26 +2412,48 @@ int main(int argc, char **argv)
 	strcpy(agent_ver, AGENT_VER);
 #endif
 	char jsonpath_def[] = "/tmp/ma-sysstat.json";
+	char plugin_jsonpath_def[64];
 	jsonpath = jsonpath_def;
 	uint32_t timeout_buf;
 
-	while ((opt = getopt(argc, argv, "Fh:j:mt:")) != -1) {
+	/* not an error, the defaults are used without the config */
+	ma_config_load(&config);
+
+	while ((opt = getopt(argc, argv, "FH:h:i:j:mp:Tt:")) != -1) {
 		switch(opt) {
 			case 'F':
 				formatted = true;
 				break;
+			case 'H':
+				history_kb = strtoul(optarg, NULL, 10);
+				break;
 			case 'h':
 				if (!optarg || strlen(optarg) != 11) {
 					fprintf(stderr, "err: invalid Host ID\n");
 					return -1;
 				}
 				strcpy(hostid, optarg);
+				opt_hostid = true;
+				break;
+			case 'i':
+				interval = strtoul(optarg, NULL, 10);
+				if (interval < 10) {
+					fprintf(stderr,
+						"warning: too short interval (must be >= 10), use 10s\n");
+					interval = 10;
+				}
 				break;
 			case 'j':
 				jsonpath = optarg;
 				break;
 			case 'm':
 				use_model = true;
+				opt_model = true;
+				break;
+			case 'p':
+				proc_top_n = strtoul(optarg, NULL, 10);
+				if (proc_top_n > PROC_SCAN_MAX)
+					proc_top_n = PROC_SCAN_MAX;
 				break;
 			case 't':
 				timeout_buf = strtoul(optarg, NULL, 10);
@@ -701,6 +2463,10 @@ int main(int argc, char **argv)
 					break;
 				}
 				timeout = timeout_buf;
+				opt_timeout = true;
+				break;
+			case 'T':
+				trace_enabled = true;
 				break;
 			default:
 				fprintf(stderr, "err: unknown paramerter\n");
@@ -710,6 +2476,7 @@ int main(int argc, char **argv)
 
 	argc -= optind;
 	argv += optind;
+	apply_config();
 
 	cmd = argv[0];
 	if (argc < 1)
@@ -721,6 +2488,34 @@ int main(int argc, char **argv)
 //	fprintf(stderr, "formatted: %s\n", formatted ? "true" : "false");
 //	fprintf(stderr, "use_model: %s\n", use_model ? "true" : "false");
 
+	/* no ubus is required */
+	if (!strcmp(cmd, "history"))
+		return print_metric_history(argc > 1 ? argv[1] : NULL,
+					argc > 2 ? argv[2] : NULL);
+	if (!strcmp(cmd, "probe"))
+		return run_probe(argc > 1 ? argv[1] : NULL,
+				argc > 2 ? argv[2] : NULL,
+				argc > 3 ? argv[3] : NULL);
+	if (!strcmp(cmd, "config")) {
+		ma_config_print_sh(&config);
+		return 0;
+	}
+	if (!strcmp(cmd, "set")) {
+		if (argc < 3) {
+			fprintf(stderr, "err: no option or value is specified\n");
+			return -1;
+		}
+		ret = ma_config_set(argv[1], argv[2]);
+		/* notify the resident collector if running and changed */
+		if (!ret && (ctx = ubus_connect(NULL)) != NULL) {
+			blob_buf_init(&send_buf, 0);
+			blobmsg_add_string(&send_buf, "option", argv[1]);
+			ubus_lookup_call("ma", "reload", send_buf.head, &result);
+			free(ctx);
+		}
+		return ret < 0 ? ret : 0;
+	}
+
 	ctx = ubus_connect(NULL);
 	if(!ctx) {
 		fprintf (stderr, "err: failed to connect to ubus\n");
@@ -735,11 +2530,19 @@ int main(int argc, char **argv)
 		}
 	} else if (!strcmp(cmd, "metricj"))
 	{
+		uint64_t start = trace_now();
+
 		if (strlen(hostid) != 11) {
 			fprintf(stderr, "err: no Host ID is specified\n");
 			free(ctx);
 			return -1;
 		}
+		/* collected by the resident collector */
+		if (!get_collector_metric(hostid)) {
+			print_metric_json();
+			free(ctx);
+			return 0;
+		}
 		ret = get_sys_stat();
 		if (ret) {
 			fprintf(stderr, "err: failed to get system status (%s)\n",
@@ -756,23 +2559,67 @@ int main(int argc, char **argv)
 			return ret;
 		}
 		print_metric_json();
-		FILE *fp;
-		if ((fp = fopen(jsonpath, "w")) == NULL) {
-			fprintf(stderr, "err: failed to open the temporary json file for writing\n");
+		store_metric_history();
+		ret = save_sysstat_json();
+		trace_end(TRACE_TOTAL, start);
+		trace_print("metricj");
+	} else if (!strcmp(cmd, "plugin"))
+	{
+		plugin_group = argc > 1 ? argv[1] : NULL;
+		if (getenv("MACKEREL_AGENT_PLUGIN_META")) {
+			print_plugin_meta();
 			free(ctx);
-			return -3;
+			return 0;
 		}
-		char *json = blobmsg_format_json_indent(tmp_buf.head, true, formatted ? 0 : -1);
-		if (!fwrite(json, strlen(json), 1, fp)) {
-			fprintf(stderr, "err: failed to write to temporary json file\n");
-			ret = -3;
+		/* collected by the resident collector, no Host ID is needed */
+		if (!get_collector_metric(NULL)) {
+			print_plugin_metrics();
+			free(ctx);
+			return 0;
 		}
-		fclose(fp);
+		/* not to take the deltas of ma-sh or of the other groups */
+		if (jsonpath == jsonpath_def) {
+			snprintf(plugin_jsonpath_def, sizeof(plugin_jsonpath_def),
+				"/tmp/ma-plugin%s%s-sysstat.json",
+				plugin_group ? "-" : "",
+				plugin_group ? plugin_group : "");
+			jsonpath = plugin_jsonpath_def;
+		}
+		ret = get_plugin_stat();
+		if (ret) {
+			fprintf(stderr, "err: failed to get metric data (%s)\n",
+					ubus_strerror(ret));
+			free(ctx);
+			return ret;
+		}
+		print_plugin_metrics();
+		ret = save_sysstat_json();
+	} else if (!strcmp(cmd, "daemon"))
+	{
+		setup_outputs();
+		setup_remotes();
+		setup_checks();
+		setup_probes();
+		setup_logmatch();
+		ret = run_collector();
 	} else if (!strcmp(cmd, "debug"))
 	{
 		/* debug code */
 	}
 	
+	/* no more send by the remote poll */
+	output_free_all();
+	remote_free_all();
+	check_free_all();
+	probe_free_all();
+	logmatch_free_all();
+	proc_top_close();
+	port_stat_close();
+	portlink_close();
+	hwmon_close();
+	irq_stat_close();
+	qdisc_stat_close();
+	procfs_close();
 	free(ctx);
 
 	return ret;
@@ -58,11 +58,30 @@ static const struct blobmsg_policy sinfo_policy[] = {
 enum {
 	SINFO_MEM_TOTAL,
 	SINFO_MEM_AVAILABLE,
+	SINFO_MEM_FREE,
+	SINFO_MEM_SHARED,
+	SINFO_MEM_BUFFERED,
+	SINFO_MEM_CACHED,
 };
 
 static const struct blobmsg_policy sinfo_mem_policy[] = {
 	[SINFO_MEM_TOTAL] = { .name = "total", .type = BLOBMSG_TYPE_INT64 },
 	[SINFO_MEM_AVAILABLE] = { .name = "available", .type = BLOBMSG_TYPE_INT64 },
+	[SINFO_MEM_FREE] = { .name = "free", .type = BLOBMSG_TYPE_INT64 },
+	[SINFO_MEM_SHARED] = { .name = "shared", .type = BLOBMSG_TYPE_INT64 },
+	[SINFO_MEM_BUFFERED] = { .name = "buffered", .type = BLOBMSG_TYPE_INT64 },
+	[SINFO_MEM_CACHED] = { .name = "cached", .type = BLOBMSG_TYPE_INT64 },
+};
+
+/* system info -> swap */
+enum {
+	SINFO_SWAP_TOTAL,
+	SINFO_SWAP_FREE,
+};
+
+static const struct blobmsg_policy sinfo_swap_policy[] = {
+	[SINFO_SWAP_TOTAL] = { .name = "total", .type = BLOBMSG_TYPE_INT64 },
+	[SINFO_SWAP_FREE] = { .name = "free", .type = BLOBMSG_TYPE_INT64 },
 };
 
 /* network.interface dump */
@@ -134,12 +153,24 @@ static const struct blobmsg_policy l3dev_stat_policy[] = {
 enum {
 	SSTAT_CPU,
 	SSTAT_IF,
+	SSTAT_PROC,
+	SSTAT_PORT,
+	SSTAT_IRQ,
+	SSTAT_SOFTIRQ,
+	SSTAT_QDISC,
+	SSTAT_PORTLINK,
 	_SSTAT_MAX,
 };
 
 static const struct blobmsg_policy sstat_policy[] = {
 	[SSTAT_CPU] = { .name = "cpu", .type = BLOBMSG_TYPE_TABLE },
 	[SSTAT_IF] = { .name = "if", .type = BLOBMSG_TYPE_TABLE },
+	[SSTAT_PROC] = { .name = "proc", .type = BLOBMSG_TYPE_TABLE },
+	[SSTAT_PORT] = { .name = "port", .type = BLOBMSG_TYPE_TABLE },
+	[SSTAT_IRQ] = { .name = "irq", .type = BLOBMSG_TYPE_TABLE },
+	[SSTAT_SOFTIRQ] = { .name = "softirq", .type = BLOBMSG_TYPE_TABLE },
+	[SSTAT_QDISC] = { .name = "qdisc", .type = BLOBMSG_TYPE_TABLE },
+	[SSTAT_PORTLINK] = { .name = "portlink", .type = BLOBMSG_TYPE_TABLE },
 };
 
 enum {
@@ -197,11 +228,62 @@ static const struct blobmsg_policy metric_policy[] = {
 	[METRIC_METRICS] = { .name = "metrics", .type = BLOBMSG_TYPE_ARRAY },
 };
 
+/* metrics -> 0, 1, 2, ... ("value" is int32, int64 or double) */
+enum {
+	METRIC_OBJ_NAME,
+	METRIC_OBJ_TIME,
+	METRIC_OBJ_VALUE,
+	_METRIC_OBJ_MAX,
+};
+
+static const struct blobmsg_policy metric_obj_policy[] = {
+	[METRIC_OBJ_NAME] = { .name = "name", .type = BLOBMSG_TYPE_STRING },
+	[METRIC_OBJ_TIME] = { .name = "time", .type = BLOBMSG_TYPE_INT64 },
+	[METRIC_OBJ_VALUE] = { .name = "value", .type = BLOBMSG_TYPE_UNSPEC },
+};
+
+/* ubus "ma" object -> metrics */
+enum {
+	MA_METRICS_HOSTID,
+	_MA_METRICS_MAX,
+};
+
+static const struct blobmsg_policy ma_metrics_policy[] = {
+	[MA_METRICS_HOSTID] = { .name = "hostid", .type = BLOBMSG_TYPE_STRING },
+};
+
+/* ubus "ma" object -> reload */
+enum {
+	MA_RELOAD_OPTION,
+	_MA_RELOAD_MAX,
+};
+
+static const struct blobmsg_policy ma_reload_policy[] = {
+	[MA_RELOAD_OPTION] = { .name = "option", .type = BLOBMSG_TYPE_STRING },
+};
+
+/* latest counters of l3 device (for ubus "ma" object -> interfaces) */
+struct if_stat {
+	char name[DEVNAME_MAX_LEN];
+	uint64_t txb;
+	uint64_t rxb;
+	uint64_t txb_diff;
+	uint64_t rxb_diff;
+};
+
+/* ubus result, kept until the next call with the same one */
+struct ubus_result {
+	struct blob_attr *msg;		/* NULL: no data */
+	void *buf;
+	size_t size;				/* only grown, reused every collection */
+};
+
 static void
 ubus_receive_result_cb(struct ubus_request *req, int type, struct blob_attr *msg);
 
 static int
-ubus_lookup_call(char *path_str, const char *method, struct blob_attr *attr);
+ubus_lookup_call(const char *path_str, const char *method,
+		 struct blob_attr *attr, struct ubus_result *res);
 
 static int get_l3dev_status(char *devname);
 
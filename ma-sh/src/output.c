@@ -0,0 +1,752 @@
+/*
+ * output sinks for the resident collector
+ *
+ * The metrics of one collection are formatted for all sinks, and each sink
+ * sends them when its batch is full. Failed data are kept in the sink and
+ * sent with the next batch after the backoff, HTTP requests of the sinks
+ * are run concurrently in uloop. The formatted records are always
+ * terminated by '\n' in the buffer, so the oldest ones can be dropped.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <dlfcn.h>
+#include <math.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include <libubox/uclient.h>
+
+#include "output.h"
+#include "trace.h"
+
+enum {
+	OUTPUT_OBJ_HOSTID,
+	OUTPUT_OBJ_NAME,
+	OUTPUT_OBJ_TIME,
+	OUTPUT_OBJ_VALUE,
+	_OUTPUT_OBJ_MAX,
+};
+
+static const struct blobmsg_policy output_obj_policy[] = {
+	[OUTPUT_OBJ_HOSTID] = { .name = "hostId", .type = BLOBMSG_TYPE_STRING },
+	[OUTPUT_OBJ_NAME] = { .name = "name", .type = BLOBMSG_TYPE_STRING },
+	[OUTPUT_OBJ_TIME] = { .name = "time", .type = BLOBMSG_TYPE_INT64 },
+	[OUTPUT_OBJ_VALUE] = { .name = "value", .type = BLOBMSG_TYPE_UNSPEC },
+};
+
+static LIST_HEAD(outputs);
+static LIST_HEAD(retired);		/* the previous ones while reloading */
+static struct output_stats stats;
+static unsigned int output_timeout = 10;
+static bool output_deferred = false;
+static const struct ustream_ssl_ops *ssl_ops;
+static struct ustream_ssl_ctx *ssl_ctx;
+
+/* based on uclient-fetch */
+static int init_ustream_ssl(void)
+{
+	void *dlh;
+	glob_t gl;
+	int i;
+
+	if (ssl_ctx)
+		return 0;
+
+	dlh = dlopen("libustream-ssl.so", RTLD_LAZY | RTLD_LOCAL);
+	if (!dlh) {
+		fprintf(stderr, "err: failed to load libustream-ssl.so\n");
+		return -1;
+	}
+	ssl_ops = dlsym(dlh, "ustream_ssl_ops");
+	if (!ssl_ops || !(ssl_ctx = ssl_ops->context_new(false))) {
+		fprintf(stderr, "err: failed to initialize ustream-ssl\n");
+		return -1;
+	}
+	if (!glob("/etc/ssl/certs/*.crt", 0, NULL, &gl)) {
+		for (i = 0; i < gl.gl_pathc; i++)
+			ssl_ops->context_add_ca_crt_file(ssl_ctx, gl.gl_pathv[i]);
+		globfree(&gl);
+	}
+
+	return 0;
+}
+
+static int output_append(struct output *o, const char *str, size_t len)
+{
+	size_t size;
+	char *buf, *p;
+
+	if (o->len + len > OUTPUT_PENDING_MAX) {
+		/* drop the oldest records unless they are in flight */
+		if (o->busy || len > OUTPUT_PENDING_MAX)
+			goto drop;
+		p = memchr(o->buf + o->len + len - OUTPUT_PENDING_MAX, '\n',
+				OUTPUT_PENDING_MAX - len);
+		if (!p) {
+			o->len = 0;
+		} else {
+			o->len -= p + 1 - o->buf;
+			memmove(o->buf, p + 1, o->len);
+		}
+		o->dropped++;
+	}
+
+	if (o->len + len > o->size) {
+		size = o->size ? o->size : 4096;
+		while (size < o->len + len)
+			size *= 2;
+		if (!(buf = realloc(o->buf, size)))
+			goto drop;
+		o->buf = buf;
+		o->size = size;
+	}
+	memcpy(o->buf + o->len, str, len);
+	o->len += len;
+
+	return 0;
+
+drop:
+	o->dropped++;
+	return -1;
+}
+
+static int output_printf(struct output *o, const char *fmt, ...)
+{
+	char str[512];
+	va_list ap;
+	int len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(str, sizeof(str), fmt, ap);
+	va_end(ap);
+	if (len < 0 || len >= sizeof(str))
+		return -1;
+
+	return output_append(o, str, len);
+}
+
+/* value as JSON/line protocol number, returns false for NaN/Inf */
+static bool format_value(struct blob_attr *attr, char *str, size_t len,
+			 bool influx)
+{
+	double d;
+
+	switch (blobmsg_type(attr)) {
+		case BLOBMSG_TYPE_INT32:
+			snprintf(str, len, influx ? "%ui" : "%u",
+					blobmsg_get_u32(attr));
+			return true;
+		case BLOBMSG_TYPE_INT64:
+			snprintf(str, len, influx ? "%llui" : "%llu",
+					(unsigned long long)blobmsg_get_u64(attr));
+			return true;
+		case BLOBMSG_TYPE_DOUBLE:
+			d = blobmsg_get_double(attr);
+			if (!isfinite(d))
+				return false;
+			snprintf(str, len, "%.15g", d);
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * escape str into dst with a backslash before the chars in esc, control
+ * chars are written as \u00XX for JSON (json) or dropped, returns dst
+ */
+static const char *escape_str(const char *str, const char *esc, bool json,
+			      char *dst, size_t len)
+{
+	char *p = dst, *end = dst + len - 7;
+
+	for (; *str && p < end; str++) {
+		if ((unsigned char)*str < 0x20) {
+			if (json)
+				p += sprintf(p, "\\u%04x", *str);
+			continue;
+		}
+		if (strchr(esc, *str))
+			*p++ = '\\';
+		*p++ = *str;
+	}
+	*p = '\0';
+
+	return dst;
+}
+
+static int format_json(struct output *o, const char *hostid, const char *name,
+		       uint64_t time, struct blob_attr *value, const char *sep)
+{
+	char val[32], hostid_esc[64], name_esc[256];
+
+	/* JSON has no NaN, post null like blobmsg_format_json does */
+	if (!format_value(value, val, sizeof(val), false))
+		strcpy(val, "null");
+
+	return output_printf(o,
+			"{\"hostId\":\"%s\",\"name\":\"%s\",\"time\":%llu,\"value\":%s}%s",
+			escape_str(hostid, "\"\\", true, hostid_esc, sizeof(hostid_esc)),
+			escape_str(name, "\"\\", true, name_esc, sizeof(name_esc)),
+			(unsigned long long)time, val, sep);
+}
+
+/* Mackerel: records are terminated by ",\n" and sent as an array */
+static int mackerel_init(struct output *o)
+{
+	const char *base = o->target[0] ? o->target : MACKEREL_APIBASE_DEF;
+
+	/* a host name is posted over https, a URL is used as it is */
+	snprintf(o->url, sizeof(o->url), "%s%s/api/v0/tsdb",
+			strstr(base, "://") ? "" : "https://", base);
+	if (!o->key[0]) {
+		fprintf(stderr, "err: no API key for Mackerel output\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int mackerel_format(struct output *o, const char *hostid,
+			   const char *name, uint64_t time,
+			   struct blob_attr *value)
+{
+	/* not registered yet, the API rejects the whole batch */
+	if (strlen(hostid) != 11)
+		return 0;
+
+	return format_json(o, hostid, name, time, value, ",\n");
+}
+
+#ifdef WITH_OUTPUT_INFLUX
+/* line protocol, timestamps are in ns (default precision) */
+static int influx_format(struct output *o, const char *hostid,
+			 const char *name, uint64_t time,
+			 struct blob_attr *value)
+{
+	char val[32], hostid_esc[64], name_esc[256];
+
+	if (!format_value(value, val, sizeof(val), true))
+		return 0;
+
+	/* measurement and tag value, '=' is special only in the tag */
+	return output_printf(o, "%s,host=%s value=%s %llu000000000\n",
+			escape_str(name, ", ", false, name_esc, sizeof(name_esc)),
+			escape_str(hostid, ", =", false, hostid_esc,
+					sizeof(hostid_esc)),
+			val, (unsigned long long)time);
+}
+#endif
+
+#ifdef WITH_OUTPUT_FILE
+static int file_format(struct output *o, const char *hostid,
+		       const char *name, uint64_t time,
+		       struct blob_attr *value)
+{
+	return format_json(o, hostid, name, time, value, "\n");
+}
+#endif
+
+static void output_done(struct output *o, bool success)
+{
+	o->busy = false;
+	stats.post_ms = (trace_now() - o->send_start) / 1000;
+	if (!success) {
+		stats.failures++;
+		unsigned int backoff = 30 << (o->failures < 5 ? o->failures : 5);
+
+		o->failures++;
+		o->next_try = time(NULL) +
+			(backoff < OUTPUT_RETRY_MAX ? backoff : OUTPUT_RETRY_MAX);
+		fprintf(stderr, "warning: %s output failed (%d times, status: %d)\n",
+				o->ops->type, o->failures, o->status);
+		o->sent_len = 0;
+		return;
+	}
+
+	/* drop the sent records, and keep new ones formatted in flight */
+	stats.bytes_sent += o->sent_len;
+	o->len -= o->sent_len;
+	memmove(o->buf, o->buf + o->sent_len, o->len);
+	o->sent_len = 0;
+	o->failures = 0;
+	o->next_try = 0;
+}
+
+static void http_header_done(struct uclient *cl)
+{
+	struct output *o = cl->priv;
+
+	o->status = cl->status_code;
+}
+
+static void http_data_read(struct uclient *cl)
+{
+	char buf[256];
+
+	/* the response body is not used */
+	while (uclient_read(cl, buf, sizeof(buf)) > 0);
+}
+
+static void http_data_eof(struct uclient *cl)
+{
+	struct output *o = cl->priv;
+
+	output_done(o, o->status >= 200 && o->status < 300);
+}
+
+static void http_error(struct uclient *cl, int code)
+{
+	struct output *o = cl->priv;
+
+	uclient_disconnect(cl);
+	o->status = -code;
+	output_done(o, false);
+}
+
+static const struct uclient_cb http_cb = {
+	.header_done = http_header_done,
+	.data_read = http_data_read,
+	.data_eof = http_data_eof,
+	.error = http_error,
+};
+
+/* shared with the other uclient users (ex.: remote) */
+int output_set_ssl(struct uclient *cl, bool verify)
+{
+	if (init_ustream_ssl())
+		return -1;
+
+	return uclient_http_set_ssl_ctx(cl, ssl_ops, ssl_ctx, verify);
+}
+
+static int http_init(struct output *o)
+{
+	if (!o->url[0])
+		strcpy(o->url, o->target);
+
+	o->cl = uclient_new(o->url, NULL, &http_cb);
+	if (!o->cl) {
+		fprintf(stderr, "err: invalid URL \"%s\"\n", o->url);
+		return -1;
+	}
+	o->cl->priv = o;
+
+	if (!strncmp(o->url, "https://", 8) && output_set_ssl(o->cl, true))
+		return -1;
+
+	return 0;
+}
+
+static int http_send(struct output *o)
+{
+	bool mackerel = !strcmp(o->ops->type, "mackerel");
+	char auth[OUTPUT_KEY_LEN + 8];
+	int ret;
+
+	o->status = 0;
+	uclient_set_timeout(o->cl, output_timeout * 1000);
+	if (uclient_connect(o->cl))
+		return -1;
+	uclient_http_set_request_type(o->cl, "POST");
+	uclient_http_reset_headers(o->cl);
+	if (mackerel) {
+		uclient_http_set_header(o->cl, "X-Api-Key", o->key);
+		uclient_http_set_header(o->cl, "Content-Type", "application/json");
+	} else {
+		if (o->key[0]) {
+			snprintf(auth, sizeof(auth), "Token %s", o->key);
+			uclient_http_set_header(o->cl, "Authorization", auth);
+		}
+		uclient_http_set_header(o->cl, "Content-Type", "text/plain");
+	}
+
+	o->sent_len = o->len;
+	if (mackerel) {
+		/* "{...},\n{...},\n" -> "[{...},\n{...}]" */
+		uclient_write(o->cl, "[", 1);
+		uclient_write(o->cl, o->buf, o->len - 2);
+		uclient_write(o->cl, "]", 1);
+	} else {
+		uclient_write(o->cl, o->buf, o->len);
+	}
+	ret = uclient_request(o->cl);
+	if (ret) {
+		uclient_disconnect(o->cl);
+		return ret;
+	}
+
+	return 1;
+}
+
+static void http_free(struct output *o)
+{
+	if (o->cl)
+		uclient_free(o->cl);
+	o->cl = NULL;
+}
+
+#ifdef WITH_OUTPUT_INFLUX
+static int udp_init(struct output *o)
+{
+	struct addrinfo hints = {
+		.ai_family = AF_UNSPEC,
+		.ai_socktype = SOCK_DGRAM,
+	}, *res;
+	char host[OUTPUT_TARGET_LEN], *port;
+
+	/* udp://<host>:<port>, [<v6addr>]:<port> */
+	strcpy(host, o->target + strlen("udp://"));
+	port = strrchr(host, ':');
+	if (!port) {
+		fprintf(stderr, "err: no port in \"%s\"\n", o->target);
+		return -1;
+	}
+	*port++ = '\0';
+	if (host[0] == '[' && port[-2] == ']') {
+		port[-2] = '\0';
+		memmove(host, host + 1, strlen(host));
+	}
+
+	if (getaddrinfo(host, port, &hints, &res)) {
+		fprintf(stderr, "err: failed to resolve \"%s\"\n", host);
+		return -1;
+	}
+	o->fd = socket(res->ai_family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (o->fd < 0 || connect(o->fd, res->ai_addr, res->ai_addrlen)) {
+		fprintf(stderr, "err: failed to open UDP socket for \"%s\"\n",
+				o->target);
+		freeaddrinfo(res);
+		return -1;
+	}
+	freeaddrinfo(res);
+
+	return 0;
+}
+
+/* send lines in datagrams up to OUTPUT_UDP_LEN, no retry */
+static int udp_send(struct output *o)
+{
+	size_t ofs = 0, len;
+	char *end;
+
+	while (ofs < o->len) {
+		len = o->len - ofs;
+		if (len > OUTPUT_UDP_LEN) {
+			end = memrchr(o->buf + ofs, '\n', OUTPUT_UDP_LEN);
+			len = end ? end + 1 - (o->buf + ofs) : OUTPUT_UDP_LEN;
+		}
+		send(o->fd, o->buf + ofs, len, 0);
+		ofs += len;
+	}
+	o->sent_len = o->len;
+
+	return 0;
+}
+#endif
+
+#ifdef WITH_OUTPUT_FILE
+static int file_init(struct output *o)
+{
+	o->fd = open(o->target, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+	if (o->fd < 0) {
+		fprintf(stderr, "err: failed to open \"%s\"\n", o->target);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int file_send(struct output *o)
+{
+	char path[OUTPUT_TARGET_LEN + 4];
+	struct stat st;
+	ssize_t len;
+
+	if (!fstat(o->fd, &st) && st.st_size + o->len > OUTPUT_FILE_MAX) {
+		snprintf(path, sizeof(path), "%s.old", o->target);
+		rename(o->target, path);
+		close(o->fd);
+		if (file_init(o))
+			return -1;
+	}
+
+	len = write(o->fd, o->buf, o->len);
+	if (len < 0)
+		return -1;
+	/* partially written (ex.: ENOSPC), the rest is kept */
+	o->sent_len = len;
+
+	return 0;
+}
+#endif
+
+#if defined(WITH_OUTPUT_INFLUX) || defined(WITH_OUTPUT_FILE)
+static void fd_free(struct output *o)
+{
+	if (o->fd >= 0)
+		close(o->fd);
+	o->fd = -1;
+}
+#endif
+
+#ifdef WITH_OUTPUT_INFLUX
+static int influx_init(struct output *o)
+{
+	if (!strncmp(o->target, "udp://", 6))
+		return udp_init(o);
+
+	return http_init(o);
+}
+
+static int influx_send(struct output *o)
+{
+	return o->fd >= 0 ? udp_send(o) : http_send(o);
+}
+
+static void influx_free(struct output *o)
+{
+	fd_free(o);
+	http_free(o);
+}
+#endif
+
+static int mackerel_init_http(struct output *o)
+{
+	if (mackerel_init(o))
+		return -1;
+
+	return http_init(o);
+}
+
+static const struct output_ops output_types[] = {
+	{
+		.type = "mackerel",
+		.init = mackerel_init_http,
+		.format = mackerel_format,
+		.send = http_send,
+		.free = http_free,
+	},
+#ifdef WITH_OUTPUT_INFLUX
+	{
+		.type = "influx",
+		.init = influx_init,
+		.format = influx_format,
+		.send = influx_send,
+		.free = influx_free,
+	},
+#endif
+#ifdef WITH_OUTPUT_FILE
+	{
+		.type = "file",
+		.init = file_init,
+		.format = file_format,
+		.send = file_send,
+		.free = fd_free,
+	},
+#endif
+};
+
+void output_set_timeout(unsigned int sec)
+{
+	output_timeout = sec;
+}
+
+/* spec: <type>[:<target>] */
+int output_add(const char *spec, const char *key, unsigned int batch)
+{
+	const char *target = strchr(spec, ':');
+	size_t tlen = target ? target - spec : strlen(spec);
+	struct output *o;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(output_types); i++) {
+		if (strlen(output_types[i].type) == tlen &&
+		    !strncmp(output_types[i].type, spec, tlen))
+			break;
+	}
+	if (i == ARRAY_SIZE(output_types)) {
+		fprintf(stderr, "err: unknown output \"%s\"\n", spec);
+		return -1;
+	}
+	if (target && strlen(target + 1) >= OUTPUT_TARGET_LEN)
+		return -1;
+
+	/* kept with the pending data (and in flight) if still configured */
+	list_for_each_entry(o, &retired, list) {
+		if (o->ops == &output_types[i] &&
+		    !strcmp(o->target, target ? target + 1 : "")) {
+			list_move_tail(&o->list, &outputs);
+			o->batch = batch ? batch : 1;
+			snprintf(o->key, sizeof(o->key), "%s", key ? key : "");
+			return 0;
+		}
+	}
+
+	o = calloc(1, sizeof(*o));
+	if (!o)
+		return -1;
+	o->ops = &output_types[i];
+	o->fd = -1;
+	o->batch = batch ? batch : 1;
+	if (target)
+		strcpy(o->target, target + 1);
+	if (key)
+		snprintf(o->key, sizeof(o->key), "%s", key);
+
+	if (o->ops->init(o)) {
+		o->ops->free(o);
+		free(o);
+		return -1;
+	}
+	list_add_tail(&o->list, &outputs);
+
+	return 0;
+}
+
+bool output_has_type(const char *type)
+{
+	struct output *o;
+
+	list_for_each_entry(o, &outputs, list) {
+		if (!strcmp(o->ops->type, type))
+			return true;
+	}
+
+	return false;
+}
+
+static void output_flush(struct output *o)
+{
+	int ret;
+
+	if (o->busy || !o->len || o->cycles < o->batch ||
+	    time(NULL) < o->next_try)
+		return;
+	/* deferred unless the oldest data are about to be dropped */
+	if (output_deferred && o->len < OUTPUT_PENDING_MAX / 2)
+		return;
+
+	o->cycles = 0;
+	o->send_start = trace_now();
+	ret = o->ops->send(o);
+	if (ret > 0) {
+		o->busy = true;	/* completed in callbacks */
+		return;
+	}
+	output_done(o, ret == 0);
+}
+
+/* format the "metrics" array for all outputs */
+void output_add_metrics(struct blob_attr *metrics)
+{
+	struct blob_attr *tb[_OUTPUT_OBJ_MAX], *cur;
+	struct output *o;
+	uint64_t start;
+	unsigned rem;
+
+	if (list_empty(&outputs))
+		return;
+
+	start = trace_now();
+
+	blobmsg_for_each_attr(cur, metrics, rem) {
+		blobmsg_parse(output_obj_policy, _OUTPUT_OBJ_MAX, tb,
+				blobmsg_data(cur), blobmsg_data_len(cur));
+		if (!tb[OUTPUT_OBJ_HOSTID] || !tb[OUTPUT_OBJ_NAME] ||
+		    !tb[OUTPUT_OBJ_TIME] || !tb[OUTPUT_OBJ_VALUE])
+			continue;
+
+		list_for_each_entry(o, &outputs, list)
+			o->ops->format(o,
+					blobmsg_get_string(tb[OUTPUT_OBJ_HOSTID]),
+					blobmsg_get_string(tb[OUTPUT_OBJ_NAME]),
+					blobmsg_get_u64(tb[OUTPUT_OBJ_TIME]),
+					tb[OUTPUT_OBJ_VALUE]);
+	}
+	trace_end(TRACE_JSON, start);
+}
+
+/* end of a collection, send the batches if full */
+void output_send(void)
+{
+	struct output *o;
+
+	list_for_each_entry(o, &outputs, list) {
+		o->cycles++;
+		output_flush(o);
+	}
+}
+
+/* hold the batches while the collector is backed off */
+void output_defer(bool defer)
+{
+	output_deferred = defer;
+}
+
+void output_write(struct blob_attr *metrics)
+{
+	output_add_metrics(metrics);
+	output_send();
+}
+
+void output_get_stats(struct output_stats *st)
+{
+	struct output *o;
+
+	*st = stats;
+	st->pending = 0;
+	list_for_each_entry(o, &outputs, list)
+		st->pending += o->len;
+
+	stats.bytes_sent = 0;
+	stats.failures = 0;
+}
+
+static void output_free(struct output *o)
+{
+	list_del(&o->list);
+	o->ops->free(o);
+	free(o->buf);
+	free(o);
+}
+
+void output_free_all(void)
+{
+	struct output *o, *tmp;
+
+	list_for_each_entry_safe(o, tmp, &outputs, list)
+		output_free(o);
+}
+
+/*
+ * before re-adding the outputs on reload, the ones added again with the
+ * same type and target are kept by output_add()
+ */
+void output_retire_all(void)
+{
+	list_splice_init(&outputs, &retired);
+}
+
+/* after re-adding, free the outputs no longer configured */
+void output_free_retired(void)
+{
+	struct output *o, *tmp;
+
+	list_for_each_entry_safe(o, tmp, &retired, list) {
+		if (o->len)
+			fprintf(stderr,
+				"warning: %s output removed, %zu bytes not sent\n",
+				o->ops->type, o->len);
+		output_free(o);
+	}
+}
@@ -0,0 +1,117 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <libubox/list.h>
+#include <libubox/blobmsg.h>
+
+#define OUTPUT_TARGET_LEN	256
+#define OUTPUT_KEY_LEN		128
+#define OUTPUT_PENDING_MAX	(64 * 1024)	/* oldest data are dropped over this */
+#define OUTPUT_RETRY_MAX	600		/* max backoff (sec) */
+#define OUTPUT_FILE_MAX		(1024 * 1024)	/* rotated to "<path>.old" */
+#define OUTPUT_UDP_LEN		1400
+#define MACKEREL_APIBASE_DEF	"api.mackerelio.com"
+
+struct output;
+struct uclient;
+
+struct output_ops {
+	const char *type;
+	int (*init)(struct output *o);
+	/* append one metric to the pending buffer */
+	int (*format)(struct output *o, const char *hostid, const char *name,
+		      uint64_t time, struct blob_attr *value);
+	/* 0: sent, 1: in progress, < 0: failed */
+	int (*send)(struct output *o);
+	void (*free)(struct output *o);
+};
+
+/*
+ * output sink, each has its own batching and retry state
+ *
+ *   mackerel[:<apibase>]        POST /api/v0/tsdb (JSON)
+ *   influx:http(s)://<url>      POST line protocol (ex.: .../write?db=router)
+ *   influx:udp://<host>:<port>  line protocol over UDP
+ *   file:<path>                 newline-delimited JSON
+ */
+struct output {
+	struct list_head list;
+	const struct output_ops *ops;
+	char target[OUTPUT_TARGET_LEN];
+	char key[OUTPUT_KEY_LEN];	/* API key or token */
+	unsigned int batch;			/* cycles to be sent at once */
+
+	/* batching */
+	char *buf;					/* formatted records */
+	size_t len;
+	size_t size;
+	size_t sent_len;			/* in flight */
+	unsigned int cycles;
+	unsigned int dropped;
+
+	/* retry */
+	unsigned int failures;
+	time_t next_try;
+	bool busy;
+	uint64_t send_start;		/* usec, monotonic */
+
+	/* backend */
+	char url[OUTPUT_TARGET_LEN];
+	struct uclient *cl;
+	int status;
+	int fd;
+};
+
+/* since the previous output_get_stats() */
+struct output_stats {
+	uint64_t bytes_sent;
+	unsigned int failures;
+	unsigned int post_ms;		/* the last completed one */
+	size_t pending;				/* bytes not sent yet */
+};
+
+#ifdef WITH_OUTPUT
+int output_add(const char *spec, const char *key, unsigned int batch);
+void output_set_timeout(unsigned int sec);
+bool output_has_type(const char *type);
+void output_add_metrics(struct blob_attr *metrics);
+void output_send(void);
+void output_write(struct blob_attr *metrics);
+void output_defer(bool defer);
+void output_free_all(void);
+void output_retire_all(void);
+void output_free_retired(void);
+int output_set_ssl(struct uclient *cl, bool verify);
+void output_get_stats(struct output_stats *st);
+#else
+static inline int output_add(const char *spec, const char *key,
+			     unsigned int batch)
+{
+	fprintf(stderr, "err: outputs are not supported in this build\n");
+	return -1;
+}
+static inline void output_set_timeout(unsigned int sec) {}
+static inline bool output_has_type(const char *type) { return false; }
+static inline void output_add_metrics(struct blob_attr *metrics) {}
+static inline void output_send(void) {}
+static inline void output_write(struct blob_attr *metrics) {}
+static inline void output_defer(bool defer) {}
+static inline void output_free_all(void) {}
+static inline void output_retire_all(void) {}
+static inline void output_free_retired(void) {}
+static inline int output_set_ssl(struct uclient *cl, bool verify)
+{
+	return -1;
+}
+static inline void output_get_stats(struct output_stats *st)
+{
+	memset(st, 0, sizeof(*st));
+}
+#endif
+
+#endif
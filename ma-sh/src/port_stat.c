@@ -0,0 +1,331 @@
+/*
+ * per-port counters of DSA switches and bridges
+ *
+ * One RTM_GETLINK dump returns IFLA_STATS64 of all links together with
+ * IFLA_MASTER, IFLA_PHYS_SWITCH_ID and the link kind, so the DSA user
+ * ports (with a switch id) and the bridge members are found and read at
+ * once, without spawning swconfig or ethtool. The netlink socket is kept
+ * open. The counters of the previous scan are stored in the sysstat json
+ * like the "cpu" and "proc" ones.
+ *
+ * Link speed and duplex are read from sysfs: ETHTOOL_MSG_LINKMODES_GET
+ * needs CONFIG_ETHTOOL_NETLINK (5.6 or later), which is not available on
+ * all targets, and sysfs returns the same ethtool_link_ksettings.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/if.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_link.h>
+
+#include "port_stat.h"
+#include "util.h"
+
+struct port_link {
+	int index;
+	int master;
+	char name[PORT_NAME_LEN];
+	bool is_switch;				/* has IFLA_PHYS_SWITCH_ID */
+	bool is_bridge;
+	bool up;
+	uint64_t cnt[_PORT_CNT_MAX];
+};
+
+static const char * const cnt_names[] = {
+	[PORT_RX_BYTES] = "rxBytes",
+	[PORT_TX_BYTES] = "txBytes",
+	[PORT_RX_PACKETS] = "rxPackets",
+	[PORT_TX_PACKETS] = "txPackets",
+	[PORT_RX_ERRORS] = "rxErrors",
+	[PORT_TX_ERRORS] = "txErrors",
+};
+
+static int nl_fd = -1;
+static uint32_t nl_seq;
+static char nl_buf[PORT_NL_BUF_LEN] __attribute__((aligned(NLMSG_ALIGNTO)));
+static struct port_link links[PORT_LINK_MAX];
+static int link_cnt;
+static struct port_link *ports[PORT_STAT_MAX];
+static int port_cnt;
+PREV_TABLE(prev, PORT_STAT_MAX, _PORT_CNT_MAX, PORT_NAME_LEN,
+	   PORT_STAT_MAX * 2);
+
+static int nl_open(void)
+{
+	struct sockaddr_nl sa = { .nl_family = AF_NETLINK };
+
+	nl_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if (nl_fd < 0) {
+		fprintf(stderr, "err: failed to open rtnetlink socket\n");
+		return -3;
+	}
+	if (bind(nl_fd, (struct sockaddr *)&sa, sizeof(sa))) {
+		fprintf(stderr, "err: failed to bind rtnetlink socket\n");
+		close(nl_fd);
+		nl_fd = -1;
+		return -3;
+	}
+
+	return 0;
+}
+
+static int nl_dump_link(void)
+{
+	struct {
+		struct nlmsghdr nlh;
+		struct ifinfomsg ifm;
+	} req;
+
+	memset(&req, 0, sizeof(req));
+	req.nlh.nlmsg_len = sizeof(req);
+	req.nlh.nlmsg_type = RTM_GETLINK;
+	req.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	req.nlh.nlmsg_seq = ++nl_seq;
+	req.ifm.ifi_family = AF_UNSPEC;
+
+	if (send(nl_fd, &req, sizeof(req), 0) < 0)
+		return -3;
+
+	return 0;
+}
+
+static void parse_linkinfo(struct rtattr *info, struct port_link *l)
+{
+	struct rtattr *rta;
+	int len = RTA_PAYLOAD(info);
+
+	for (rta = RTA_DATA(info); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		if (rta->rta_type == IFLA_INFO_KIND &&
+		    !strncmp(RTA_DATA(rta), "bridge", RTA_PAYLOAD(rta)))
+			l->is_bridge = true;
+	}
+}
+
+static void parse_link(struct nlmsghdr *nlh)
+{
+	struct ifinfomsg *ifm = NLMSG_DATA(nlh);
+	struct rtnl_link_stats64 st;
+	struct port_link *l;
+	struct rtattr *rta;
+	int len = IFLA_PAYLOAD(nlh);
+
+	if (link_cnt >= PORT_LINK_MAX)
+		return;
+
+	l = &links[link_cnt];
+	memset(l, 0, sizeof(*l));
+	l->index = ifm->ifi_index;
+
+	for (rta = IFLA_RTA(ifm); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		switch (rta->rta_type) {
+			case IFLA_IFNAME:
+				snprintf(l->name, sizeof(l->name), "%s",
+						(char *)RTA_DATA(rta));
+				break;
+			case IFLA_MASTER:
+				l->master = *(uint32_t *)RTA_DATA(rta);
+				break;
+			case IFLA_PHYS_SWITCH_ID:
+				l->is_switch = true;
+				break;
+			case IFLA_OPERSTATE:
+				l->up = *(uint8_t *)RTA_DATA(rta) == IF_OPER_UP;
+				break;
+			case IFLA_LINKINFO:
+				parse_linkinfo(rta, l);
+				break;
+			case IFLA_STATS64:
+				/* may be unaligned for 64bit access */
+				memcpy(&st, RTA_DATA(rta), sizeof(st));
+				l->cnt[PORT_RX_BYTES] = st.rx_bytes;
+				l->cnt[PORT_TX_BYTES] = st.tx_bytes;
+				l->cnt[PORT_RX_PACKETS] = st.rx_packets;
+				l->cnt[PORT_TX_PACKETS] = st.tx_packets;
+				l->cnt[PORT_RX_ERRORS] = st.rx_errors;
+				l->cnt[PORT_TX_ERRORS] = st.tx_errors;
+				break;
+		}
+	}
+
+	if (l->name[0])
+		link_cnt++;
+}
+
+/* receive the dump until NLMSG_DONE */
+static int nl_recv_link(void)
+{
+	struct nlmsghdr *nlh;
+	ssize_t len;
+
+	link_cnt = 0;
+	for (;;) {
+		len = recv(nl_fd, nl_buf, sizeof(nl_buf), 0);
+		if (len < 0)
+			return -3;
+
+		for (nlh = (struct nlmsghdr *)nl_buf; NLMSG_OK(nlh, len);
+		     nlh = NLMSG_NEXT(nlh, len)) {
+			if (nlh->nlmsg_seq != nl_seq)
+				continue;
+			if (nlh->nlmsg_type == NLMSG_DONE)
+				return 0;
+			if (nlh->nlmsg_type == NLMSG_ERROR)
+				return -3;
+			if (nlh->nlmsg_type == RTM_NEWLINK)
+				parse_link(nlh);
+		}
+	}
+}
+
+static struct port_link *find_link(int index)
+{
+	int i;
+
+	for (i = 0; i < link_cnt; i++) {
+		if (links[i].index == index)
+			return &links[i];
+	}
+
+	return NULL;
+}
+
+/* dump the links, returns the number of ports */
+int port_stat_scan(void)
+{
+	struct port_link *l, *m;
+	int i;
+
+	if (nl_fd < 0 && nl_open())
+		return -3;
+
+	if (nl_dump_link() || nl_recv_link()) {
+		fprintf(stderr, "err: failed to dump links\n");
+		/* re-open with the new sequence next time */
+		port_stat_close();
+		return -3;
+	}
+
+	port_cnt = 0;
+	for (i = 0; i < link_cnt && port_cnt < PORT_STAT_MAX; i++) {
+		l = &links[i];
+		if (l->is_bridge)
+			continue;
+		if (!l->is_switch &&
+		    (!l->master || !(m = find_link(l->master)) || !m->is_bridge))
+			continue;
+		ports[port_cnt++] = l;
+	}
+
+	return port_cnt;
+}
+
+/* store name -> [counters] table of the current scan to the buffer */
+void port_stat_save(struct blob_buf *buf, const char *name)
+{
+	void *tbl;
+	int i;
+
+	tbl = blobmsg_open_table(buf, name);
+	for (i = 0; i < port_cnt; i++)
+		prev_table_add(buf, ports[i]->name, ports[i]->cnt,
+				_PORT_CNT_MAX);
+	blobmsg_close_table(buf, tbl);
+}
+
+/* load name -> [counters] table of the previous scan */
+void port_stat_load(struct blob_attr *attr)
+{
+	prev_table_load(&prev, attr);
+}
+
+/* /sys/class/net/<dev>/<attr>, returns the length */
+static int read_sysfs(const char *dev, const char *attr, char *buf,
+		      size_t len)
+{
+	char path[64];
+	ssize_t ret;
+	int fd;
+
+	snprintf(path, sizeof(path), "/sys/class/net/%s/%s", dev, attr);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	/* EINVAL for the link down */
+	ret = read(fd, buf, len - 1);
+	close(fd);
+	if (ret <= 0)
+		return -1;
+	buf[ret] = '\0';
+
+	return ret;
+}
+
+static void get_link_mode(const char *dev, struct port_stat_ent *ent)
+{
+	char buf[16];
+
+	ent->speed = -1;
+	ent->duplex = -1;
+	if (!ent->up)
+		return;
+
+	if (read_sysfs(dev, "speed", buf, sizeof(buf)) > 0)
+		ent->speed = strtol(buf, NULL, 10);
+	if (ent->speed <= 0)
+		ent->speed = -1;
+	if (read_sysfs(dev, "duplex", buf, sizeof(buf)) > 0) {
+		if (!strncmp(buf, "full", 4))
+			ent->duplex = 1;
+		else if (!strncmp(buf, "half", 4))
+			ent->duplex = 0;
+	}
+}
+
+/*
+ * get the ports of the current scan into ents, the deltas are available
+ * if the port was in the previous scan, returns the number of entries
+ */
+int port_stat_get(struct port_stat_ent *ents, int n)
+{
+	const uint64_t *p;
+	int i, j;
+
+	for (i = 0; i < port_cnt && i < n; i++) {
+		strcpy(ents[i].name, ports[i]->name);
+		metric_sanitize(ents[i].name);
+		ents[i].up = ports[i]->up;
+		get_link_mode(ports[i]->name, &ents[i]);
+
+		p = prev_table_find(&prev, ports[i]->name, _PORT_CNT_MAX);
+		ents[i].has_delta = p != NULL;
+		for (j = 0; j < _PORT_CNT_MAX; j++) {
+			/* reset or re-created since the previous scan */
+			if (!p || ports[i]->cnt[j] < p[j])
+				ents[i].cnt[j] = 0;
+			else
+				ents[i].cnt[j] = ports[i]->cnt[j] - p[j];
+		}
+	}
+
+	return i;
+}
+
+const char *port_stat_cnt_name(int cnt)
+{
+	return cnt_names[cnt];
+}
+
+void port_stat_close(void)
+{
+	if (nl_fd < 0)
+		return;
+	close(nl_fd);
+	nl_fd = -1;
+}
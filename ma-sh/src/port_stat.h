@@ -0,0 +1,51 @@
+#ifndef PORT_STAT_H
+#define PORT_STAT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <libubox/blobmsg.h>
+
+#define PORT_STAT_MAX		32		/* switch ports and bridge members */
+#define PORT_LINK_MAX		128		/* links in a dump */
+#define PORT_NAME_LEN		16		/* IFNAMSIZ */
+#define PORT_NL_BUF_LEN		32768
+
+enum {
+	PORT_RX_BYTES,
+	PORT_TX_BYTES,
+	PORT_RX_PACKETS,
+	PORT_TX_PACKETS,
+	PORT_RX_ERRORS,
+	PORT_TX_ERRORS,
+	_PORT_CNT_MAX,
+};
+
+struct port_stat_ent {
+	char name[PORT_NAME_LEN];	/* sanitized ifname */
+	uint64_t cnt[_PORT_CNT_MAX];	/* delta from the previous scan */
+	bool has_delta;				/* false on the first scan */
+	bool up;
+	int speed;					/* Mbps, -1: unknown */
+	int duplex;					/* 1: full, 0: half, -1: unknown */
+};
+
+#ifdef WITH_PORT_STAT
+int port_stat_scan(void);
+void port_stat_save(struct blob_buf *buf, const char *name);
+void port_stat_load(struct blob_attr *attr);
+int port_stat_get(struct port_stat_ent *ents, int n);
+const char *port_stat_cnt_name(int cnt);
+void port_stat_close(void);
+#else
+static inline int port_stat_scan(void) { return -1; }
+static inline void port_stat_save(struct blob_buf *buf, const char *name) {}
+static inline void port_stat_load(struct blob_attr *attr) {}
+static inline int port_stat_get(struct port_stat_ent *ents, int n)
+{
+	return 0;
+}
+static inline const char *port_stat_cnt_name(int cnt) { return ""; }
+static inline void port_stat_close(void) {}
+#endif
+
+#endif
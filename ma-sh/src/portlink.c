@@ -0,0 +1,685 @@
+/*
+ * link speed of the swconfig switch ports
+ *
+ * The external ports (without "device") of the switches in board.json are
+ * queried over the generic netlink family of swconfig, with the "link"
+ * requests of all ports sent in one message and the replies received
+ * together, instead of "swconfig dev <sw> port <n> get link" per port.
+ *
+ * The port map (family, switch ids, id of the "link" attribute and the
+ * ports) is made once and kept in memory, and in the sysstat json for the
+ * one-shot runs. It is made again if a query is refused by the kernel.
+ * Without swconfig (DSA), the map is empty and nothing is queried; the DSA
+ * ports are reported by port_stat.
+ */
+
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <linux/netlink.h>
+#include <linux/genetlink.h>
+#include <libubox/blobmsg_json.h>
+
+#include "portlink.h"
+
+/*
+ * from linux/switch.h of OpenWrt (target/linux/generic/files), not in the
+ * toolchain headers, the ids must be exactly the same as the kernel's
+ */
+#define SWITCH_FAMILY		"switch"
+
+enum {
+	/* user attributes */
+	SWITCH_ATTR_UNSPEC,
+	SWITCH_ATTR_TYPE,
+	SWITCH_ATTR_ID,
+	SWITCH_ATTR_DEV_NAME,
+	SWITCH_ATTR_ALIAS,
+	SWITCH_ATTR_NAME,
+	SWITCH_ATTR_VLANS,
+	SWITCH_ATTR_PORTS,
+	SWITCH_ATTR_PORTMAP,
+	SWITCH_ATTR_CPU_PORT,
+	/* attributes */
+	SWITCH_ATTR_OP_ID,
+	SWITCH_ATTR_OP_TYPE,
+	SWITCH_ATTR_OP_NAME,
+	SWITCH_ATTR_OP_PORT,
+	SWITCH_ATTR_OP_VLAN,
+	SWITCH_ATTR_OP_VALUE_INT,
+	SWITCH_ATTR_OP_VALUE_STR,
+	SWITCH_ATTR_OP_VALUE_PORTS,
+	SWITCH_ATTR_OP_VALUE_LINK,
+	SWITCH_ATTR_OP_DESCRIPTION,
+	/* port lists */
+	SWITCH_ATTR_PORT,
+	_SWITCH_ATTR_MAX,
+};
+
+/* commands */
+enum {
+	SWITCH_CMD_UNSPEC,
+	SWITCH_CMD_GET_SWITCH,
+	SWITCH_CMD_NEW_ATTR,
+
+	SWITCH_CMD_LIST_GLOBAL,
+	SWITCH_CMD_GET_GLOBAL,
+	SWITCH_CMD_SET_GLOBAL,
+
+	SWITCH_CMD_LIST_PORT,
+	SWITCH_CMD_GET_PORT,
+	SWITCH_CMD_SET_PORT,
+
+	SWITCH_CMD_LIST_VLAN,
+	SWITCH_CMD_GET_VLAN,
+	SWITCH_CMD_SET_VLAN,
+};
+
+/* data types */
+enum {
+	SWITCH_TYPE_UNSPEC,
+	SWITCH_TYPE_INT,
+	SWITCH_TYPE_STRING,		/* "port:1 link:up speed:1000baseT ..." (old) */
+	SWITCH_TYPE_PORTS,
+	SWITCH_TYPE_LINK,
+	SWITCH_TYPE_NOVAL,
+};
+
+/* link nested attributes */
+enum {
+	SWITCH_LINK_UNSPEC,
+	SWITCH_LINK_FLAG_LINK,
+	SWITCH_LINK_FLAG_DUPLEX,
+	SWITCH_LINK_FLAG_ANEG,
+	SWITCH_LINK_FLAG_TX_FLOW,
+	SWITCH_LINK_FLAG_RX_FLOW,
+	SWITCH_LINK_SPEED,
+	SWITCH_LINK_FLAG_EEE_100BASET,
+	SWITCH_LINK_FLAG_EEE_1000BASET,
+	_SWITCH_LINK_MAX,
+};
+
+/* board.json */
+enum {
+	BOARD_SWITCH,
+	_BOARD_MAX,
+};
+
+static const struct blobmsg_policy board_policy[] = {
+	[BOARD_SWITCH] = { .name = "switch", .type = BLOBMSG_TYPE_TABLE },
+};
+
+enum {
+	BOARD_SW_PORTS,
+	_BOARD_SW_MAX,
+};
+
+static const struct blobmsg_policy board_sw_policy[] = {
+	[BOARD_SW_PORTS] = { .name = "ports", .type = BLOBMSG_TYPE_ARRAY },
+};
+
+enum {
+	BOARD_PORT_NUM,
+	BOARD_PORT_DEVICE,
+	_BOARD_PORT_MAX,
+};
+
+static const struct blobmsg_policy board_port_policy[] = {
+	[BOARD_PORT_NUM] = { .name = "num", .type = BLOBMSG_TYPE_INT32 },
+	[BOARD_PORT_DEVICE] = { .name = "device", .type = BLOBMSG_TYPE_STRING },
+};
+
+/* cached map in the sysstat json */
+enum {
+	MAP_FAMILY,
+	_MAP_MAX,
+};
+
+static const struct blobmsg_policy map_policy[] = {
+	[MAP_FAMILY] = { .name = "family", .type = BLOBMSG_TYPE_INT32 },
+};
+
+enum {
+	MAP_SW_ID,
+	MAP_SW_LINK,
+	MAP_SW_TYPE,
+	MAP_SW_PORTS,
+	_MAP_SW_MAX,
+};
+
+static const struct blobmsg_policy map_sw_policy[] = {
+	[MAP_SW_ID] = { .name = "id", .type = BLOBMSG_TYPE_INT32 },
+	[MAP_SW_LINK] = { .name = "link", .type = BLOBMSG_TYPE_INT32 },
+	[MAP_SW_TYPE] = { .name = "type", .type = BLOBMSG_TYPE_INT32 },
+	[MAP_SW_PORTS] = { .name = "ports", .type = BLOBMSG_TYPE_ARRAY },
+};
+
+struct portlink_sw {
+	char name[PORTLINK_NAME_LEN];
+	uint32_t id;					/* of swconfig */
+	uint32_t link_id;				/* "link" attribute */
+	int link_type;					/* SWITCH_TYPE_LINK or _STRING */
+	int ports[PORTLINK_PORT_MAX];
+	int port_cnt;
+};
+
+static struct portlink_sw sws[PORTLINK_SW_MAX];
+static int sw_cnt;
+static int family;					/* 0: no swconfig */
+static bool mapped = false;
+
+static int nl_fd = -1;
+static uint32_t nl_seq;
+static char nl_buf[PORTLINK_NL_BUF_LEN] __attribute__((aligned(NLMSG_ALIGNTO)));
+static char req_buf[PORTLINK_NL_BUF_LEN] __attribute__((aligned(NLMSG_ALIGNTO)));
+static size_t req_len;
+
+static int nl_open(void)
+{
+	struct sockaddr_nl sa = { .nl_family = AF_NETLINK };
+	struct timeval tv = { .tv_sec = PORTLINK_TIMEOUT };
+
+	nl_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_GENERIC);
+	if (nl_fd < 0) {
+		fprintf(stderr, "err: failed to open genetlink socket\n");
+		return -3;
+	}
+	if (bind(nl_fd, (struct sockaddr *)&sa, sizeof(sa))) {
+		fprintf(stderr, "err: failed to bind genetlink socket\n");
+		close(nl_fd);
+		nl_fd = -1;
+		return -3;
+	}
+	setsockopt(nl_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	return 0;
+}
+
+/* requests are appended to req_buf and sent at once by nl_send() */
+static struct nlmsghdr *msg_begin(uint16_t type, uint16_t flags, uint8_t cmd)
+{
+	struct nlmsghdr *nlh = (struct nlmsghdr *)(req_buf + req_len);
+	struct genlmsghdr *genl;
+
+	if (req_len + NLMSG_SPACE(GENL_HDRLEN) > sizeof(req_buf))
+		return NULL;
+	nlh->nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN);
+	nlh->nlmsg_type = type;
+	nlh->nlmsg_flags = NLM_F_REQUEST | flags;
+	nlh->nlmsg_seq = ++nl_seq;
+	nlh->nlmsg_pid = 0;
+	genl = NLMSG_DATA(nlh);
+	genl->cmd = cmd;
+	genl->version = 1;
+	genl->reserved = 0;
+
+	return nlh;
+}
+
+static int msg_put(struct nlmsghdr *nlh, uint16_t type, const void *data,
+		   size_t len)
+{
+	struct nlattr *nla;
+	size_t off;
+
+	if (!nlh)
+		return -1;
+	off = NLMSG_ALIGN(nlh->nlmsg_len);
+	if (req_len + off + NLA_ALIGN(NLA_HDRLEN + len) > sizeof(req_buf))
+		return -1;
+	nla = (struct nlattr *)((char *)nlh + off);
+	nla->nla_type = type;
+	nla->nla_len = NLA_HDRLEN + len;
+	memcpy((char *)nla + NLA_HDRLEN, data, len);
+	nlh->nlmsg_len = off + NLA_ALIGN(nla->nla_len);
+
+	return 0;
+}
+
+static int msg_put_u32(struct nlmsghdr *nlh, uint16_t type, uint32_t val)
+{
+	return msg_put(nlh, type, &val, sizeof(val));
+}
+
+static void msg_end(struct nlmsghdr *nlh)
+{
+	req_len += NLMSG_ALIGN(nlh->nlmsg_len);
+}
+
+static int nl_send(void)
+{
+	ssize_t len = send(nl_fd, req_buf, req_len, 0);
+
+	req_len = 0;
+
+	return len < 0 ? -3 : 0;
+}
+
+static void parse_attrs(struct nlattr **tb, int max, void *data, int len)
+{
+	struct nlattr *nla;
+
+	memset(tb, 0, sizeof(*tb) * max);
+	for (nla = data; len >= NLA_HDRLEN && nla->nla_len >= NLA_HDRLEN &&
+	     nla->nla_len <= len;
+	     len -= NLA_ALIGN(nla->nla_len),
+	     nla = (struct nlattr *)((char *)nla + NLA_ALIGN(nla->nla_len))) {
+		if ((nla->nla_type & NLA_TYPE_MASK) < max)
+			tb[nla->nla_type & NLA_TYPE_MASK] = nla;
+	}
+}
+
+static void *nla_data(struct nlattr *nla)
+{
+	return (char *)nla + NLA_HDRLEN;
+}
+
+static uint32_t nla_u32(struct nlattr *nla)
+{
+	return *(uint32_t *)nla_data(nla);
+}
+
+static void parse_genl(struct nlmsghdr *nlh, struct nlattr **tb, int max)
+{
+	parse_attrs(tb, max, (char *)NLMSG_DATA(nlh) + GENL_HDRLEN,
+			nlh->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN));
+}
+
+static int nl_error(struct nlmsghdr *nlh)
+{
+	struct nlmsgerr *e = NLMSG_DATA(nlh);
+
+	return nlh->nlmsg_type == NLMSG_ERROR ? e->error : 0;
+}
+
+/*
+ * receive the replies of the seqs in [first, nl_seq] until all of them
+ * are done, the callback gets the messages with the index of the request
+ *
+ * The dumps end with NLMSG_DONE, the others are sent with NLM_F_ACK and
+ * end with the ACK (NLMSG_ERROR of 0): swconfig answers LIST_PORT in
+ * NLM_F_MULTI parts without NLMSG_DONE, like libsw expects. The ACKs are
+ * not passed to the callback.
+ */
+static int nl_recv(uint32_t first,
+		   void (*cb)(struct nlmsghdr *nlh, int idx, void *arg), void *arg)
+{
+	struct nlmsghdr *nlh;
+	int pending = nl_seq - first + 1;
+	ssize_t len;
+
+	while (pending > 0) {
+		len = recv(nl_fd, nl_buf, sizeof(nl_buf), 0);
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len <= 0)
+			return -3;
+
+		for (nlh = (struct nlmsghdr *)nl_buf; NLMSG_OK(nlh, len);
+		     nlh = NLMSG_NEXT(nlh, len)) {
+			if (nlh->nlmsg_seq < first || nlh->nlmsg_seq > nl_seq)
+				continue;
+			if (nlh->nlmsg_type == NLMSG_DONE) {
+				pending--;
+				continue;
+			}
+			if (nlh->nlmsg_type == NLMSG_ERROR) {
+				if (nl_error(nlh))
+					cb(nlh, nlh->nlmsg_seq - first, arg);
+				pending--;
+				continue;
+			}
+			cb(nlh, nlh->nlmsg_seq - first, arg);
+		}
+	}
+
+	return 0;
+}
+
+static void family_cb(struct nlmsghdr *nlh, int idx, void *arg)
+{
+	struct nlattr *tb[CTRL_ATTR_FAMILY_ID + 1];
+
+	if (nl_error(nlh) || nlh->nlmsg_type != GENL_ID_CTRL)
+		return;
+	parse_genl(nlh, tb, CTRL_ATTR_FAMILY_ID + 1);
+	if (tb[CTRL_ATTR_FAMILY_ID])
+		family = *(uint16_t *)nla_data(tb[CTRL_ATTR_FAMILY_ID]);
+}
+
+static int get_family(void)
+{
+	struct nlmsghdr *nlh;
+	uint32_t first = nl_seq + 1;
+
+	family = 0;
+	nlh = msg_begin(GENL_ID_CTRL, NLM_F_ACK, CTRL_CMD_GETFAMILY);
+	if (msg_put(nlh, CTRL_ATTR_FAMILY_NAME, SWITCH_FAMILY,
+		    sizeof(SWITCH_FAMILY)))
+		return -3;
+	msg_end(nlh);
+	if (nl_send() || nl_recv(first, family_cb, NULL))
+		return -3;
+
+	return 0;
+}
+
+/* "switch0" in board.json is the alias of swconfig */
+static void switch_cb(struct nlmsghdr *nlh, int idx, void *arg)
+{
+	struct nlattr *tb[_SWITCH_ATTR_MAX];
+	int i;
+
+	if (nl_error(nlh) || nlh->nlmsg_type != family)
+		return;
+	parse_genl(nlh, tb, _SWITCH_ATTR_MAX);
+	if (!tb[SWITCH_ATTR_ID])
+		return;
+	for (i = 0; i < sw_cnt; i++) {
+		if ((tb[SWITCH_ATTR_ALIAS] &&
+		     !strcmp(sws[i].name, nla_data(tb[SWITCH_ATTR_ALIAS]))) ||
+		    (tb[SWITCH_ATTR_DEV_NAME] &&
+		     !strcmp(sws[i].name, nla_data(tb[SWITCH_ATTR_DEV_NAME]))))
+			sws[i].id = nla_u32(tb[SWITCH_ATTR_ID]);
+	}
+}
+
+static void port_attr_cb(struct nlmsghdr *nlh, int idx, void *arg)
+{
+	struct nlattr *tb[_SWITCH_ATTR_MAX];
+	struct portlink_sw *sw = &sws[idx];
+	uint32_t type;
+
+	if (nl_error(nlh) || nlh->nlmsg_type != family)
+		return;
+	parse_genl(nlh, tb, _SWITCH_ATTR_MAX);
+	if (!tb[SWITCH_ATTR_OP_ID] || !tb[SWITCH_ATTR_OP_TYPE] ||
+	    !tb[SWITCH_ATTR_OP_NAME] ||
+	    strcmp(nla_data(tb[SWITCH_ATTR_OP_NAME]), "link"))
+		return;
+	type = nla_u32(tb[SWITCH_ATTR_OP_TYPE]);
+	if (type != SWITCH_TYPE_LINK && type != SWITCH_TYPE_STRING)
+		return;
+	sw->link_id = nla_u32(tb[SWITCH_ATTR_OP_ID]);
+	sw->link_type = type;
+}
+
+/* external ports of the switches in board.json */
+static int read_board(void)
+{
+	struct blob_attr *tb[_BOARD_MAX], *tb_sw[_BOARD_SW_MAX];
+	struct blob_attr *tb_port[_BOARD_PORT_MAX];
+	struct blob_attr *sw, *port;
+	struct portlink_sw *s;
+	static struct blob_buf b;
+	unsigned rem, rem2;
+
+	sw_cnt = 0;
+	blob_buf_init(&b, 0);
+	if (!blobmsg_add_json_from_file(&b, PORTLINK_BOARD_JSON))
+		return -1;
+
+	blobmsg_parse(board_policy, _BOARD_MAX, tb, blob_data(b.head),
+			blob_len(b.head));
+	blobmsg_for_each_attr(sw, tb[BOARD_SWITCH], rem) {
+		if (sw_cnt >= PORTLINK_SW_MAX)
+			break;
+		blobmsg_parse(board_sw_policy, _BOARD_SW_MAX, tb_sw,
+				blobmsg_data(sw), blobmsg_data_len(sw));
+		s = &sws[sw_cnt];
+		memset(s, 0, sizeof(*s));
+		snprintf(s->name, sizeof(s->name), "%s", blobmsg_name(sw));
+		blobmsg_for_each_attr(port, tb_sw[BOARD_SW_PORTS], rem2) {
+			blobmsg_parse(board_port_policy, _BOARD_PORT_MAX, tb_port,
+					blobmsg_data(port), blobmsg_data_len(port));
+			/* CPU ports have the ethernet device */
+			if (!tb_port[BOARD_PORT_NUM] || tb_port[BOARD_PORT_DEVICE] ||
+			    s->port_cnt >= PORTLINK_PORT_MAX)
+				continue;
+			s->ports[s->port_cnt++] =
+				blobmsg_get_u32(tb_port[BOARD_PORT_NUM]);
+		}
+		if (s->port_cnt)
+			sw_cnt++;
+	}
+	blob_buf_free(&b);
+
+	return 0;
+}
+
+/* board.json, then the family, the switch ids and the "link" attributes */
+static int make_map(void)
+{
+	struct nlmsghdr *nlh;
+	uint32_t first;
+	int i, cnt;
+
+	mapped = false;
+	family = 0;
+	if (read_board())
+		return -1;
+	if (!sw_cnt)
+		goto done;
+	if ((nl_fd < 0 && nl_open()) || get_family())
+		return -3;
+	/* not registered, DSA */
+	if (!family) {
+		sw_cnt = 0;
+		goto done;
+	}
+
+	for (i = 0; i < sw_cnt; i++)
+		sws[i].id = UINT32_MAX;
+	first = nl_seq + 1;
+	nlh = msg_begin(family, NLM_F_DUMP, SWITCH_CMD_GET_SWITCH);
+	if (!nlh)
+		return -3;
+	msg_end(nlh);
+	if (nl_send() || nl_recv(first, switch_cb, NULL))
+		return -3;
+
+	/* one LIST_PORT per switch, in the order of sws[] */
+	first = nl_seq + 1;
+	for (i = 0; i < sw_cnt; i++) {
+		sws[i].link_type = SWITCH_TYPE_UNSPEC;
+		nlh = msg_begin(family, NLM_F_ACK, SWITCH_CMD_LIST_PORT);
+		if (msg_put_u32(nlh, SWITCH_ATTR_ID, sws[i].id))
+			return -3;
+		msg_end(nlh);
+	}
+	if (nl_send() || nl_recv(first, port_attr_cb, NULL))
+		return -3;
+
+	/* no such switch or no "link" */
+	for (i = 0, cnt = 0; i < sw_cnt; i++) {
+		if (sws[i].id == UINT32_MAX ||
+		    sws[i].link_type == SWITCH_TYPE_UNSPEC)
+			continue;
+		sws[cnt++] = sws[i];
+	}
+	sw_cnt = cnt;
+done:
+	mapped = true;
+
+	return 0;
+}
+
+/* "port:1 link:up speed:1000baseT full-duplex ..." */
+static void parse_link_str(const char *str, struct portlink_ent *ent)
+{
+	const char *p;
+
+	ent->up = strstr(str, "link:up") != NULL;
+	if (ent->up && (p = strstr(str, "speed:")))
+		ent->speed = strtoul(p + strlen("speed:"), NULL, 10);
+}
+
+struct link_arg {
+	struct portlink_ent *ents;
+	bool stale;
+};
+
+static void link_cb(struct nlmsghdr *nlh, int idx, void *arg)
+{
+	struct nlattr *tb[_SWITCH_ATTR_MAX], *tb_link[_SWITCH_LINK_MAX];
+	struct link_arg *la = arg;
+	struct portlink_ent *ent = &la->ents[idx];
+	int err = nl_error(nlh);
+
+	if (err) {
+		/* the switch or the attribute is gone */
+		if (err == -ENOENT || err == -EINVAL || err == -EOPNOTSUPP)
+			la->stale = true;
+		return;
+	}
+	if (nlh->nlmsg_type != family)
+		return;
+	parse_genl(nlh, tb, _SWITCH_ATTR_MAX);
+	if (tb[SWITCH_ATTR_OP_VALUE_LINK]) {
+		parse_attrs(tb_link, _SWITCH_LINK_MAX,
+				nla_data(tb[SWITCH_ATTR_OP_VALUE_LINK]),
+				tb[SWITCH_ATTR_OP_VALUE_LINK]->nla_len - NLA_HDRLEN);
+		ent->up = tb_link[SWITCH_LINK_FLAG_LINK] != NULL;
+		if (ent->up && tb_link[SWITCH_LINK_SPEED])
+			ent->speed = nla_u32(tb_link[SWITCH_LINK_SPEED]);
+	} else if (tb[SWITCH_ATTR_OP_VALUE_STR]) {
+		parse_link_str(nla_data(tb[SWITCH_ATTR_OP_VALUE_STR]), ent);
+	}
+}
+
+/* query all ports at once, returns the number of entries */
+int portlink_get(struct portlink_ent *ents, int n)
+{
+	struct link_arg la = { .ents = ents };
+	struct nlmsghdr *nlh;
+	uint32_t first;
+	int i, j, cnt = 0;
+
+	if (!mapped && make_map()) {
+		portlink_close();
+		return -3;
+	}
+	if (!sw_cnt)
+		return 0;
+	if (nl_fd < 0 && nl_open())
+		return -3;
+
+	first = nl_seq + 1;
+	for (i = 0; i < sw_cnt; i++) {
+		for (j = 0; j < sws[i].port_cnt && cnt < n; j++, cnt++) {
+			memset(&ents[cnt], 0, sizeof(ents[cnt]));
+			strcpy(ents[cnt].sw, sws[i].name);
+			ents[cnt].port = sws[i].ports[j];
+
+			nlh = msg_begin(family, NLM_F_ACK, SWITCH_CMD_GET_PORT);
+			if (msg_put_u32(nlh, SWITCH_ATTR_ID, sws[i].id) ||
+			    msg_put_u32(nlh, SWITCH_ATTR_OP_ID, sws[i].link_id) ||
+			    msg_put_u32(nlh, SWITCH_ATTR_OP_PORT, sws[i].ports[j]))
+				return -3;
+			msg_end(nlh);
+		}
+	}
+	if (!cnt)
+		return 0;
+
+	if (nl_send() || nl_recv(first, link_cb, &la)) {
+		fprintf(stderr, "err: failed to get the link of the switch ports\n");
+		portlink_close();
+		return -3;
+	}
+	/* made again next time */
+	if (la.stale)
+		mapped = false;
+
+	return cnt;
+}
+
+/* store the port map to the buffer */
+void portlink_save(struct blob_buf *buf, const char *name)
+{
+	void *tbl, *tbl2, *ary;
+	int i, j;
+
+	if (!mapped)
+		return;
+
+	tbl = blobmsg_open_table(buf, name);
+	blobmsg_add_u32(buf, "family", family);
+	for (i = 0; i < sw_cnt; i++) {
+		tbl2 = blobmsg_open_table(buf, sws[i].name);
+		blobmsg_add_u32(buf, "id", sws[i].id);
+		blobmsg_add_u32(buf, "link", sws[i].link_id);
+		blobmsg_add_u32(buf, "type", sws[i].link_type);
+		ary = blobmsg_open_array(buf, "ports");
+		for (j = 0; j < sws[i].port_cnt; j++)
+			blobmsg_add_u32(buf, NULL, sws[i].ports[j]);
+		blobmsg_close_array(buf, ary);
+		blobmsg_close_table(buf, tbl2);
+	}
+	blobmsg_close_table(buf, tbl);
+}
+
+/* load the port map of the previous run unless made already */
+void portlink_load(struct blob_attr *attr)
+{
+	struct blob_attr *tb[_MAP_MAX], *tb_sw[_MAP_SW_MAX];
+	struct blob_attr *cur, *port;
+	struct portlink_sw *s;
+	unsigned rem, rem2;
+
+	if (mapped || !attr)
+		return;
+
+	blobmsg_parse(map_policy, _MAP_MAX, tb, blobmsg_data(attr),
+			blobmsg_data_len(attr));
+	if (!tb[MAP_FAMILY])
+		return;
+
+	sw_cnt = 0;
+	blobmsg_for_each_attr(cur, attr, rem) {
+		if (blobmsg_type(cur) != BLOBMSG_TYPE_TABLE ||
+		    sw_cnt >= PORTLINK_SW_MAX)
+			continue;
+		blobmsg_parse(map_sw_policy, _MAP_SW_MAX, tb_sw,
+				blobmsg_data(cur), blobmsg_data_len(cur));
+		if (!tb_sw[MAP_SW_ID] || !tb_sw[MAP_SW_LINK] ||
+		    !tb_sw[MAP_SW_TYPE] || !tb_sw[MAP_SW_PORTS])
+			continue;
+
+		s = &sws[sw_cnt];
+		memset(s, 0, sizeof(*s));
+		snprintf(s->name, sizeof(s->name), "%s", blobmsg_name(cur));
+		s->id = blobmsg_get_u32(tb_sw[MAP_SW_ID]);
+		s->link_id = blobmsg_get_u32(tb_sw[MAP_SW_LINK]);
+		s->link_type = blobmsg_get_u32(tb_sw[MAP_SW_TYPE]);
+		blobmsg_for_each_attr(port, tb_sw[MAP_SW_PORTS], rem2) {
+			if (blobmsg_type(port) != BLOBMSG_TYPE_INT32 ||
+			    s->port_cnt >= PORTLINK_PORT_MAX)
+				continue;
+			s->ports[s->port_cnt++] = blobmsg_get_u32(port);
+		}
+		sw_cnt++;
+	}
+	family = blobmsg_get_u32(tb[MAP_FAMILY]);
+	/*
+	 * swconfig without any switch mapped is made again, the map may be
+	 * made by the older version with the wrong attribute ids
+	 */
+	if (family && !sw_cnt)
+		return;
+	mapped = true;
+}
+
+void portlink_close(void)
+{
+	if (nl_fd >= 0) {
+		close(nl_fd);
+		nl_fd = -1;
+	}
+	mapped = false;
+}
@@ -0,0 +1,38 @@
+#ifndef PORTLINK_H
+#define PORTLINK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <libubox/blobmsg.h>
+
+#define PORTLINK_SW_MAX		4		/* swconfig switches in board.json */
+#define PORTLINK_PORT_MAX	16		/* external ports of a switch */
+#define PORTLINK_MAX		(PORTLINK_SW_MAX * PORTLINK_PORT_MAX)
+#define PORTLINK_NAME_LEN	16
+#define PORTLINK_NL_BUF_LEN	8192
+#define PORTLINK_TIMEOUT	1		/* s, a switch driver on MDIO */
+#define PORTLINK_BOARD_JSON	"/etc/board.json"
+
+struct portlink_ent {
+	char sw[PORTLINK_NAME_LEN];		/* "switch0" in board.json */
+	int port;
+	bool up;
+	int speed;						/* Mbps, 0: down or unknown */
+};
+
+#ifdef WITH_PORTLINK
+void portlink_load(struct blob_attr *attr);
+int portlink_get(struct portlink_ent *ents, int n);
+void portlink_save(struct blob_buf *buf, const char *name);
+void portlink_close(void);
+#else
+static inline void portlink_load(struct blob_attr *attr) {}
+static inline int portlink_get(struct portlink_ent *ents, int n)
+{
+	return 0;
+}
+static inline void portlink_save(struct blob_buf *buf, const char *name) {}
+static inline void portlink_close(void) {}
+#endif
+
+#endif
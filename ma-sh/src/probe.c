@@ -0,0 +1,578 @@
+/*
+ * active latency probes (ICMP echo, TCP connect and DNS query)
+ *
+ * All probes run in uloop of the resident collector, each target on its
+ * own interval (down to 100ms) with one probe in flight at a time, so the
+ * timeout is capped by the interval. The ICMP echoes of all targets share
+ * one raw socket (or an unprivileged ping socket as the fallback) and
+ * the replies are matched by the sequence, which carries the index of
+ * the target. TCP and DNS probes use a non-blocking socket per attempt.
+ * The RTTs are aggregated into min/avg/max/p95 and loss per target for
+ * each collection, p95 from a log-linear histogram (error < 3.2%) to
+ * count all RTTs of the window regardless of its length.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/ip_icmp.h>
+#include <libubox/uloop.h>
+
+#include "probe.h"
+#include "util.h"
+
+#define SEQ_IDX_SHIFT	11		/* 5 bits of the index, 11 bits of count */
+
+struct probe {
+	char name[PROBE_NAME_LEN];
+	int type;
+	struct sockaddr_in addr;
+	char qname[PROBE_TARGET_LEN];	/* DNS */
+	unsigned int interval_ms;
+	unsigned int timeout_ms;
+
+	/* in flight */
+	struct uloop_timeout timer;		/* next send */
+	struct uloop_timeout deadline;
+	struct uloop_fd fd;				/* TCP and DNS */
+	bool pending;
+	uint16_t seq;
+	uint64_t sent_us;
+
+	/* window */
+	unsigned int done;
+	unsigned int lost;
+	uint32_t rtt_min;				/* us */
+	uint32_t rtt_max;
+	uint64_t rtt_sum;
+	uint32_t hist[PROBE_HIST_LEN];
+};
+
+static const char * const type_names[] = {
+	[PROBE_ICMP] = "icmp",
+	[PROBE_TCP] = "tcp",
+	[PROBE_DNS] = "dns",
+};
+
+static struct probe probes[PROBE_MAX];
+static int probe_cnt;
+static struct uloop_fd icmp_fd = { .fd = -1 };
+static bool icmp_dgram = false;		/* no IP header, id set by the kernel */
+static uint16_t echo_id;
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* exact below 32us, then 16 buckets per power of 2 */
+static unsigned int hist_idx(uint32_t us)
+{
+	int msb;
+
+	if (us < (1 << PROBE_HIST_BITS))
+		return us;
+	msb = 31 - __builtin_clz(us);
+
+	return (msb - PROBE_HIST_BITS + 1) << PROBE_HIST_BITS |
+		((us >> (msb - PROBE_HIST_BITS)) & ((1 << PROBE_HIST_BITS) - 1));
+}
+
+/* the middle of the bucket */
+static uint32_t hist_val(unsigned int idx)
+{
+	int shift = (idx >> PROBE_HIST_BITS) - 1;
+
+	if (shift <= 0)
+		return idx;
+
+	return ((1 << PROBE_HIST_BITS | (idx & ((1 << PROBE_HIST_BITS) - 1)))
+			<< shift) + (1 << (shift - 1));
+}
+
+static void probe_result(struct probe *p, bool ok)
+{
+	uint32_t rtt;
+
+	uloop_timeout_cancel(&p->deadline);
+	if (p->fd.fd >= 0) {
+		uloop_fd_delete(&p->fd);
+		close(p->fd.fd);
+		p->fd.fd = -1;
+	}
+	p->pending = false;
+	p->done++;
+	if (!ok) {
+		p->lost++;
+		return;
+	}
+
+	rtt = now_us() - p->sent_us;
+	if (p->done - p->lost == 1 || rtt < p->rtt_min)
+		p->rtt_min = rtt;
+	if (rtt > p->rtt_max)
+		p->rtt_max = rtt;
+	p->rtt_sum += rtt;
+	p->hist[hist_idx(rtt)]++;
+}
+
+static uint16_t icmp_cksum(const void *data, size_t len)
+{
+	const uint16_t *p = data;
+	uint32_t sum = 0;
+
+	for (; len > 1; len -= 2)
+		sum += *p++;
+	if (len)
+		sum += *(const uint8_t *)p;
+	sum = (sum >> 16) + (sum & 0xffff);
+	sum += sum >> 16;
+
+	return ~sum;
+}
+
+static void icmp_cb(struct uloop_fd *fd, unsigned int events)
+{
+	char buf[256];
+	struct icmphdr *icmp;
+	struct probe *p;
+	ssize_t len;
+	size_t off;
+	int idx;
+
+	while ((len = recv(fd->fd, buf, sizeof(buf), 0)) > 0) {
+		off = 0;
+		if (!icmp_dgram) {
+			if (len < sizeof(struct iphdr))
+				continue;
+			off = ((struct iphdr *)buf)->ihl * 4;
+		}
+		if (len < off + sizeof(*icmp))
+			continue;
+		icmp = (struct icmphdr *)(buf + off);
+		/* the echo requests to 127.0.0.1 are received as well */
+		if (icmp->type != ICMP_ECHOREPLY ||
+		    (!icmp_dgram && icmp->un.echo.id != echo_id))
+			continue;
+
+		idx = ntohs(icmp->un.echo.sequence) >> SEQ_IDX_SHIFT;
+		if (idx >= probe_cnt)
+			continue;
+		p = &probes[idx];
+		if (p->pending && p->seq == ntohs(icmp->un.echo.sequence))
+			probe_result(p, true);
+	}
+}
+
+static int icmp_open(void)
+{
+	int fd;
+
+	fd = socket(AF_INET, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC,
+			IPPROTO_ICMP);
+	if (fd < 0 && (errno == EPERM || errno == EACCES)) {
+		/* net.ipv4.ping_group_range */
+		fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+				IPPROTO_ICMP);
+		icmp_dgram = true;
+	}
+	if (fd < 0) {
+		fprintf(stderr, "err: failed to open ICMP socket\n");
+		return -3;
+	}
+
+	echo_id = htons(getpid() & 0xffff);
+	icmp_fd.fd = fd;
+	icmp_fd.cb = icmp_cb;
+	uloop_fd_add(&icmp_fd, ULOOP_READ);
+
+	return 0;
+}
+
+static int send_icmp(struct probe *p)
+{
+	struct {
+		struct icmphdr hdr;
+		uint64_t ts;
+	} pkt;
+
+	if (icmp_fd.fd < 0 && icmp_open())
+		return -1;
+
+	memset(&pkt, 0, sizeof(pkt));
+	pkt.hdr.type = ICMP_ECHO;
+	pkt.hdr.un.echo.id = echo_id;
+	pkt.hdr.un.echo.sequence = htons(p->seq);
+	pkt.ts = p->sent_us;
+	pkt.hdr.checksum = icmp_cksum(&pkt, sizeof(pkt));
+
+	if (sendto(icmp_fd.fd, &pkt, sizeof(pkt), 0,
+		   (struct sockaddr *)&p->addr, sizeof(p->addr)) < 0)
+		return -1;
+
+	return 0;
+}
+
+static void tcp_cb(struct uloop_fd *fd, unsigned int events)
+{
+	struct probe *p = container_of(fd, struct probe, fd);
+	socklen_t len = sizeof(int);
+	int err = 0;
+
+	/* refused: reachable, but not the service */
+	getsockopt(fd->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+	probe_result(p, err == 0);
+}
+
+static int send_tcp(struct probe *p)
+{
+	int fd;
+
+	fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+	p->fd.fd = fd;
+	if (!connect(fd, (struct sockaddr *)&p->addr, sizeof(p->addr))) {
+		probe_result(p, true);
+		return 0;
+	}
+	if (errno != EINPROGRESS) {
+		probe_result(p, false);
+		return 0;
+	}
+
+	p->fd.cb = tcp_cb;
+	uloop_fd_add(&p->fd, ULOOP_WRITE);
+
+	return 0;
+}
+
+static void dns_cb(struct uloop_fd *fd, unsigned int events)
+{
+	struct probe *p = container_of(fd, struct probe, fd);
+	uint8_t buf[512];
+	ssize_t len;
+
+	while ((len = recv(fd->fd, buf, sizeof(buf), 0)) >= 0) {
+		/* any response of the query (QR) including NXDOMAIN */
+		if (len >= 12 && ((buf[0] << 8) | buf[1]) == p->seq &&
+		    (buf[2] & 0x80)) {
+			probe_result(p, true);
+			return;
+		}
+	}
+	/* ICMP port unreachable */
+	if (errno == ECONNREFUSED)
+		probe_result(p, false);
+}
+
+/* A query with RD, returns the length */
+static int build_query(struct probe *p, uint8_t *buf, size_t size)
+{
+	const char *label = p->qname, *dot;
+	size_t len = 12, l;
+
+	memset(buf, 0, 12);
+	buf[0] = p->seq >> 8;
+	buf[1] = p->seq & 0xff;
+	buf[2] = 0x01;			/* RD */
+	buf[5] = 1;				/* QDCOUNT */
+
+	while (*label) {
+		dot = strchr(label, '.');
+		l = dot ? dot - label : strlen(label);
+		if (l == 0 || l > 63 || len + l + 1 + 5 > size)
+			return -1;
+		buf[len++] = l;
+		memcpy(buf + len, label, l);
+		len += l;
+		label += l + (dot ? 1 : 0);
+	}
+	buf[len++] = 0;
+	buf[len++] = 0;
+	buf[len++] = 1;			/* A */
+	buf[len++] = 0;
+	buf[len++] = 1;			/* IN */
+
+	return len;
+}
+
+static int send_dns(struct probe *p)
+{
+	uint8_t buf[PROBE_TARGET_LEN + 18];
+	int fd, len;
+
+	len = build_query(p, buf, sizeof(buf));
+	if (len < 0)
+		return -1;
+
+	fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+	p->fd.fd = fd;
+	if (connect(fd, (struct sockaddr *)&p->addr, sizeof(p->addr)) ||
+	    send(fd, buf, len, 0) < 0) {
+		probe_result(p, false);
+		return 0;
+	}
+
+	p->fd.cb = dns_cb;
+	uloop_fd_add(&p->fd, ULOOP_READ);
+
+	return 0;
+}
+
+static void deadline_cb(struct uloop_timeout *t)
+{
+	probe_result(container_of(t, struct probe, deadline), false);
+}
+
+static void timer_cb(struct uloop_timeout *t)
+{
+	struct probe *p = container_of(t, struct probe, timer);
+	int ret = -1;
+
+	uloop_timeout_set(t, p->interval_ms);
+
+	/* not expected, the timeout is shorter than the interval */
+	if (p->pending)
+		probe_result(p, false);
+
+	p->seq = (p - probes) << SEQ_IDX_SHIFT |
+		((p->seq + 1) & ((1 << SEQ_IDX_SHIFT) - 1));
+	p->pending = true;
+	p->sent_us = now_us();
+	uloop_timeout_set(&p->deadline, p->timeout_ms);
+
+	errno = 0;
+	switch (p->type) {
+		case PROBE_ICMP:
+			ret = send_icmp(p);
+			break;
+		case PROBE_TCP:
+			ret = send_tcp(p);
+			break;
+		case PROBE_DNS:
+			ret = send_dns(p);
+			break;
+	}
+	if (ret) {
+		/* no route (ex.: WAN down) is a loss of the target */
+		if (errno == ENETUNREACH || errno == EHOSTUNREACH) {
+			probe_result(p, false);
+			return;
+		}
+		/* not counted, other local errors are not losses */
+		uloop_timeout_cancel(&p->deadline);
+		if (p->fd.fd >= 0) {
+			close(p->fd.fd);
+			p->fd.fd = -1;
+		}
+		p->pending = false;
+	}
+}
+
+static int resolve(const char *host, uint16_t port, struct sockaddr_in *sin)
+{
+	struct addrinfo hints = { .ai_family = AF_INET }, *res;
+
+	if (getaddrinfo(host, NULL, &hints, &res)) {
+		fprintf(stderr, "err: failed to resolve \"%s\"\n", host);
+		return -1;
+	}
+	memcpy(sin, res->ai_addr, sizeof(*sin));
+	sin->sin_port = htons(port);
+	freeaddrinfo(res);
+
+	return 0;
+}
+
+/* "host:port" -> host and port, returns -1 if no valid port */
+static int split_port(char *str, unsigned long *port)
+{
+	char *colon = strrchr(str, ':'), *eptr;
+
+	if (!colon)
+		return 0;
+	*colon = '\0';
+	*port = strtoul(colon + 1, &eptr, 10);
+
+	return (*eptr || !*port || *port > 65535) ? -1 : 0;
+}
+
+int probe_type(const char *type)
+{
+	int i;
+
+	for (i = 0; i < _PROBE_TYPE_MAX; i++) {
+		if (!strcmp(type, type_names[i]))
+			return i;
+	}
+
+	return -1;
+}
+
+int probe_add(const char *name, int type, const char *target,
+	      unsigned int interval_ms, unsigned int timeout_ms)
+{
+	char buf[PROBE_TARGET_LEN], *host = buf, *at;
+	unsigned long port = 0;
+	struct probe *p;
+
+	if (probe_cnt >= PROBE_MAX) {
+		fprintf(stderr, "warning: too many probes (max: %d), ignored\n",
+				PROBE_MAX);
+		return -1;
+	}
+	if (type < 0 || type >= _PROBE_TYPE_MAX ||
+	    strlen(target) >= sizeof(buf)) {
+		fprintf(stderr, "err: invalid probe \"%s\"\n", name);
+		return -1;
+	}
+
+	p = &probes[probe_cnt];
+	memset(p, 0, sizeof(*p));
+	snprintf(p->name, sizeof(p->name), "%s", name);
+	metric_sanitize(p->name);
+	p->type = type;
+	p->fd.fd = -1;
+	strcpy(buf, target);
+
+	switch (type) {
+		case PROBE_TCP:
+			if (split_port(host, &port) || !port) {
+				fprintf(stderr, "err: no port for the probe \"%s\"\n",
+						name);
+				return -1;
+			}
+			break;
+		case PROBE_DNS:
+			port = PROBE_DNS_PORT;
+			at = strchr(buf, '@');
+			if (at)
+				*at = '\0';
+			snprintf(p->qname, sizeof(p->qname), "%s", buf);
+			host = at ? at + 1 : PROBE_DNS_SERVER;
+			if (at && split_port(host, &port)) {
+				fprintf(stderr, "err: invalid server of the probe \"%s\"\n",
+						name);
+				return -1;
+			}
+			break;
+	}
+	if (resolve(host, port, &p->addr))
+		return -1;
+
+	p->interval_ms = interval_ms ? interval_ms : PROBE_INTERVAL_DEF;
+	if (p->interval_ms < PROBE_INTERVAL_MIN)
+		p->interval_ms = PROBE_INTERVAL_MIN;
+	p->timeout_ms = timeout_ms ? timeout_ms : p->interval_ms;
+	if (p->timeout_ms > p->interval_ms)
+		p->timeout_ms = p->interval_ms;
+	p->timer.cb = timer_cb;
+	p->deadline.cb = deadline_cb;
+	probe_cnt++;
+
+	return 0;
+}
+
+/* the sockets are opened in uloop */
+void probe_start(void)
+{
+	int i;
+
+	/* spread the first sends over the interval */
+	for (i = 0; i < probe_cnt; i++)
+		uloop_timeout_set(&probes[i].timer,
+				probes[i].interval_ms * i / probe_cnt);
+}
+
+/* nearest rank in the histogram, within min and max */
+static uint32_t hist_p95(const struct probe *p, unsigned int cnt)
+{
+	unsigned int rank = (cnt * 95 + 99) / 100, sum = 0, i;
+	uint32_t val = p->rtt_max;
+
+	for (i = 0; i < PROBE_HIST_LEN; i++) {
+		sum += p->hist[i];
+		if (sum >= rank) {
+			val = hist_val(i);
+			break;
+		}
+	}
+	if (val < p->rtt_min)
+		val = p->rtt_min;
+
+	return val < p->rtt_max ? val : p->rtt_max;
+}
+
+/*
+ * aggregate the window of all probes into ents and start the next one
+ * returns the number of entries
+ */
+int probe_get(struct probe_stat_ent *ents, int n)
+{
+	struct probe *p;
+	unsigned int recv;
+	int i;
+
+	for (i = 0; i < probe_cnt && i < n; i++) {
+		p = &probes[i];
+		memset(&ents[i], 0, sizeof(ents[i]));
+		strcpy(ents[i].name, p->name);
+		ents[i].done = p->done;
+		ents[i].lost = p->lost;
+		ents[i].loss = p->done ? p->lost * 100.0 / p->done : 0;
+
+		recv = p->done - p->lost;
+		if (recv) {
+			ents[i].has_rtt = true;
+			ents[i].rtt_min = p->rtt_min / 1000.0;
+			ents[i].rtt_max = p->rtt_max / 1000.0;
+			ents[i].rtt_avg = p->rtt_sum / 1000.0 / recv;
+			ents[i].rtt_p95 = hist_p95(p, recv) / 1000.0;
+		}
+
+		p->done = p->lost = 0;
+		p->rtt_min = p->rtt_max = 0;
+		p->rtt_sum = 0;
+		memset(p->hist, 0, sizeof(p->hist));
+	}
+
+	return i;
+}
+
+void probe_free_all(void)
+{
+	int i;
+
+	for (i = 0; i < probe_cnt; i++) {
+		uloop_timeout_cancel(&probes[i].timer);
+		uloop_timeout_cancel(&probes[i].deadline);
+		if (probes[i].fd.fd >= 0) {
+			uloop_fd_delete(&probes[i].fd);
+			close(probes[i].fd.fd);
+		}
+	}
+	probe_cnt = 0;
+
+	if (icmp_fd.fd >= 0) {
+		uloop_fd_delete(&icmp_fd);
+		close(icmp_fd.fd);
+		icmp_fd.fd = -1;
+	}
+	icmp_dgram = false;
+}
@@ -0,0 +1,61 @@
+#ifndef PROBE_H
+#define PROBE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define PROBE_MAX			32		/* index in the ICMP sequence */
+#define PROBE_NAME_LEN		32
+#define PROBE_TARGET_LEN	128
+#define PROBE_HIST_BITS		4		/* 16 buckets per power of 2 of the RTT */
+#define PROBE_HIST_LEN		((32 - PROBE_HIST_BITS + 1) << PROBE_HIST_BITS)
+#define PROBE_INTERVAL_DEF	1000	/* ms */
+#define PROBE_INTERVAL_MIN	100
+#define PROBE_DNS_PORT		53
+#define PROBE_DNS_SERVER	"127.0.0.1"
+
+enum {
+	PROBE_ICMP,			/* "<host>", IPv4 */
+	PROBE_TCP,			/* "<host>:<port>", connect() */
+	PROBE_DNS,			/* "<name>[@<server>[:<port>]]", A query */
+	_PROBE_TYPE_MAX,
+};
+
+/* aggregate of a window (since the previous probe_get()) */
+struct probe_stat_ent {
+	char name[PROBE_NAME_LEN];	/* sanitized */
+	unsigned int done;			/* answered or lost */
+	unsigned int lost;
+	double loss;				/* % */
+	bool has_rtt;				/* answered at least once */
+	double rtt_min;				/* ms */
+	double rtt_avg;
+	double rtt_max;
+	double rtt_p95;
+};
+
+#ifdef WITH_PROBE
+int probe_type(const char *type);
+int probe_add(const char *name, int type, const char *target,
+	      unsigned int interval_ms, unsigned int timeout_ms);
+void probe_start(void);
+int probe_get(struct probe_stat_ent *ents, int n);
+void probe_free_all(void);
+#else
+static inline int probe_type(const char *type) { return -1; }
+static inline int probe_add(const char *name, int type, const char *target,
+			    unsigned int interval_ms, unsigned int timeout_ms)
+{
+	fprintf(stderr, "err: probes are not supported in this build\n");
+	return -1;
+}
+static inline void probe_start(void) {}
+static inline int probe_get(struct probe_stat_ent *ents, int n)
+{
+	return 0;
+}
+static inline void probe_free_all(void) {}
+#endif
+
+#endif
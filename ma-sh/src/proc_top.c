@@ -0,0 +1,237 @@
+/*
+ * top-N processes by CPU time and RSS
+ *
+ * /proc is scanned once per interval with the directory handle kept open,
+ * and only /proc/<pid>/stat is read for each process (utime, stime and rss
+ * are all in it, so /proc/<pid>/statm is not needed). CPU time is computed
+ * incrementally against the pid -> ticks table of the previous scan, which
+ * is stored in the sysstat json like the "cpu" and "if" counters, with the
+ * time of the scan as pid "0".
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+
+#include "procfs.h"
+#include "proc_top.h"
+#include "util.h"
+
+struct proc_ent {
+	uint32_t pid;
+	uint64_t ticks;
+	uint64_t start;				/* clock ticks after boot */
+	uint64_t rss;
+	char name[PROC_COMM_LEN];
+};
+
+static DIR *proc_dir;
+static char stat_buf[512];
+static struct proc_ent procs[PROC_SCAN_MAX];
+static int proc_cnt;
+/* pid -> ticks, and the scan time as pid "0" */
+PREV_TABLE(prev, PROC_SCAN_MAX + 1, 1, PROC_PID_LEN, PROC_HASH_SIZE);
+static uint64_t scan_time, prev_scan_time;	/* clock ticks after boot */
+static long page_size, clk_tck;
+
+/* "1234 (comm) S 1 ..." -> utime (14), stime (15), starttime (22), rss (24) */
+static int parse_stat(const char *buf, struct proc_ent *ent)
+{
+	const char *p, *start, *end;
+	uint64_t val;
+	int field;
+
+	start = strchr(buf, '(');
+	end = strrchr(buf, ')');
+	if (!start || !end || end < start)
+		return -1;
+
+	/* comm (sanitized for the metric name) */
+	start++;
+	metric_sanitize_copy(ent->name, start, end - start, sizeof(ent->name));
+
+	/* skip " S " (state, field 3) */
+	p = end + 1;
+	while (*p == ' ')
+		p++;
+	if (*p == '\0')
+		return -1;
+	p++;
+
+	ent->ticks = 0;
+	for (field = 4; field <= 24; field++) {
+		/* priority and nice (18, 19) may be negative */
+		while (*p == ' ' || *p == '-')
+			p++;
+		if (!(p = procfs_parse_u64(p, &val)))
+			return -1;
+		if (field == 14 || field == 15)
+			ent->ticks += val;
+		else if (field == 22)
+			ent->start = val;
+	}
+	ent->rss = val * page_size;
+
+	return 0;
+}
+
+/* scan /proc/[0-9]+/stat, returns the number of processes */
+int proc_top_scan(void)
+{
+	struct timespec ts;
+	struct dirent *de;
+	char path[32];
+	ssize_t len;
+	int fd;
+
+	if (!proc_dir) {
+		if (!(proc_dir = opendir("/proc"))) {
+			fprintf(stderr, "err: failed to open \"/proc\"\n");
+			return -3;
+		}
+		page_size = sysconf(_SC_PAGESIZE);
+		clk_tck = sysconf(_SC_CLK_TCK);
+	} else {
+		rewinddir(proc_dir);
+	}
+
+	/* same clock as starttime */
+	clock_gettime(CLOCK_BOOTTIME, &ts);
+	scan_time = (uint64_t)ts.tv_sec * clk_tck +
+			(uint64_t)ts.tv_nsec * clk_tck / 1000000000;
+
+	proc_cnt = 0;
+	while ((de = readdir(proc_dir)) != NULL && proc_cnt < PROC_SCAN_MAX) {
+		if (de->d_name[0] < '1' || de->d_name[0] > '9')
+			continue;
+
+		snprintf(path, sizeof(path), "%s/stat", de->d_name);
+		fd = openat(dirfd(proc_dir), path, O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			continue;	/* already exited */
+		len = read(fd, stat_buf, sizeof(stat_buf) - 1);
+		close(fd);
+		if (len <= 0)
+			continue;
+		stat_buf[len] = '\0';
+
+		procs[proc_cnt].pid = strtoul(de->d_name, NULL, 10);
+		if (parse_stat(stat_buf, &procs[proc_cnt]))
+			continue;
+		proc_cnt++;
+	}
+
+	return proc_cnt;
+}
+
+/* store pid -> ticks table of the current scan to the buffer */
+void proc_top_save(struct blob_buf *buf, const char *name)
+{
+	char pid[PROC_PID_LEN];
+	void *tbl;
+	int i;
+
+	tbl = blobmsg_open_table(buf, name);
+	blobmsg_add_u64(buf, "0", scan_time);
+	for (i = 0; i < proc_cnt; i++) {
+		sprintf(pid, "%u", procs[i].pid);
+		blobmsg_add_u64(buf, pid, procs[i].ticks);
+	}
+	blobmsg_close_table(buf, tbl);
+}
+
+/* load pid -> ticks table of the previous scan */
+void proc_top_load(struct blob_attr *attr)
+{
+	const uint64_t *p;
+
+	prev_table_load(&prev, attr);
+	p = prev_table_find(&prev, "0", 1);
+	prev_scan_time = p ? *p : 0;
+}
+
+static int cmp_name(const void *a, const void *b)
+{
+	return strcmp(((const struct proc_top_ent *)a)->name,
+			((const struct proc_top_ent *)b)->name);
+}
+
+static int cmp_ticks(const void *a, const void *b)
+{
+	const struct proc_top_ent *x = a, *y = b;
+
+	return x->ticks < y->ticks ? 1 : x->ticks > y->ticks ? -1 : 0;
+}
+
+static int cmp_rss(const void *a, const void *b)
+{
+	const struct proc_top_ent *x = a, *y = b;
+
+	return x->rss < y->rss ? 1 : x->rss > y->rss ? -1 : 0;
+}
+
+/*
+ * get top n processes by CPU ticks (by_cpu) or RSS into ents
+ * processes with the same name (ex.: multiple dnsmasq) are summed up
+ * to keep the metric names stable, returns the number of entries
+ */
+int proc_top_get(struct proc_top_ent *ents, int n, bool by_cpu)
+{
+	static struct proc_top_ent agg[PROC_SCAN_MAX];
+	const uint64_t *p;
+	char pid[PROC_PID_LEN];
+	int i, cnt = 0;
+
+	if (by_cpu && !prev.loaded)
+		return 0;
+
+	for (i = 0; i < proc_cnt; i++) {
+		strcpy(agg[i].name, procs[i].name);
+		agg[i].rss = procs[i].rss;
+		agg[i].ticks = 0;
+		if (!by_cpu)
+			continue;
+
+		/*
+		 * processes not in the previous scan count all their ticks only
+		 * if started after it, others (ex.: dropped from a full table)
+		 * count nothing rather than their whole lifetime
+		 */
+		sprintf(pid, "%u", procs[i].pid);
+		p = prev_table_find(&prev, pid, 1);
+		if (!p) {
+			if (prev_scan_time && procs[i].start >= prev_scan_time)
+				agg[i].ticks = procs[i].ticks;
+		} else if (procs[i].ticks >= *p)
+			agg[i].ticks = procs[i].ticks - *p;
+	}
+
+	qsort(agg, proc_cnt, sizeof(*agg), cmp_name);
+	for (i = 0; i < proc_cnt; i++) {
+		if (cnt > 0 && !strcmp(agg[cnt - 1].name, agg[i].name)) {
+			agg[cnt - 1].ticks += agg[i].ticks;
+			agg[cnt - 1].rss += agg[i].rss;
+			continue;
+		}
+		agg[cnt++] = agg[i];
+	}
+
+	qsort(agg, cnt, sizeof(*agg), by_cpu ? cmp_ticks : cmp_rss);
+	if (n > cnt)
+		n = cnt;
+	memcpy(ents, agg, sizeof(*ents) * n);
+
+	return n;
+}
+
+void proc_top_close(void)
+{
+	if (proc_dir)
+		closedir(proc_dir);
+	proc_dir = NULL;
+}
@@ -0,0 +1,41 @@
+#ifndef PROC_TOP_H
+#define PROC_TOP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <libubox/blobmsg.h>
+
+#define PROC_SCAN_MAX	1024	/* upper limit of processes scanned per interval */
+#define PROC_HASH_SIZE	2048	/* must be power of 2 and > PROC_SCAN_MAX + 1 */
+#define PROC_COMM_LEN	16		/* TASK_COMM_LEN */
+#define PROC_PID_LEN	11		/* "4294967295" */
+#ifdef WITH_PROC_TOP
+#define PROC_TOP_DEF	5
+#else
+#define PROC_TOP_DEF	0
+#endif
+
+struct proc_top_ent {
+	char name[PROC_COMM_LEN];	/* sanitized comm */
+	uint64_t ticks;				/* delta from the previous scan */
+	uint64_t rss;				/* in bytes */
+};
+
+#ifdef WITH_PROC_TOP
+int proc_top_scan(void);
+void proc_top_save(struct blob_buf *buf, const char *name);
+void proc_top_load(struct blob_attr *attr);
+int proc_top_get(struct proc_top_ent *ents, int n, bool by_cpu);
+void proc_top_close(void);
+#else
+static inline int proc_top_scan(void) { return -1; }
+static inline void proc_top_save(struct blob_buf *buf, const char *name) {}
+static inline void proc_top_load(struct blob_attr *attr) {}
+static inline int proc_top_get(struct proc_top_ent *ents, int n, bool by_cpu)
+{
+	return 0;
+}
+static inline void proc_top_close(void) {}
+#endif
+
+#endif
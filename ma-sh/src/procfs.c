@@ -0,0 +1,360 @@
+/*
+ * allocation-light readers for /proc
+ *
+ * The files are opened once and kept open, every read is done by pread()
+ * from the offset 0 into the single static buffer, and the values are
+ * parsed by hand (no stdio, no strtok).
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <libubox/utils.h>
+
+#include "procfs.h"
+
+enum {
+	PROCFS_STAT,
+	PROCFS_CPUINFO,
+	PROCFS_MEMINFO,
+	PROCFS_LOADAVG,
+	PROCFS_NETDEV,
+	PROCFS_SELF_STATM,
+	_PROCFS_MAX,
+};
+
+static struct {
+	const char *path;
+	int fd;
+} procfs_files[] = {
+	[PROCFS_STAT] = { .path = "/proc/stat", .fd = -1 },
+	[PROCFS_CPUINFO] = { .path = "/proc/cpuinfo", .fd = -1 },
+	[PROCFS_MEMINFO] = { .path = "/proc/meminfo", .fd = -1 },
+	[PROCFS_LOADAVG] = { .path = "/proc/loadavg", .fd = -1 },
+	[PROCFS_NETDEV] = { .path = "/proc/net/dev", .fd = -1 },
+	[PROCFS_SELF_STATM] = { .path = "/proc/self/statm", .fd = -1 },
+};
+
+static char procfs_buf[PROCFS_BUF_LEN];
+
+/*
+ * read the whole file into procfs_buf and terminate it
+ * returns the length of the contents, or -1 on error
+ */
+static int procfs_read(int idx)
+{
+	int fd = procfs_files[idx].fd;
+	ssize_t len, total = 0;
+
+	if (fd < 0) {
+		fd = open(procfs_files[idx].path, O_RDONLY | O_CLOEXEC);
+		if (fd < 0) {
+			fprintf(stderr, "err: failed to open \"%s\"\n",
+					procfs_files[idx].path);
+			return -1;
+		}
+		procfs_files[idx].fd = fd;
+	}
+
+	/* seq_file may return less than requested, loop until EOF */
+	while (total < sizeof(procfs_buf) - 1) {
+		len = pread(fd, procfs_buf + total,
+				sizeof(procfs_buf) - 1 - total, total);
+		if (len < 0) {
+			fprintf(stderr, "err: failed to read \"%s\"\n",
+					procfs_files[idx].path);
+			return -1;
+		}
+		if (len == 0)
+			break;
+		total += len;
+	}
+	procfs_buf[total] = '\0';
+
+	return total;
+}
+
+static const char *skip_space(const char *p)
+{
+	while (*p == ' ' || *p == '\t')
+		p++;
+
+	return p;
+}
+
+static const char *next_line(const char *p)
+{
+	while (*p != '\0' && *p != '\n')
+		p++;
+
+	return *p == '\n' ? p + 1 : p;
+}
+
+/*
+ * parse a decimal integer with leading spaces
+ * returns the pointer after the digits, or NULL if no digits
+ */
+const char *procfs_parse_u64(const char *p, uint64_t *val)
+{
+	uint64_t tmp = 0;
+
+	p = skip_space(p);
+	if (*p < '0' || *p > '9')
+		return NULL;
+	while (*p >= '0' && *p <= '9')
+		tmp = tmp * 10 + (*p++ - '0');
+	*val = tmp;
+
+	return p;
+}
+
+/* parse "x.yy" in /proc/loadavg */
+static const char *parse_load(const char *p, double *val)
+{
+	uint64_t ip, fp = 0, div = 1;
+
+	p = procfs_parse_u64(p, &ip);
+	if (!p)
+		return NULL;
+	if (*p == '.') {
+		p++;
+		while (*p >= '0' && *p <= '9') {
+			fp = fp * 10 + (*p++ - '0');
+			div *= 10;
+		}
+	}
+	*val = ip + (double)fp / div;
+
+	return p;
+}
+
+/* get values of the "cpu" line in /proc/stat (_PROCFS_CPU_MAX entries) */
+int procfs_read_stat_cpu(uint64_t *val)
+{
+	const char *p;
+	int i;
+
+	if (procfs_read(PROCFS_STAT) < 0)
+		return -3;
+
+	if (strncmp(procfs_buf, "cpu ", 4)) {
+		fprintf(stderr, "err: failed to get cpu stat\n");
+		return -3;
+	}
+	p = procfs_buf + 4;
+	for (i = 0; i < _PROCFS_CPU_MAX; i++) {
+		/* older kernels don't have some columns */
+		if (!(p = procfs_parse_u64(p, &val[i])))
+			break;
+	}
+	for (; i < _PROCFS_CPU_MAX; i++)
+		val[i] = 0;
+
+	return 0;
+}
+
+/*
+ * count "processor" lines in /proc/cpuinfo
+ *   WZR-900DHP (BCM47081): "processor\t:"
+ *   ETG3-R (AR9342)/WN-DX1167R (MT7621A): "processor\t\t:"
+ */
+int procfs_count_cpus(void)
+{
+	const char *p;
+	int cnt = 0;
+
+	if (procfs_read(PROCFS_CPUINFO) < 0)
+		return -3;
+
+	for (p = procfs_buf; *p != '\0'; p = next_line(p)) {
+		if (strncmp(p, "processor", 9))
+			continue;
+		if (*skip_space(p + 9) == ':')
+			cnt++;
+	}
+
+	return cnt;
+}
+
+static const struct {
+	const char *key;
+	size_t offset;
+} meminfo_keys[] = {
+	{ "MemTotal", offsetof(struct procfs_meminfo, total) },
+	{ "MemFree", offsetof(struct procfs_meminfo, free) },
+	{ "MemAvailable", offsetof(struct procfs_meminfo, available) },
+	{ "Buffers", offsetof(struct procfs_meminfo, buffers) },
+	{ "Cached", offsetof(struct procfs_meminfo, cached) },
+	{ "SwapCached", offsetof(struct procfs_meminfo, swap_cached) },
+	{ "SwapTotal", offsetof(struct procfs_meminfo, swap_total) },
+	{ "SwapFree", offsetof(struct procfs_meminfo, swap_free) },
+	{ "Shmem", offsetof(struct procfs_meminfo, shmem) },
+};
+
+int procfs_read_meminfo(struct procfs_meminfo *mi)
+{
+	const char *p, *val;
+	uint64_t tmp;
+	size_t klen;
+	int i, found = 0;
+
+	if (procfs_read(PROCFS_MEMINFO) < 0)
+		return -3;
+
+	memset(mi, 0, sizeof(*mi));
+	for (p = procfs_buf; *p != '\0' && found < ARRAY_SIZE(meminfo_keys);
+	     p = next_line(p)) {
+		for (i = 0; i < ARRAY_SIZE(meminfo_keys); i++) {
+			klen = strlen(meminfo_keys[i].key);
+			if (strncmp(p, meminfo_keys[i].key, klen) || p[klen] != ':')
+				continue;
+			val = procfs_parse_u64(p + klen + 1, &tmp);
+			if (!val)
+				break;
+			/* all values are in kB */
+			*(uint64_t *)((char *)mi + meminfo_keys[i].offset) = tmp * 1024;
+			found++;
+			break;
+		}
+	}
+
+	if (!mi->total) {
+		fprintf(stderr, "err: failed to parse \"/proc/meminfo\"\n");
+		return -1;
+	}
+	/* before Linux 3.14 */
+	if (!mi->available)
+		mi->available = mi->free + mi->buffers + mi->cached;
+
+	return 0;
+}
+
+/* "0.12 0.34 0.56 1/89 1234" */
+int procfs_read_loadavg(struct procfs_loadavg *la)
+{
+	const char *p = procfs_buf;
+	uint64_t tmp;
+	int i;
+
+	if (procfs_read(PROCFS_LOADAVG) < 0)
+		return -3;
+
+	for (i = 0; i < 3; i++) {
+		if (!(p = parse_load(p, &la->load[i])))
+			goto err;
+	}
+	if (!(p = procfs_parse_u64(p, &tmp)) || *p != '/')
+		goto err;
+	la->running = tmp;
+	if (!(p = procfs_parse_u64(p + 1, &tmp)))
+		goto err;
+	la->total = tmp;
+
+	return 0;
+
+err:
+	fprintf(stderr, "err: failed to parse \"/proc/loadavg\"\n");
+	return -1;
+}
+
+/*
+ *  face |bytes packets errs drop fifo frame compressed multicast|bytes ...
+ *  eth0: 1234 ...
+ * returns the number of devices stored to devs
+ */
+int procfs_read_netdev(struct procfs_netdev *devs, int max)
+{
+	const char *p, *name, *colon;
+	uint64_t val[16];
+	int i, cnt = 0;
+	size_t len;
+
+	if (procfs_read(PROCFS_NETDEV) < 0)
+		return -3;
+
+	/* skip 2 header lines */
+	p = next_line(next_line(procfs_buf));
+	for (; *p != '\0' && cnt < max; p = next_line(p)) {
+		name = skip_space(p);
+		for (colon = name; *colon != ':' && *colon != '\n' && *colon != '\0';
+		     colon++);
+		if (*colon != ':')
+			continue;
+		len = colon - name;
+		if (len == 0 || len >= NETDEV_NAME_LEN)
+			continue;
+
+		p = colon + 1;
+		for (i = 0; i < ARRAY_SIZE(val); i++) {
+			if (!(p = procfs_parse_u64(p, &val[i])))
+				break;
+		}
+		if (i < ARRAY_SIZE(val)) {
+			p = colon;
+			continue;
+		}
+
+		memcpy(devs[cnt].name, name, len);
+		devs[cnt].name[len] = '\0';
+		devs[cnt].rx_bytes = val[0];
+		devs[cnt].rx_packets = val[1];
+		devs[cnt].rx_errs = val[2];
+		devs[cnt].rx_drop = val[3];
+		devs[cnt].tx_bytes = val[8];
+		devs[cnt].tx_packets = val[9];
+		devs[cnt].tx_errs = val[10];
+		devs[cnt].tx_drop = val[11];
+		cnt++;
+	}
+
+	return cnt;
+}
+
+const struct procfs_netdev *
+procfs_find_netdev(const struct procfs_netdev *devs, int cnt, const char *name)
+{
+	int i;
+
+	for (i = 0; i < cnt; i++) {
+		if (!strcmp(devs[i].name, name))
+			return &devs[i];
+	}
+
+	return NULL;
+}
+
+/* RSS of ma-tools itself (in bytes) */
+int procfs_read_self_rss(uint64_t *rss)
+{
+	const char *p = procfs_buf;
+	uint64_t pages;
+
+	if (procfs_read(PROCFS_SELF_STATM) < 0)
+		return -3;
+
+	/* "size resident shared ..." (in pages) */
+	if (!(p = procfs_parse_u64(p, &pages)) ||
+	    !(p = procfs_parse_u64(p, &pages))) {
+		fprintf(stderr, "err: failed to parse \"/proc/self/statm\"\n");
+		return -1;
+	}
+	*rss = pages * sysconf(_SC_PAGESIZE);
+
+	return 0;
+}
+
+void procfs_close(void)
+{
+	int i;
+
+	for (i = 0; i < _PROCFS_MAX; i++) {
+		if (procfs_files[i].fd < 0)
+			continue;
+		close(procfs_files[i].fd);
+		procfs_files[i].fd = -1;
+	}
+}
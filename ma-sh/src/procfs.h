@@ -0,0 +1,68 @@
+#ifndef PROCFS_H
+#define PROCFS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define PROCFS_BUF_LEN	16384	/* enough for /proc/net/dev with ~100 devices */
+#define NETDEV_MAX		64
+#define NETDEV_NAME_LEN	16		/* IFNAMSIZ */
+
+/* /proc/stat -> "cpu" line */
+enum {
+	PROCFS_CPU_USR,
+	PROCFS_CPU_NIC,
+	PROCFS_CPU_SYS,
+	PROCFS_CPU_IDLE,
+	PROCFS_CPU_IO,
+	PROCFS_CPU_IRQ,
+	PROCFS_CPU_SIRQ,
+	PROCFS_CPU_ST,
+	_PROCFS_CPU_MAX,
+};
+
+/* /proc/meminfo (all values in bytes) */
+struct procfs_meminfo {
+	uint64_t total;
+	uint64_t free;
+	uint64_t available;
+	uint64_t buffers;
+	uint64_t cached;
+	uint64_t shmem;
+	uint64_t swap_cached;
+	uint64_t swap_total;
+	uint64_t swap_free;
+};
+
+/* /proc/loadavg */
+struct procfs_loadavg {
+	double load[3];			/* 1, 5, 15 min */
+	unsigned int running;
+	unsigned int total;
+};
+
+/* /proc/net/dev */
+struct procfs_netdev {
+	char name[NETDEV_NAME_LEN];
+	uint64_t rx_bytes;
+	uint64_t rx_packets;
+	uint64_t rx_errs;
+	uint64_t rx_drop;
+	uint64_t tx_bytes;
+	uint64_t tx_packets;
+	uint64_t tx_errs;
+	uint64_t tx_drop;
+};
+
+const char *procfs_parse_u64(const char *p, uint64_t *val);
+int procfs_read_stat_cpu(uint64_t *val);
+int procfs_count_cpus(void);
+int procfs_read_meminfo(struct procfs_meminfo *mi);
+int procfs_read_loadavg(struct procfs_loadavg *la);
+int procfs_read_netdev(struct procfs_netdev *devs, int max);
+const struct procfs_netdev *
+procfs_find_netdev(const struct procfs_netdev *devs, int cnt, const char *name);
+int procfs_read_self_rss(uint64_t *rss);
+void procfs_close(void);
+
+#endif
@@ -0,0 +1,455 @@
+/*
+ * queueing discipline statistics for SQM (cake, fq_codel, htb, ...)
+ *
+ * One RTM_GETQDISC dump per collection returns TCA_STATS2 of all qdiscs
+ * on all devices, with the xstats (TCA_STATS_APP) of cake and fq_codel,
+ * so `tc -s qdisc` is not needed. The per-tin statistics of cake are in
+ * its xstats and reported as separate entries; classes are not dumped,
+ * as RTM_GETTCLASS needs one request per device and the leaf qdiscs of
+ * SQM (simple.qos) are in the qdisc dump already. The children of mq
+ * are skipped, mq itself reports their sum. Like the "port" counters,
+ * the counters of the previous scan are stored in the sysstat json.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/pkt_sched.h>
+#include <linux/gen_stats.h>
+
+#include "qdisc_stat.h"
+#include "util.h"
+
+struct qdisc_if {
+	int index;
+	char name[IF_NAMESIZE];
+};
+
+/* mq roots in the dump, their children are skipped */
+struct qdisc_mq {
+	int index;
+	uint32_t handle;
+};
+
+static const char * const val_names[] = {
+	[QDISC_BYTES] = "bytes",
+	[QDISC_PACKETS] = "packets",
+	[QDISC_DROPS] = "drops",
+	[QDISC_OVERLIMITS] = "overlimits",
+	[QDISC_REQUEUES] = "requeues",
+	[QDISC_ECN_MARKS] = "ecnMarks",
+	[QDISC_BACKLOG] = "backlog",
+	[QDISC_QLEN] = "qlen",
+	[QDISC_PEAK_DELAY] = "peakDelayUs",
+	[QDISC_AVG_DELAY] = "avgDelayUs",
+	[QDISC_BASE_DELAY] = "baseDelayUs",
+};
+
+#define VALID(v)	(1U << (v))
+
+static int nl_fd = -1;
+static uint32_t nl_seq;
+static char nl_buf[QDISC_NL_BUF_LEN] __attribute__((aligned(NLMSG_ALIGNTO)));
+static struct qdisc_stat_ent cur[QDISC_STAT_MAX];
+static int cur_cnt;
+static int dump_cnt, last_dump_cnt;
+static struct qdisc_mq mqs[QDISC_IF_MAX];
+static int mq_cnt;
+static struct qdisc_if ifs[QDISC_IF_MAX];
+static int if_cnt;
+PREV_TABLE(prev, QDISC_STAT_MAX, _QDISC_CNT_MAX, QDISC_LABEL_LEN,
+	   QDISC_STAT_MAX * 2);
+
+static int nl_open(void)
+{
+	struct sockaddr_nl sa = { .nl_family = AF_NETLINK };
+
+	nl_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if (nl_fd < 0) {
+		fprintf(stderr, "err: failed to open rtnetlink socket\n");
+		return -3;
+	}
+	if (bind(nl_fd, (struct sockaddr *)&sa, sizeof(sa))) {
+		fprintf(stderr, "err: failed to bind rtnetlink socket\n");
+		close(nl_fd);
+		nl_fd = -1;
+		return -3;
+	}
+
+	return 0;
+}
+
+static int nl_dump_qdisc(void)
+{
+	struct {
+		struct nlmsghdr nlh;
+		struct tcmsg tcm;
+	} req;
+
+	memset(&req, 0, sizeof(req));
+	req.nlh.nlmsg_len = sizeof(req);
+	req.nlh.nlmsg_type = RTM_GETQDISC;
+	req.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	req.nlh.nlmsg_seq = ++nl_seq;
+	req.tcm.tcm_family = AF_UNSPEC;
+
+	if (send(nl_fd, &req, sizeof(req), 0) < 0)
+		return -3;
+
+	return 0;
+}
+
+/*
+ * ifindex -> name, cached as ifindexes are not reused by the kernel;
+ * the cache is dropped when the number of qdiscs changes, which is the
+ * case for the devices added, removed and usually renamed (re-created)
+ */
+static const char *if_name(int index)
+{
+	struct qdisc_if *i;
+
+	for (i = ifs; i < ifs + if_cnt; i++) {
+		if (i->index == index)
+			return i->name;
+	}
+	if (if_cnt >= QDISC_IF_MAX)
+		if_cnt = 0;
+	i = &ifs[if_cnt];
+	if (!if_indextoname(index, i->name))
+		return NULL;
+	i->index = index;
+	if_cnt++;
+
+	return i->name;
+}
+
+static uint32_t rta_u32(struct rtattr *rta)
+{
+	return RTA_PAYLOAD(rta) >= 4 ? *(uint32_t *)RTA_DATA(rta) : 0;
+}
+
+static uint64_t rta_u64(struct rtattr *rta)
+{
+	uint64_t val = 0;
+
+	/* may be unaligned for 64bit access */
+	if (RTA_PAYLOAD(rta) >= 8)
+		memcpy(&val, RTA_DATA(rta), sizeof(val));
+
+	return val;
+}
+
+static struct qdisc_stat_ent *new_ent(void)
+{
+	struct qdisc_stat_ent *e;
+
+	if (cur_cnt >= QDISC_STAT_MAX)
+		return NULL;
+	e = &cur[cur_cnt++];
+	memset(e, 0, sizeof(*e));
+
+	return e;
+}
+
+static void parse_cake_tin(struct rtattr *tin, struct qdisc_stat_ent *q)
+{
+	struct qdisc_stat_ent *e;
+	struct rtattr *rta;
+	int len = RTA_PAYLOAD(tin);
+
+	e = new_ent();
+	if (!e)
+		return;
+	snprintf(e->label, sizeof(e->label), "%s_tin%d", q->label,
+			tin->rta_type - 1);
+	strcpy(e->kind, q->kind);
+	e->is_tin = true;
+
+	for (rta = RTA_DATA(tin); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		switch (rta->rta_type) {
+			case TCA_CAKE_TIN_STATS_SENT_BYTES64:
+				e->val[QDISC_BYTES] = rta_u64(rta);
+				e->valid |= VALID(QDISC_BYTES);
+				break;
+			case TCA_CAKE_TIN_STATS_SENT_PACKETS:
+				e->val[QDISC_PACKETS] = rta_u32(rta);
+				e->valid |= VALID(QDISC_PACKETS);
+				break;
+			case TCA_CAKE_TIN_STATS_DROPPED_PACKETS:
+				e->val[QDISC_DROPS] = rta_u32(rta);
+				e->valid |= VALID(QDISC_DROPS);
+				break;
+			case TCA_CAKE_TIN_STATS_ECN_MARKED_PACKETS:
+				e->val[QDISC_ECN_MARKS] = rta_u32(rta);
+				e->valid |= VALID(QDISC_ECN_MARKS);
+				/* the qdisc reports the sum of the tins */
+				q->val[QDISC_ECN_MARKS] += e->val[QDISC_ECN_MARKS];
+				q->valid |= VALID(QDISC_ECN_MARKS);
+				break;
+			case TCA_CAKE_TIN_STATS_BACKLOG_BYTES:
+				e->val[QDISC_BACKLOG] = rta_u32(rta);
+				e->valid |= VALID(QDISC_BACKLOG);
+				break;
+			case TCA_CAKE_TIN_STATS_PEAK_DELAY_US:
+				e->val[QDISC_PEAK_DELAY] = rta_u32(rta);
+				e->valid |= VALID(QDISC_PEAK_DELAY);
+				break;
+			case TCA_CAKE_TIN_STATS_AVG_DELAY_US:
+				e->val[QDISC_AVG_DELAY] = rta_u32(rta);
+				e->valid |= VALID(QDISC_AVG_DELAY);
+				break;
+			case TCA_CAKE_TIN_STATS_BASE_DELAY_US:
+				e->val[QDISC_BASE_DELAY] = rta_u32(rta);
+				e->valid |= VALID(QDISC_BASE_DELAY);
+				break;
+		}
+	}
+}
+
+static void parse_xstats(struct rtattr *app, struct qdisc_stat_ent *e)
+{
+	struct tc_fq_codel_xstats fq;
+	struct rtattr *rta, *tin;
+	int len = RTA_PAYLOAD(app), len2, tins = 0;
+
+	if (!strcmp(e->kind, "fq_codel")) {
+		if (len < sizeof(fq))
+			return;
+		memcpy(&fq, RTA_DATA(app), sizeof(fq));
+		if (fq.type != TCA_FQ_CODEL_XSTATS_QDISC)
+			return;
+		e->val[QDISC_ECN_MARKS] = fq.qdisc_stats.ecn_mark;
+		e->valid |= VALID(QDISC_ECN_MARKS);
+	} else if (!strcmp(e->kind, "cake")) {
+		for (rta = RTA_DATA(app); RTA_OK(rta, len);
+		     rta = RTA_NEXT(rta, len)) {
+			if (rta->rta_type != TCA_CAKE_STATS_TIN_STATS)
+				continue;
+			len2 = RTA_PAYLOAD(rta);
+			for (tin = RTA_DATA(rta); RTA_OK(tin, len2) &&
+			     tins < QDISC_TIN_MAX; tin = RTA_NEXT(tin, len2)) {
+				parse_cake_tin(tin, e);
+				tins++;
+			}
+		}
+	}
+}
+
+static void parse_stats2(struct rtattr *stats, struct qdisc_stat_ent *e)
+{
+	struct gnet_stats_basic bs;
+	struct gnet_stats_queue qs;
+	struct rtattr *rta, *app = NULL;
+	int len = RTA_PAYLOAD(stats);
+
+	for (rta = RTA_DATA(stats); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		switch (rta->rta_type) {
+			case TCA_STATS_BASIC:
+				memset(&bs, 0, sizeof(bs));
+				memcpy(&bs, RTA_DATA(rta),
+					RTA_PAYLOAD(rta) < sizeof(bs) ?
+					RTA_PAYLOAD(rta) : sizeof(bs));
+				e->val[QDISC_BYTES] = bs.bytes;
+				/* unless TCA_STATS_PKT64 is given */
+				if (!(e->valid & VALID(QDISC_PACKETS)))
+					e->val[QDISC_PACKETS] = bs.packets;
+				e->valid |= VALID(QDISC_BYTES) | VALID(QDISC_PACKETS);
+				break;
+			case TCA_STATS_PKT64:
+				e->val[QDISC_PACKETS] = rta_u64(rta);
+				e->valid |= VALID(QDISC_PACKETS);
+				break;
+			case TCA_STATS_QUEUE:
+				if (RTA_PAYLOAD(rta) < sizeof(qs))
+					break;
+				memcpy(&qs, RTA_DATA(rta), sizeof(qs));
+				e->val[QDISC_DROPS] = qs.drops;
+				e->val[QDISC_OVERLIMITS] = qs.overlimits;
+				e->val[QDISC_REQUEUES] = qs.requeues;
+				e->val[QDISC_BACKLOG] = qs.backlog;
+				e->val[QDISC_QLEN] = qs.qlen;
+				e->valid |= VALID(QDISC_DROPS) | VALID(QDISC_OVERLIMITS) |
+					VALID(QDISC_REQUEUES) | VALID(QDISC_BACKLOG) |
+					VALID(QDISC_QLEN);
+				break;
+			case TCA_STATS_APP:
+				app = rta;
+				break;
+		}
+	}
+
+	/* after the qdisc itself, the tins follow it */
+	if (app)
+		parse_xstats(app, e);
+}
+
+static bool is_mq_child(int index, uint32_t parent)
+{
+	int i;
+
+	for (i = 0; i < mq_cnt; i++) {
+		if (mqs[i].index == index &&
+		    mqs[i].handle == TC_H_MAJ(parent))
+			return true;
+	}
+
+	return false;
+}
+
+static void parse_qdisc(struct nlmsghdr *nlh)
+{
+	struct tcmsg *tcm = NLMSG_DATA(nlh);
+	struct qdisc_stat_ent *e;
+	struct rtattr *rta, *stats = NULL;
+	const char *kind = NULL, *ifname;
+	int len = nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*tcm));
+
+	dump_cnt++;
+	for (rta = TCA_RTA(tcm); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		if (rta->rta_type == TCA_KIND)
+			kind = RTA_DATA(rta);
+		else if (rta->rta_type == TCA_STATS2)
+			stats = rta;
+	}
+	if (!kind || !stats)
+		return;
+
+	/* nothing queued or summed up in mq */
+	if (!strcmp(kind, "noqueue") || !strcmp(kind, "ingress") ||
+	    !strcmp(kind, "clsact") || is_mq_child(tcm->tcm_ifindex,
+						  tcm->tcm_parent))
+		return;
+	if (!strcmp(kind, "mq") && mq_cnt < QDISC_IF_MAX) {
+		mqs[mq_cnt].index = tcm->tcm_ifindex;
+		mqs[mq_cnt++].handle = tcm->tcm_handle;
+	}
+
+	ifname = if_name(tcm->tcm_ifindex);
+	if (!ifname)
+		return;
+	e = new_ent();
+	if (!e)
+		return;
+	snprintf(e->kind, sizeof(e->kind), "%s", kind);
+	if (tcm->tcm_parent == TC_H_ROOT)
+		snprintf(e->label, sizeof(e->label), "%s", ifname);
+	else
+		snprintf(e->label, sizeof(e->label), "%s_%x_%x", ifname,
+				TC_H_MAJ(tcm->tcm_parent) >> 16,
+				TC_H_MIN(tcm->tcm_parent));
+	metric_sanitize(e->label);
+
+	parse_stats2(stats, e);
+}
+
+/* receive the dump until NLMSG_DONE */
+static int nl_recv_qdisc(void)
+{
+	struct nlmsghdr *nlh;
+	ssize_t len;
+
+	cur_cnt = 0;
+	dump_cnt = 0;
+	mq_cnt = 0;
+	for (;;) {
+		len = recv(nl_fd, nl_buf, sizeof(nl_buf), 0);
+		if (len < 0)
+			return -3;
+
+		for (nlh = (struct nlmsghdr *)nl_buf; NLMSG_OK(nlh, len);
+		     nlh = NLMSG_NEXT(nlh, len)) {
+			if (nlh->nlmsg_seq != nl_seq)
+				continue;
+			if (nlh->nlmsg_type == NLMSG_DONE)
+				return 0;
+			if (nlh->nlmsg_type == NLMSG_ERROR)
+				return -3;
+			if (nlh->nlmsg_type == RTM_NEWQDISC)
+				parse_qdisc(nlh);
+		}
+	}
+}
+
+/* dump the qdiscs, returns the number of entries (qdiscs and tins) */
+int qdisc_stat_scan(void)
+{
+	if (nl_fd < 0 && nl_open())
+		return -3;
+
+	if (nl_dump_qdisc() || nl_recv_qdisc()) {
+		fprintf(stderr, "err: failed to dump qdiscs\n");
+		/* re-open with the new sequence next time */
+		qdisc_stat_close();
+		return -3;
+	}
+	if (dump_cnt != last_dump_cnt) {
+		/* resolved again on the next scan */
+		if_cnt = 0;
+		last_dump_cnt = dump_cnt;
+	}
+
+	return cur_cnt;
+}
+
+/* store label -> [counters] table of the current scan to the buffer */
+void qdisc_stat_save(struct blob_buf *buf, const char *name)
+{
+	void *tbl;
+	int i;
+
+	tbl = blobmsg_open_table(buf, name);
+	for (i = 0; i < cur_cnt; i++)
+		prev_table_add(buf, cur[i].label, cur[i].val, _QDISC_CNT_MAX);
+	blobmsg_close_table(buf, tbl);
+}
+
+/* load label -> [counters] table of the previous scan */
+void qdisc_stat_load(struct blob_attr *attr)
+{
+	prev_table_load(&prev, attr);
+}
+
+/*
+ * get the entries of the current scan into ents, the counters are the
+ * deltas if the entry was in the previous scan
+ * returns the number of entries
+ */
+int qdisc_stat_get(struct qdisc_stat_ent *ents, int n)
+{
+	const uint64_t *p;
+	int i, j;
+
+	for (i = 0; i < cur_cnt && i < n; i++) {
+		ents[i] = cur[i];
+		p = prev_table_find(&prev, cur[i].label, _QDISC_CNT_MAX);
+		ents[i].has_delta = p != NULL;
+		for (j = 0; j < _QDISC_CNT_MAX; j++) {
+			/* qdisc replaced (SQM restarted) since the previous scan */
+			if (!p || cur[i].val[j] < p[j])
+				ents[i].val[j] = 0;
+			else
+				ents[i].val[j] = cur[i].val[j] - p[j];
+		}
+	}
+
+	return i;
+}
+
+const char *qdisc_stat_val_name(int val)
+{
+	return val_names[val];
+}
+
+void qdisc_stat_close(void)
+{
+	if (nl_fd < 0)
+		return;
+	close(nl_fd);
+	nl_fd = -1;
+}
@@ -0,0 +1,60 @@
+#ifndef QDISC_STAT_H
+#define QDISC_STAT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <libubox/blobmsg.h>
+
+#define QDISC_STAT_MAX		32		/* qdiscs and cake tins reported */
+#define QDISC_KIND_LEN		16
+#define QDISC_LABEL_LEN		32		/* <ifname>[_<parent>][_tin<N>] */
+#define QDISC_IF_MAX		64		/* ifindex -> name cache */
+#define QDISC_TIN_MAX		8		/* cake diffserv8 */
+#define QDISC_NL_BUF_LEN	32768
+
+/* counters (reported as deltas) first, then gauges */
+enum {
+	QDISC_BYTES,
+	QDISC_PACKETS,
+	QDISC_DROPS,
+	QDISC_OVERLIMITS,
+	QDISC_REQUEUES,
+	QDISC_ECN_MARKS,
+	_QDISC_CNT_MAX,
+	QDISC_BACKLOG = _QDISC_CNT_MAX,	/* bytes */
+	QDISC_QLEN,
+	QDISC_PEAK_DELAY,				/* us, cake tins */
+	QDISC_AVG_DELAY,
+	QDISC_BASE_DELAY,
+	_QDISC_VAL_MAX,
+};
+
+struct qdisc_stat_ent {
+	char label[QDISC_LABEL_LEN];	/* sanitized */
+	char kind[QDISC_KIND_LEN];
+	bool is_tin;
+	bool has_delta;					/* false on the first scan */
+	uint32_t valid;					/* bits of the values */
+	uint64_t val[_QDISC_VAL_MAX];	/* delta for counters */
+};
+
+#ifdef WITH_QDISC_STAT
+int qdisc_stat_scan(void);
+void qdisc_stat_save(struct blob_buf *buf, const char *name);
+void qdisc_stat_load(struct blob_attr *attr);
+int qdisc_stat_get(struct qdisc_stat_ent *ents, int n);
+const char *qdisc_stat_val_name(int val);
+void qdisc_stat_close(void);
+#else
+static inline int qdisc_stat_scan(void) { return -1; }
+static inline void qdisc_stat_save(struct blob_buf *buf, const char *name) {}
+static inline void qdisc_stat_load(struct blob_attr *attr) {}
+static inline int qdisc_stat_get(struct qdisc_stat_ent *ents, int n)
+{
+	return 0;
+}
+static inline const char *qdisc_stat_val_name(int val) { return ""; }
+static inline void qdisc_stat_close(void) {}
+#endif
+
+#endif
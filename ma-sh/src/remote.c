@@ -0,0 +1,442 @@
+/*
+ * remote devices for the aggregator mode
+ *
+ * The same ubus methods as the local collection are called on the remote
+ * devices through rpcd JSON-RPC, so small APs need neither curl nor
+ * ca-certificates. All methods are called in one batch request per
+ * device, and the requests to the devices are run concurrently in uloop
+ * with their own timeouts. The session is kept and re-used until rpcd
+ * expires it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libubox/uclient.h>
+#include <libubox/blobmsg_json.h>
+
+#include "output.h"
+#include "remote.h"
+
+/* the responses are wrapped to be parsed as an object */
+#define RESP_PREFIX	"{\"r\":"
+
+enum {
+	RPC_CALL_INFO = 1,
+	RPC_CALL_IFDUMP,
+	RPC_CALL_DEVS,
+	_RPC_CALL_MAX,
+};
+
+static const char * const rpc_calls[][2] = {
+	[RPC_CALL_INFO] = { "system", "info" },
+	[RPC_CALL_IFDUMP] = { "network.interface", "dump" },
+	[RPC_CALL_DEVS] = { "network.device", "status" },
+};
+
+static const struct blobmsg_policy resp_policy =
+	{ .name = "r", .type = BLOBMSG_TYPE_UNSPEC };
+
+enum {
+	RPC_ID,
+	RPC_RESULT,
+	RPC_ERROR,
+	_RPC_MAX,
+};
+
+static const struct blobmsg_policy rpc_policy[] = {
+	[RPC_ID] = { .name = "id", .type = BLOBMSG_TYPE_INT32 },
+	[RPC_RESULT] = { .name = "result", .type = BLOBMSG_TYPE_ARRAY },
+	[RPC_ERROR] = { .name = "error", .type = BLOBMSG_TYPE_TABLE },
+};
+
+/* result -> [ <ubus status>, { ... } ] */
+enum {
+	RPC_RESULT_CODE,
+	RPC_RESULT_DATA,
+	_RPC_RESULT_MAX,
+};
+
+static const struct blobmsg_policy rpc_result_policy[] = {
+	[RPC_RESULT_CODE] = { .type = BLOBMSG_TYPE_INT32 },
+	[RPC_RESULT_DATA] = { .type = BLOBMSG_TYPE_TABLE },
+};
+
+static const struct blobmsg_policy rpc_sid_policy =
+	{ .name = "ubus_rpc_session", .type = BLOBMSG_TYPE_STRING };
+
+static LIST_HEAD(remotes);
+static int pending;
+static remote_result_cb result_cb;
+static remote_done_cb done_cb;
+static struct blob_buf req_buf;
+static struct blob_buf resp_buf;
+
+static void remote_finish(struct remote *r)
+{
+	uclient_disconnect(r->cl);
+	if (--pending == 0 && done_cb)
+		done_cb();
+}
+
+static int build_login(struct remote *r, char **body)
+{
+	void *ary, *tbl;
+
+	blob_buf_init(&req_buf, 0);
+	blobmsg_add_string(&req_buf, "jsonrpc", "2.0");
+	blobmsg_add_u32(&req_buf, "id", 1);
+	blobmsg_add_string(&req_buf, "method", "call");
+	ary = blobmsg_open_array(&req_buf, "params");
+	blobmsg_add_string(&req_buf, NULL, REMOTE_SID_NONE);
+	blobmsg_add_string(&req_buf, NULL, "session");
+	blobmsg_add_string(&req_buf, NULL, "login");
+	tbl = blobmsg_open_table(&req_buf, NULL);
+	blobmsg_add_string(&req_buf, "username", r->user);
+	blobmsg_add_string(&req_buf, "password", r->pass);
+	blobmsg_close_table(&req_buf, tbl);
+	blobmsg_close_array(&req_buf, ary);
+
+	*body = blobmsg_format_json(req_buf.head, true);
+
+	return *body ? 0 : -1;
+}
+
+static int build_calls(struct remote *r, char **body)
+{
+	size_t len = 0, size = 1024;
+	int i;
+
+	*body = malloc(size);
+	if (!*body)
+		return -1;
+
+	(*body)[len++] = '[';
+	for (i = RPC_CALL_INFO; i < _RPC_CALL_MAX; i++) {
+		len += snprintf(*body + len, size - len,
+				"%s{\"jsonrpc\":\"2.0\",\"id\":%d,\"method\":\"call\","
+				"\"params\":[\"%s\",\"%s\",\"%s\",{}]}",
+				i > RPC_CALL_INFO ? "," : "", i, r->sid,
+				rpc_calls[i][0], rpc_calls[i][1]);
+	}
+	snprintf(*body + len, size - len, "]");
+
+	return 0;
+}
+
+static int remote_request(struct remote *r, bool login)
+{
+	char *body;
+	int ret;
+
+	if (login ? build_login(r, &body) : build_calls(r, &body))
+		return -1;
+
+	r->login = login;
+	r->status = 0;
+	r->resp_len = strlen(RESP_PREFIX);
+	memcpy(r->resp, RESP_PREFIX, r->resp_len);
+
+	uclient_set_timeout(r->cl, r->timeout * 1000);
+	ret = uclient_connect(r->cl);
+	if (ret)
+		goto out;
+	uclient_http_set_request_type(r->cl, "POST");
+	uclient_http_reset_headers(r->cl);
+	uclient_http_set_header(r->cl, "Content-Type", "application/json");
+	uclient_write(r->cl, body, strlen(body));
+	ret = uclient_request(r->cl);
+	if (ret)
+		uclient_disconnect(r->cl);
+
+out:
+	free(body);
+
+	return ret;
+}
+
+/* ubus_rpc_session is 32 hex digits */
+static int parse_login(struct remote *r, struct blob_attr *resp)
+{
+	struct blob_attr *tb[_RPC_MAX], *tb_res[_RPC_RESULT_MAX], *sid;
+	const char *str;
+	int i;
+
+	blobmsg_parse(rpc_policy, _RPC_MAX, tb,
+			blobmsg_data(resp), blobmsg_data_len(resp));
+	if (!tb[RPC_RESULT])
+		return -1;
+	blobmsg_parse_array(rpc_result_policy, _RPC_RESULT_MAX, tb_res,
+			blobmsg_data(tb[RPC_RESULT]),
+			blobmsg_data_len(tb[RPC_RESULT]));
+	if (!tb_res[RPC_RESULT_CODE] || blobmsg_get_u32(tb_res[RPC_RESULT_CODE]) ||
+	    !tb_res[RPC_RESULT_DATA])
+		return -1;
+
+	blobmsg_parse(&rpc_sid_policy, 1, &sid,
+			blobmsg_data(tb_res[RPC_RESULT_DATA]),
+			blobmsg_data_len(tb_res[RPC_RESULT_DATA]));
+	if (!sid)
+		return -1;
+	str = blobmsg_get_string(sid);
+	if (strlen(str) != REMOTE_SID_LEN)
+		return -1;
+	for (i = 0; i < REMOTE_SID_LEN; i++) {
+		if (!((str[i] >= '0' && str[i] <= '9') ||
+		      (str[i] >= 'a' && str[i] <= 'f')))
+			return -1;
+	}
+	strcpy(r->sid, str);
+
+	return 0;
+}
+
+/* returns 1 if the session has been expired */
+static int parse_calls(struct remote *r, struct blob_attr *resp)
+{
+	struct blob_attr *res[_RPC_CALL_MAX] = { NULL };
+	struct blob_attr *tb[_RPC_MAX], *tb_res[_RPC_RESULT_MAX], *cur;
+	unsigned rem;
+	int id;
+
+	if (blobmsg_type(resp) != BLOBMSG_TYPE_ARRAY)
+		return -1;
+
+	blobmsg_for_each_attr(cur, resp, rem) {
+		blobmsg_parse(rpc_policy, _RPC_MAX, tb,
+				blobmsg_data(cur), blobmsg_data_len(cur));
+		if (!tb[RPC_ID])
+			continue;
+		id = blobmsg_get_u32(tb[RPC_ID]);
+		if (id < RPC_CALL_INFO || id >= _RPC_CALL_MAX)
+			continue;
+		/* -32002: access denied (invalid session) */
+		if (tb[RPC_ERROR])
+			return 1;
+		if (!tb[RPC_RESULT])
+			continue;
+
+		blobmsg_parse_array(rpc_result_policy, _RPC_RESULT_MAX, tb_res,
+				blobmsg_data(tb[RPC_RESULT]),
+				blobmsg_data_len(tb[RPC_RESULT]));
+		if (!tb_res[RPC_RESULT_CODE] ||
+		    blobmsg_get_u32(tb_res[RPC_RESULT_CODE]))
+			continue;
+		res[id] = tb_res[RPC_RESULT_DATA];
+	}
+
+	if (!res[RPC_CALL_INFO])
+		return -1;
+	if (result_cb)
+		result_cb(r, res[RPC_CALL_INFO], res[RPC_CALL_IFDUMP],
+				res[RPC_CALL_DEVS]);
+
+	return 0;
+}
+
+static void remote_error(struct remote *r, const char *msg)
+{
+	fprintf(stderr, "err: remote \"%s\": %s\n", r->url, msg);
+	remote_finish(r);
+}
+
+static void remote_header_done(struct uclient *cl)
+{
+	struct remote *r = cl->priv;
+
+	r->status = cl->status_code;
+}
+
+static void remote_data_read(struct uclient *cl)
+{
+	struct remote *r = cl->priv;
+	char *buf;
+	int len;
+
+	do {
+		/* keep room for "}\0" */
+		if (r->resp_size - r->resp_len < 512 + 2) {
+			if (r->resp_size >= REMOTE_RESP_MAX) {
+				remote_error(r, "too large response");
+				return;
+			}
+			buf = realloc(r->resp, r->resp_size * 2);
+			if (!buf) {
+				remote_error(r, "out of memory");
+				return;
+			}
+			r->resp = buf;
+			r->resp_size *= 2;
+		}
+		len = uclient_read(cl, r->resp + r->resp_len,
+				r->resp_size - r->resp_len - 2);
+		if (len > 0)
+			r->resp_len += len;
+	} while (len > 0);
+}
+
+static void remote_data_eof(struct uclient *cl)
+{
+	struct blob_attr *resp;
+	struct remote *r = cl->priv;
+	int ret;
+
+	if (r->status != 200) {
+		remote_error(r, "unexpected HTTP status");
+		return;
+	}
+
+	strcpy(r->resp + r->resp_len, "}");
+	blob_buf_init(&resp_buf, 0);
+	if (!blobmsg_add_json_from_string(&resp_buf, r->resp)) {
+		remote_error(r, "invalid response");
+		return;
+	}
+	blobmsg_parse(&resp_policy, 1, &resp,
+			blob_data(resp_buf.head), blob_len(resp_buf.head));
+	if (!resp) {
+		remote_error(r, "invalid response");
+		return;
+	}
+
+	if (r->login) {
+		if (parse_login(r, resp)) {
+			remote_error(r, "login failed");
+			return;
+		}
+		if (remote_request(r, false))
+			remote_error(r, "failed to send request");
+		return;
+	}
+
+	ret = parse_calls(r, resp);
+	if (ret > 0) {
+		/* expired, login again only once in a poll */
+		r->sid[0] = '\0';
+		if (r->relogin || remote_request(r, true)) {
+			remote_error(r, "access denied");
+			return;
+		}
+		r->relogin = true;
+		return;
+	}
+	if (ret < 0) {
+		remote_error(r, "no result of \"system info\"");
+		return;
+	}
+
+	remote_finish(r);
+}
+
+static void remote_http_error(struct uclient *cl, int code)
+{
+	struct remote *r = cl->priv;
+
+	remote_error(r, code == UCLIENT_ERROR_TIMEDOUT ?
+			"timed out" : "connection failed");
+}
+
+static const struct uclient_cb remote_cb = {
+	.header_done = remote_header_done,
+	.data_read = remote_data_read,
+	.data_eof = remote_data_eof,
+	.error = remote_http_error,
+};
+
+int remote_add(const char *url, const char *user, const char *pass,
+	       const char *hostid, unsigned int timeout)
+{
+	struct remote *r;
+
+	if (strlen(url) >= REMOTE_URL_LEN || strlen(user) >= REMOTE_USER_LEN ||
+	    strlen(pass) >= REMOTE_PASS_LEN || strlen(hostid) != 11) {
+		fprintf(stderr, "err: invalid remote \"%s\"\n", url);
+		return -1;
+	}
+
+	r = calloc(1, sizeof(*r));
+	if (!r)
+		return -1;
+	strcpy(r->url, url);
+	strcpy(r->user, user);
+	strcpy(r->pass, pass);
+	strcpy(r->hostid, hostid);
+	r->timeout = timeout ? timeout : REMOTE_TIMEOUT_DEF;
+
+	r->resp_size = 4096;
+	r->resp = malloc(r->resp_size);
+	r->cl = uclient_new(r->url, NULL, &remote_cb);
+	if (!r->resp || !r->cl) {
+		fprintf(stderr, "err: invalid remote \"%s\"\n", url);
+		goto err;
+	}
+	r->cl->priv = r;
+	/* mostly self-signed certificates of the devices */
+	if (!strncmp(r->url, "https://", 8) && output_set_ssl(r->cl, false))
+		goto err;
+
+	list_add_tail(&r->list, &remotes);
+
+	return 0;
+
+err:
+	if (r->cl)
+		uclient_free(r->cl);
+	free(r->resp);
+	free(r);
+
+	return -1;
+}
+
+bool remote_empty(void)
+{
+	return list_empty(&remotes);
+}
+
+/*
+ * poll all remote devices, result is called for each succeeded one and
+ * done after all requests are finished, returns the number of started
+ * requests (< 0: the previous poll is still running)
+ */
+int remote_poll(remote_result_cb result, remote_done_cb done)
+{
+	struct remote *r;
+
+	if (pending > 0)
+		return -1;
+
+	result_cb = result;
+	done_cb = NULL;
+	list_for_each_entry(r, &remotes, list) {
+		r->relogin = false;
+		if (remote_request(r, !r->sid[0])) {
+			fprintf(stderr, "err: remote \"%s\": failed to send request\n",
+					r->url);
+			continue;
+		}
+		pending++;
+	}
+	/* not called synchronously in this function */
+	done_cb = done;
+
+	return pending;
+}
+
+void remote_free_all(void)
+{
+	struct remote *r, *tmp;
+
+	/* complete the running poll without the remaining results */
+	if (pending > 0 && done_cb)
+		done_cb();
+
+	list_for_each_entry_safe(r, tmp, &remotes, list) {
+		list_del(&r->list);
+		uclient_free(r->cl);
+		free(r->resp);
+		free(r);
+	}
+	pending = 0;
+	blob_buf_free(&req_buf);
+	blob_buf_free(&resp_buf);
+}
@@ -0,0 +1,83 @@
+#ifndef REMOTE_H
+#define REMOTE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <libubox/list.h>
+#include <libubox/blobmsg.h>
+
+#define REMOTE_URL_LEN		128
+#define REMOTE_USER_LEN		32
+#define REMOTE_PASS_LEN		64
+#define REMOTE_SID_LEN		32
+#define REMOTE_SID_NONE		"00000000000000000000000000000000"
+#define REMOTE_RESP_MAX		(256 * 1024)
+#define REMOTE_IF_MAX		32
+#define REMOTE_TIMEOUT_DEF	5
+
+struct uclient;
+
+/* l3 device counters of the previous poll */
+struct remote_if {
+	char name[32];
+	uint64_t txb;
+	uint64_t rxb;
+};
+
+/*
+ * remote OpenWrt device polled through rpcd JSON-RPC (uhttpd-mod-ubus)
+ * the user needs read access to "system", "network.interface" and
+ * "network.device" in its rpcd ACL
+ */
+struct remote {
+	struct list_head list;
+	char url[REMOTE_URL_LEN];		/* http://<host>/ubus */
+	char user[REMOTE_USER_LEN];
+	char pass[REMOTE_PASS_LEN];
+	char hostid[12];
+	unsigned int timeout;			/* sec */
+
+	char sid[REMOTE_SID_LEN + 1];	/* ubus_rpc_session */
+	struct uclient *cl;
+	bool login;						/* in session.login */
+	bool relogin;					/* session expired once */
+	int status;
+	char *resp;
+	size_t resp_len;
+	size_t resp_size;
+
+	struct remote_if ifs[REMOTE_IF_MAX];
+	int if_cnt;
+	bool if_valid;
+};
+
+/* "system info", "network.interface dump" and "network.device status" */
+typedef void (*remote_result_cb)(struct remote *r, struct blob_attr *info,
+				 struct blob_attr *ifdump,
+				 struct blob_attr *devs);
+typedef void (*remote_done_cb)(void);
+
+#ifdef WITH_REMOTE
+int remote_add(const char *url, const char *user, const char *pass,
+	       const char *hostid, unsigned int timeout);
+bool remote_empty(void);
+int remote_poll(remote_result_cb result, remote_done_cb done);
+void remote_free_all(void);
+#else
+static inline int remote_add(const char *url, const char *user,
+			     const char *pass, const char *hostid,
+			     unsigned int timeout)
+{
+	fprintf(stderr, "err: remotes are not supported in this build\n");
+	return -1;
+}
+static inline bool remote_empty(void) { return true; }
+static inline int remote_poll(remote_result_cb result, remote_done_cb done)
+{
+	return 0;
+}
+static inline void remote_free_all(void) {}
+#endif
+
+#endif
@@ -0,0 +1,84 @@
+/*
+ * self-instrumentation of the collection
+ *
+ * The elapsed time of each stage is accumulated for the current
+ * collection, and moved to the "last" set when the next one starts. The
+ * resident collector reports the last complete collection as agent
+ * metrics, the one-shot commands report the stages measured so far.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "trace.h"
+
+bool trace_enabled = false;
+
+static const char * const trace_names[] = {
+	[TRACE_PROCFS] = "procfs",
+	[TRACE_PROC_TOP] = "proc_top",
+	[TRACE_UBUS] = "ubus",
+	[TRACE_NETLINK] = "netlink",
+	[TRACE_JSON] = "json",
+	[TRACE_HISTORY] = "history",
+	[TRACE_TOTAL] = "total",
+};
+
+static struct trace_stage cur[_TRACE_MAX];
+static struct trace_stage last[_TRACE_MAX];
+static bool last_valid = false;
+
+/* in usec, monotonic */
+uint64_t trace_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void trace_end(int stage, uint64_t start)
+{
+	cur[stage].us += trace_now() - start;
+	cur[stage].cnt++;
+}
+
+/* start the next collection */
+void trace_cycle(void)
+{
+	memcpy(last, cur, sizeof(last));
+	memset(cur, 0, sizeof(cur));
+	last_valid = true;
+}
+
+const struct trace_stage *trace_get(int stage)
+{
+	return last_valid ? &last[stage] : &cur[stage];
+}
+
+const char *trace_name(int stage)
+{
+	return trace_names[stage];
+}
+
+/* per-stage breakdown of the current collection to stderr */
+void trace_print(const char *label)
+{
+	int i;
+
+	if (!trace_enabled)
+		return;
+
+	fprintf(stderr, "trace: %s:", label);
+	for (i = 0; i < _TRACE_MAX; i++) {
+		if (!cur[i].cnt)
+			continue;
+		fprintf(stderr, " %s %llu.%03llu ms (%u)", trace_names[i],
+				(unsigned long long)cur[i].us / 1000,
+				(unsigned long long)cur[i].us % 1000, cur[i].cnt);
+	}
+	fprintf(stderr, "\n");
+}
@@ -0,0 +1,33 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* stages of a collection, measured without nesting */
+enum {
+	TRACE_PROCFS,		/* /proc and /sys parsing */
+	TRACE_PROC_TOP,		/* /proc/<pid>/stat scan */
+	TRACE_UBUS,			/* ubus_lookup_call() */
+	TRACE_NETLINK,		/* rtnetlink dumps */
+	TRACE_JSON,			/* formatting for stdout, file and outputs */
+	TRACE_HISTORY,
+	TRACE_TOTAL,		/* whole collection */
+	_TRACE_MAX,
+};
+
+struct trace_stage {
+	uint64_t us;
+	unsigned int cnt;
+};
+
+extern bool trace_enabled;
+
+uint64_t trace_now(void);
+void trace_end(int stage, uint64_t start);
+void trace_cycle(void);
+const struct trace_stage *trace_get(int stage);
+const char *trace_name(int stage);
+void trace_print(const char *label);
+
+#endif
@@ -0,0 +1,135 @@
+/*
+ * helpers shared by the collectors
+ */
+
+#include <string.h>
+
+#include "util.h"
+
+/* chars other than [0-9A-Za-z_-] are not allowed in the metric names */
+void metric_sanitize(char *str)
+{
+	for (; *str; str++) {
+		if (!((*str >= '0' && *str <= '9') ||
+		      (*str >= 'a' && *str <= 'z') ||
+		      (*str >= 'A' && *str <= 'Z') ||
+		      *str == '-' || *str == '_'))
+			*str = '_';
+	}
+}
+
+/* len chars of src (not terminated) into dst of size, sanitized */
+void metric_sanitize_copy(char *dst, const char *src, size_t len,
+			  size_t size)
+{
+	if (len >= size)
+		len = size - 1;
+	memcpy(dst, src, len);
+	dst[len] = '\0';
+	metric_sanitize(dst);
+}
+
+/* FNV-1a */
+static uint32_t hash_name(const char *name)
+{
+	uint32_t h = 2166136261U;
+
+	for (; *name; name++)
+		h = (h ^ (uint8_t)*name) * 16777619U;
+
+	return h;
+}
+
+/* small values are stored as int32 through json */
+static uint64_t get_counter(struct blob_attr *attr)
+{
+	return blobmsg_type(attr) == BLOBMSG_TYPE_INT32 ?
+			blobmsg_get_u32(attr) : blobmsg_get_u64(attr);
+}
+
+/*
+ * load name -> [counters] table of the previous scan, a single value
+ * instead of the array is loaded as one counter
+ */
+void prev_table_load(struct prev_table *t, struct blob_attr *attr)
+{
+	struct blob_attr *cur, *val;
+	unsigned rem, rem2;
+	const char *name;
+	uint64_t *cnt;
+	uint32_t h;
+	int n;
+
+	t->len = 0;
+	t->loaded = false;
+	memset(t->hash, 0, sizeof(*t->hash) * t->hash_size);
+	if (!attr)
+		return;
+
+	blobmsg_for_each_attr(cur, attr, rem) {
+		if (t->len >= t->max)
+			break;
+		/* truncated names may match the others */
+		name = blobmsg_name(cur);
+		if (strlen(name) >= t->name_len)
+			continue;
+
+		cnt = t->cnt + t->len * t->cnt_max;
+		n = 0;
+		if (blobmsg_type(cur) == BLOBMSG_TYPE_ARRAY) {
+			blobmsg_for_each_attr(val, cur, rem2) {
+				if (n >= t->cnt_max)
+					break;
+				cnt[n++] = get_counter(val);
+			}
+		} else {
+			cnt[n++] = get_counter(cur);
+		}
+		strcpy(t->names + t->len * t->name_len, name);
+		t->ncnt[t->len] = n;
+
+		h = hash_name(name) & (t->hash_size - 1);
+		while (t->hash[h])
+			h = (h + 1) & (t->hash_size - 1);
+		t->hash[h] = ++t->len;
+	}
+	t->loaded = true;
+}
+
+/*
+ * counters of name in the previous scan, NULL if not loaded, not found
+ * or the number of the counters is not ncnt
+ */
+const uint64_t *prev_table_find(const struct prev_table *t,
+				const char *name, int ncnt)
+{
+	uint32_t h;
+	int idx;
+
+	if (!t->loaded)
+		return NULL;
+
+	h = hash_name(name) & (t->hash_size - 1);
+	while ((idx = t->hash[h])) {
+		idx--;
+		if (!strcmp(t->names + idx * t->name_len, name))
+			return t->ncnt[idx] == ncnt ?
+					t->cnt + idx * t->cnt_max : NULL;
+		h = (h + 1) & (t->hash_size - 1);
+	}
+
+	return NULL;
+}
+
+/* add name -> [counters] of the current scan to the open table */
+void prev_table_add(struct blob_buf *buf, const char *name,
+		    const uint64_t *cnt, int n)
+{
+	void *ary;
+	int i;
+
+	ary = blobmsg_open_array(buf, name);
+	for (i = 0; i < n; i++)
+		blobmsg_add_u64(buf, NULL, cnt[i]);
+	blobmsg_close_array(buf, ary);
+}
@@ -0,0 +1,53 @@
+#ifndef UTIL_H
+#define UTIL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <libubox/blobmsg.h>
+
+/*
+ * name -> [counters] table of the previous scan, loaded from the sysstat
+ * json, with the names indexed by an open addressing hash
+ */
+struct prev_table {
+	int max;					/* entries */
+	int cnt_max;				/* counters per entry */
+	int name_len;
+	int hash_size;				/* must be power of 2 and > max */
+	char *names;
+	uint64_t *cnt;
+	int *ncnt;
+	uint16_t *hash;				/* index + 1, 0: empty slot */
+	int len;
+	bool loaded;
+};
+
+/* static storage of a prev_table */
+#define PREV_TABLE(_var, _max, _cnt_max, _name_len, _hash_size)	\
+	static char _var##_names[_max][_name_len];			\
+	static uint64_t _var##_cnt[_max][_cnt_max];			\
+	static int _var##_ncnt[_max];					\
+	static uint16_t _var##_hash[_hash_size];			\
+	static struct prev_table _var = {				\
+		.max = _max,						\
+		.cnt_max = _cnt_max,					\
+		.name_len = _name_len,					\
+		.hash_size = _hash_size,				\
+		.names = _var##_names[0],				\
+		.cnt = _var##_cnt[0],					\
+		.ncnt = _var##_ncnt,					\
+		.hash = _var##_hash,					\
+	}
+
+void metric_sanitize(char *str);
+void metric_sanitize_copy(char *dst, const char *src, size_t len,
+			  size_t size);
+
+void prev_table_load(struct prev_table *t, struct blob_attr *attr);
+const uint64_t *prev_table_find(const struct prev_table *t,
+				const char *name, int ncnt);
+void prev_table_add(struct blob_buf *buf, const char *name,
+		    const uint64_t *cnt, int n);
+
+#endif
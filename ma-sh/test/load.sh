@@ -0,0 +1,156 @@
+#!/bin/sh
+#
+# N-agent load harness for the posting path of ma-sh
+#
+# Runs N agents concurrently, each posting the metrics to /api/v0/tsdb of
+# the given API base every interval by curl with the same options as
+# func_access_api of ma-sh, and reports per post:
+#   - bytes posted and the time until the reply (avg, p95, max)
+#   - CPU time of this machine (all CPUs, from /proc/stat)
+#   - replies by the result: 2xx, 4xx, 5xx and 000 (timed out or failed)
+#
+# The payload is "ma-tools -h <host id> metricj" with -r (on the router,
+# the real collection is included in the CPU time), or M synthetic
+# metrics otherwise. Against mock-api.py, its counters show the server
+# side of the same run.
+#
+# ex.: 20 agents, 30 posts each every 2s, 5s timeout
+#   ./load.sh -n 20 -c 30 -i 2 -t 5 http://192.168.1.10:8080
+# against mock-api.py with --cert (the handshakes are included per post)
+#   ./load.sh -C mock.crt https://192.168.1.10:8443
+
+AGENTS=10
+POSTS=10
+INTERVAL=1
+METRICS=60
+TIMEOUT=10
+APIKEY="dummy"
+CACERT=
+REAL=
+MA_TOOL="/usr/sbin/ma-tools"
+
+usage() {
+	cat <<EOF
+Usage: $0 [options] <API base URL>
+
+Options:
+  -n <agents>    number of agents (default: $AGENTS)
+  -c <posts>     posts per agent (default: $POSTS)
+  -i <sec>       interval of the posts (default: $INTERVAL)
+  -m <metrics>   synthetic metrics per post (default: $METRICS)
+  -r             post "ma-tools metricj" instead of synthetic metrics
+  -t <sec>       timeout of curl, same as "timeout" of ma-sh (default: $TIMEOUT)
+  -k <key>       API key (default: $APIKEY)
+  -C <file>      CA certificate to verify an https API base (ex.: self-signed)
+EOF
+	exit 1
+}
+
+# busy and total ticks of all CPUs
+cpu_ticks() {
+	awk '/^cpu / {
+		for (i = 2; i <= NF; i++) total += $i
+		print total - $5 - $6, total
+	}' /proc/stat
+}
+
+# Mackerel tsdb JSON of synthetic metrics
+synth_json() {
+	awk -v id="$1" -v n="$2" -v t="$(date +%s)" 'BEGIN {
+		printf "["
+		for (i = 0; i < n; i++)
+			printf "%s{\"hostId\":\"%s\",\"name\":\"custom.load.metric%d\",\"time\":%d,\"value\":%d}",
+				i ? "," : "", id, i, t, i * 1000 + int(rand() * 1000)
+		printf "]"
+	}'
+}
+
+# "<http code> <bytes posted> <total time>" per line into $2
+agent() {
+	local id="$1" out="$2" n=0 json
+
+	while [ $n -lt $POSTS ]; do
+		if [ -n "$REAL" ]; then
+			json="$($MA_TOOL -h "$id" metricj)"
+		else
+			json="$(synth_json "$id" "$METRICS")"
+		fi
+		curl -s "$URL" -XPOST \
+			-H "X-api-key: $APIKEY" -H 'Content-Type: application/json' \
+			--data "$json" \
+			-o /dev/null -w '%{http_code} %{size_upload} %{time_total}\n' \
+			-m "$TIMEOUT" ${CACERT:+--cacert "$CACERT"} >> "$out"
+		n=$((n + 1))
+		[ $n -lt $POSTS ] && sleep "$INTERVAL"
+	done
+}
+
+while getopts n:c:i:m:rt:k:C: opt; do
+	case "$opt" in
+		n) AGENTS="$OPTARG" ;;
+		c) POSTS="$OPTARG" ;;
+		i) INTERVAL="$OPTARG" ;;
+		m) METRICS="$OPTARG" ;;
+		r) REAL=1 ;;
+		t) TIMEOUT="$OPTARG" ;;
+		k) APIKEY="$OPTARG" ;;
+		C) CACERT="$OPTARG" ;;
+		*) usage ;;
+	esac
+done
+shift $((OPTIND - 1))
+[ $# -eq 1 ] || usage
+URL="${1%/}/api/v0/tsdb"
+
+if [ -n "$REAL" ] && [ ! -x "$MA_TOOL" ]; then
+	echo "err: $MA_TOOL not found" >&2
+	exit 1
+fi
+
+TMP_DIR="$(mktemp -d /tmp/ma-load.XXXXXX)" || exit 1
+trap 'rm -rf "$TMP_DIR"' EXIT
+trap 'kill $(jobs -p) 2>/dev/null; exit 1' INT TERM
+
+echo "$AGENTS agents x $POSTS posts every ${INTERVAL}s to $URL" >&2
+set -- $(cpu_ticks)
+busy_start="$1" total_start="$2"
+time_start="$(date +%s)"
+
+i=0
+while [ $i -lt $AGENTS ]; do
+	# 11 chars like the host IDs of Mackerel
+	agent "$(printf 'load%07d' $i)" "$TMP_DIR/agent.$i" &
+	i=$((i + 1))
+done
+wait
+
+set -- $(cpu_ticks)
+busy="$(($1 - busy_start))" total="$(($2 - total_start))"
+elapsed="$(($(date +%s) - time_start))"
+hz="$(getconf CLK_TCK 2>/dev/null || echo 100)"
+
+cat "$TMP_DIR"/agent.* | sort -k 3 -n | awk \
+	-v busy="$busy" -v total="$total" -v hz="$hz" -v elapsed="$elapsed" '
+	{
+		posts++
+		bytes += $2
+		t[posts] = $3
+		sum += $3
+		if ($1 ~ /^2/) ok++
+		else if ($1 ~ /^4/) e4++
+		else if ($1 ~ /^5/) e5++
+		else if ($1 == "000") e0++
+	}
+	END {
+		if (!posts) {
+			print "no posts"
+			exit 1
+		}
+		printf "posts:    %d in %ds (2xx: %d, 4xx: %d, 5xx: %d, 000: %d)\n",
+			posts, elapsed, ok, e4, e5, e0
+		printf "bytes:    %.0f per post\n", bytes / posts
+		printf "time:     avg %.3fs, p95 %.3fs, max %.3fs\n",
+			sum / posts, t[int((posts * 95 + 99) / 100)], t[posts]
+		printf "CPU:      %.1f ms per post (%.1f%% of all CPUs)\n",
+			busy * 1000 / hz / posts, total ? busy * 100 / total : 0
+	}'
@@ -0,0 +1,264 @@
+#!/usr/bin/env python3
+#
+# stand-in of the Mackerel API (/api/v0) for testing ma-sh and ma-tools
+#
+# Answers the endpoints used by ma-sh and the resident collector, with the
+# latency and the errors injected as given, and counts the requests, bytes
+# and metrics per endpoint. Set "apibase" of ma-sh to the URL of this
+# server (ex.: 'http://192.168.1.10:8080'), or run load.sh against it.
+#
+#   POST /api/v0/hosts                      -> {"id": "<new host id>"}
+#   PUT  /api/v0/hosts/<id>                 -> {"id": "<id>"}
+#   POST /api/v0/hosts/<id>/status          -> {"success": true}
+#   POST /api/v0/tsdb                       -> {"success": true}
+#   POST /api/v0/graph-defs/create          -> {"success": true}
+#   POST /api/v0/monitoring/checks/report   -> {"success": true}
+#   GET  /stats                             -> the counters (not injected)
+#
+# The counters are printed every -r seconds and on exit (Ctrl-C or TERM).
+#
+# ex.: 200ms +-100ms, 5% of 503, 2% not answered within 30s
+#   ./mock-api.py -p 8080 -l 200 -j 100 -e 0.05 -H 0.02 -w 30
+#
+# With --cert and --key it answers HTTPS, to include the TLS handshake of
+# the agents in the test. Both ma-sh and ma-tools verify the server, so a
+# self-signed certificate (its CN or SAN must be the address in "apibase")
+# must be added to the CA certificates of the router, ex.:
+#   openssl req -x509 -newkey rsa:2048 -nodes -days 30 -subj /CN=192.168.1.10 \
+#     -addext subjectAltName=IP:192.168.1.10 -keyout mock.key -out mock.crt
+#   ./mock-api.py -p 8443 --cert mock.crt --key mock.key
+#   (on the router: /etc/ssl/certs/mock.crt, apibase 'https://192.168.1.10:8443')
+
+import argparse
+import json
+import random
+import re
+import secrets
+import signal
+import ssl
+import string
+import sys
+import threading
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+HOSTID_CHARS = string.ascii_letters + string.digits
+
+args = None
+lock = threading.Lock()
+stats = {}
+hosts = set()
+started = time.time()
+
+
+def count(kind, code, size, metrics=0, elapsed=0.0):
+    with lock:
+        ent = stats.setdefault(kind, {
+            "requests": 0, "bytes": 0, "metrics": 0, "time": 0.0,
+            "codes": {},
+        })
+        ent["requests"] += 1
+        ent["bytes"] += size
+        ent["metrics"] += metrics
+        ent["time"] += elapsed
+        ent["codes"][str(code)] = ent["codes"].get(str(code), 0) + 1
+
+
+def snapshot():
+    with lock:
+        return {
+            "uptime": round(time.time() - started, 1),
+            "hosts": len(hosts),
+            "endpoints": json.loads(json.dumps(stats)),
+        }
+
+
+def print_stats():
+    snap = snapshot()
+    print("--- %.0fs, %d hosts" % (snap["uptime"], snap["hosts"]),
+          file=sys.stderr)
+    for kind, ent in sorted(snap["endpoints"].items()):
+        n = ent["requests"]
+        codes = " ".join("%s:%d" % c for c in sorted(ent["codes"].items()))
+        print("%-8s %6d req %8.0f bytes/req %6.1f metrics/req "
+              "%6.0f ms/req  %s" % (kind, n, ent["bytes"] / n,
+                                    ent["metrics"] / n,
+                                    ent["time"] * 1000 / n, codes),
+              file=sys.stderr)
+
+
+def classify(method, path):
+    if method == "POST" and path == "/api/v0/hosts":
+        return "register"
+    if method == "PUT" and re.fullmatch(r"/api/v0/hosts/[^/]+", path):
+        return "update"
+    if method == "POST" and re.fullmatch(r"/api/v0/hosts/[^/]+/status",
+                                         path):
+        return "status"
+    if method == "POST" and path == "/api/v0/tsdb":
+        return "tsdb"
+    if method == "POST" and path == "/api/v0/graph-defs/create":
+        return "graphdef"
+    if method == "POST" and path == "/api/v0/monitoring/checks/report":
+        return "check"
+    return None
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+
+    def log_message(self, fmt, *a):
+        if args.verbose:
+            super().log_message(fmt, *a)
+
+    def handle(self):
+        # failed handshakes (ex.: the certificate not trusted) are counted
+        try:
+            super().handle()
+        except ssl.SSLError as e:
+            count("tls", "failed", 0)
+            self.log_message("TLS: %s", e.reason)
+
+    def reply(self, code, body):
+        data = json.dumps(body).encode()
+        self.send_response(code)
+        self.send_header("Content-Type", "application/json")
+        self.send_header("Content-Length", str(len(data)))
+        self.end_headers()
+        self.wfile.write(data)
+
+    def do_GET(self):
+        if self.path == "/stats":
+            self.reply(200, snapshot())
+        else:
+            self.reply(404, {"error": {"message": "not found"}})
+
+    def do_PUT(self):
+        self.handle_api("PUT")
+
+    def do_POST(self):
+        self.handle_api("POST")
+
+    def handle_api(self, method):
+        start = time.time()
+        size = int(self.headers.get("Content-Length") or 0)
+        body = self.rfile.read(size) if size else b""
+        path = self.path.split("?")[0]
+        kind = classify(method, path)
+        if not kind:
+            count("unknown", 404, size)
+            self.reply(404, {"error": {"message": "not found"}})
+            return
+
+        delay = args.latency + random.uniform(-args.jitter, args.jitter)
+        if delay > 0:
+            time.sleep(delay / 1000)
+
+        # injected: not answered (client timeout) or a server error
+        if random.random() < args.hang_rate:
+            time.sleep(args.hang)
+            count(kind, "hang", size, elapsed=time.time() - start)
+            self.close_connection = True
+            return
+        if random.random() < args.error_rate:
+            count(kind, args.error_code, size, elapsed=time.time() - start)
+            self.reply(args.error_code, {"error": {"message": "injected"}})
+            return
+
+        if args.apikey and self.headers.get("X-Api-Key") != args.apikey:
+            count(kind, 403, size, elapsed=time.time() - start)
+            self.reply(403, {"error": {"message": "invalid API key"}})
+            return
+
+        try:
+            data = json.loads(body or b"null")
+        except ValueError:
+            count(kind, 400, size, elapsed=time.time() - start)
+            self.reply(400, {"error": {"message": "invalid JSON"}})
+            return
+
+        metrics = 0
+        if kind == "tsdb":
+            if not isinstance(data, list) or not all(
+                    isinstance(m, dict) and
+                    {"hostId", "name", "time", "value"} <= m.keys()
+                    for m in data):
+                count(kind, 400, size, elapsed=time.time() - start)
+                self.reply(400, {"error": {"message": "invalid metrics"}})
+                return
+            metrics = len(data)
+            with lock:
+                hosts.update(m["hostId"] for m in data)
+
+        if kind == "register":
+            hostid = "".join(secrets.choice(HOSTID_CHARS) for _ in range(11))
+            with lock:
+                hosts.add(hostid)
+            res = {"id": hostid}
+        elif kind == "update":
+            res = {"id": path.split("/")[4]}
+        else:
+            res = {"success": True}
+
+        count(kind, 200, size, metrics, time.time() - start)
+        self.reply(200, res)
+
+
+def reporter():
+    while True:
+        time.sleep(args.report)
+        print_stats()
+
+
+def main():
+    global args
+
+    p = argparse.ArgumentParser(
+        description="stand-in of the Mackerel API for testing")
+    p.add_argument("-b", "--bind", default="0.0.0.0")
+    p.add_argument("-p", "--port", type=int, default=8080)
+    p.add_argument("-k", "--apikey", default="",
+                   help="required X-Api-Key (default: any)")
+    p.add_argument("-l", "--latency", type=float, default=0,
+                   help="added to each reply (ms)")
+    p.add_argument("-j", "--jitter", type=float, default=0,
+                   help="+- of the latency (ms)")
+    p.add_argument("-e", "--error-rate", type=float, default=0,
+                   help="ratio of the replies with the error code (0-1)")
+    p.add_argument("-c", "--error-code", type=int, default=503)
+    p.add_argument("-H", "--hang-rate", type=float, default=0,
+                   help="ratio of the requests not answered (0-1)")
+    p.add_argument("-w", "--hang", type=float, default=30,
+                   help="time until closed without a reply (sec)")
+    p.add_argument("-r", "--report", type=float, default=60,
+                   help="interval of the counters on stderr (sec)")
+    p.add_argument("-v", "--verbose", action="store_true",
+                   help="log each request")
+    p.add_argument("--cert", help="certificate (PEM) to answer HTTPS")
+    p.add_argument("--key", help="private key (PEM) of --cert")
+    args = p.parse_args()
+    if bool(args.cert) != bool(args.key):
+        p.error("--cert and --key are given together")
+
+    srv = ThreadingHTTPServer((args.bind, args.port), Handler)
+    srv.daemon_threads = True
+    if args.cert:
+        ctx = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+        ctx.load_cert_chain(args.cert, args.key)
+        # handshake in the handler thread, not in the accept loop
+        srv.socket = ctx.wrap_socket(srv.socket, server_side=True,
+                                     do_handshake_on_connect=False)
+    signal.signal(signal.SIGTERM, lambda *a: sys.exit(0))
+    threading.Thread(target=reporter, daemon=True).start()
+    print("listening on %s://%s:%d" % ("https" if args.cert else "http",
+                                       args.bind, args.port),
+          file=sys.stderr)
+    try:
+        srv.serve_forever()
+    except (KeyboardInterrupt, SystemExit):
+        pass
+    print_stats()
+
+
+if __name__ == "__main__":
+    main()
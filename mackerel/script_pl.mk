@@ -19,7 +19,7 @@ endef
 define Package/mackerel-plugin-portlink
 $(Package/mackerel-agent/Default)
   TITLE:=portlink plugin for mackerel-agent
-  DEPENDS:=mackerel-agent
+  DEPENDS:=mackerel-agent +ma-sh +@MA_SH_PORTLINK
 endef
 
 define Package/mackerel-plugin-portlink/description
@@ -29,7 +29,7 @@ endef
 define Package/mackerel-plugin-appproto
 $(Package/mackerel-agent/Default)
   TITLE:=appproto plugin for mackerel-agent
-  DEPENDS:=mackerel-agent +nlbwmon
+  DEPENDS:=mackerel-agent +nlbwmon +ma-sh +@MA_SH_APPPROTO
 endef
 
 define Package/mackerel-plugin-appproto/description